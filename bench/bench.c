@@ -0,0 +1,802 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Benchmark of each stage of a search on a synthetic light curve.
+   Loading, folding a single light curve, the period search and
+   plotting are timed separately, the recovered period is compared
+   with the injected one, and every fold kernel which the CPU supports
+   is checked against the scalar kernel. With --prebin the samples are
+   averaged within time bins before the search, as the search would.
+   With --recall the pre-screen is run on many light curves with and
+   without transits instead. */
+
+#include <time.h>
+#include "synth.h"
+
+/* number of trial periods used to check and time the fold kernels */
+#define BENCH_KERNEL_PERIODS  200
+
+/* relative difference in the moments allowed between kernels, which
+   sum the samples in a different order */
+#define BENCH_KERNEL_TOLERANCE  1.0e-4
+
+/* depths of the transits injected into the recall light curves,
+   as fractions of the depth given */
+#define BENCH_RECALL_DEPTHS  4
+
+/* transits which must be observed for a star to count as one which
+   the search could find. With nightly gaps some periods are never
+   seen in transit. */
+#define BENCH_RECALL_OBSERVED  3
+
+static void show_help()
+{
+    printf("waspscanbench: timing of each stage of a search on a synthetic light curve\n\n");
+    printf("     --seed                  Random number seed\n");
+    printf("     --seasons               Number of observing seasons\n");
+    printf("     --nights                Nights within each season\n");
+    printf("     --cadence               Seconds between exposures\n");
+    printf("     --period                Injected orbital period in days, 0=none\n");
+    printf("     --depth                 Fractional depth of the transit\n");
+    printf("     --duration              Duration of the transit in days\n");
+    printf("     --ingress               Fraction of the duration in ingress, 0=box\n");
+    printf(" -0  --min                   Minimum orbital period searched in days\n");
+    printf(" -1  --max                   Maximum orbital period searched in days\n");
+    printf("     --method                Score periods with heuristic (default) or bls\n");
+    printf("     --repeat                Number of times each fast stage is repeated\n");
+    printf("     --save                  Save the synthetic table and exit\n");
+    printf("     --recall                Pre-screen this many stars with and without transits\n");
+    printf("     --prescreen-threshold   Signal to noise needed to pass the pre-screen\n");
+    printf("     --prebin                Search time bins of this fraction of a light curve bucket\n");
+    printf("     --weights               Weight samples by the inverse variance of their errors\n");
+    printf("     --raw                   Also search the flux before correction\n");
+    printf("     --keep-flagged          Keep samples which have a non-zero flag\n");
+    printf(" -h  --help                  Show help\n");
+}
+
+/**
+ * @brief Returns a monotonic time
+ * @returns Time in seconds
+ */
+static double bench_time()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + (t.tv_nsec*1.0e-9);
+}
+
+/**
+ * @brief Describes how a recovered period relates to the injected one
+ * @param injected_days The injected period
+ * @param found_days The recovered period
+ * @param baseline_days Time between the first and last samples, which
+ *        sets the width of a peak in frequency
+ * @returns "recovered", "alias" for a harmonic, or "missed"
+ */
+static const char * bench_recovery(double injected_days, double found_days,
+                                   double baseline_days)
+{
+    double peak_width = 1.0 / baseline_days;
+    int n, m;
+
+    if ((injected_days <= 0) || (found_days <= 0)) return "missed";
+    if (fabs((1.0 / found_days) - (1.0 / injected_days)) < peak_width) {
+        return "recovered";
+    }
+    for (n = 1; n <= DETECT_HARMONICS; n++) {
+        for (m = 1; m <= DETECT_HARMONICS; m++) {
+            if (fabs((1.0 / found_days) - (n / (m*injected_days))) <
+                peak_width) {
+                return "alias";
+            }
+        }
+    }
+    return "missed";
+}
+
+/**
+ * @brief Keeps the unflagged samples of a generated light curve, as
+ *        logfile_load_columns would
+ * @param generated The generated light curve
+ * @param timestamp Returned imaging times, which should be freed
+ * @param series Returned flux, which should be freed
+ * @returns The number of samples, or negative if out of memory
+ */
+static int bench_unflagged(synth_series * generated,
+                           double ** timestamp, float ** series)
+{
+    int i, length = 0;
+
+    *timestamp = (double*)malloc(generated->length*sizeof(double));
+    *series = (float*)malloc(generated->length*sizeof(float));
+    if ((*timestamp == NULL) || (*series == NULL)) {
+        free(*timestamp);
+        free(*series);
+        return -1;
+    }
+    for (i = 0; i < generated->length; i++) {
+        if (generated->flag[i] != 0) continue;
+        (*timestamp)[length] = generated->timestamp[i];
+        (*series)[length] = generated->series[i];
+        length++;
+    }
+    return length;
+}
+
+/**
+ * @brief Counts the transits during which at least half of the depth
+ *        was observed
+ * @param params Description of the transit
+ * @param timestamp Imaging times in seconds, in order
+ * @param length The number of samples
+ * @returns The number of separate transits observed
+ */
+static int bench_transits_observed(synth_parameters * params,
+                                   double timestamp[], int length)
+{
+    int i, observed = 0;
+    double days, transit, last_transit = 0;
+
+    for (i = 0; i < length; i++) {
+        days = timestamp[i] / (60.0*60.0*24.0);
+        if (synth_transit(params, days) < params->depth*0.5f) continue;
+        transit = floor(((days - params->epoch_days) /
+                         params->period_days) + 0.5);
+        if ((observed == 0) || (transit != last_transit)) observed++;
+        last_transit = transit;
+    }
+    return observed;
+}
+
+/**
+ * @brief Pre-screens light curves with transits of several depths and
+ *        at periods spread over the search range, and the same number
+ *        without a transit, reporting the fraction of each which would
+ *        be searched and the time taken compared with a full search.
+ *        Recall is also given for the stars whose transits were
+ *        observed often enough to be found by any search.
+ * @param params Description of the light curves, whose seed, period
+ *        and depth are varied
+ * @param stars Number of light curves with transits, and without
+ * @param min_period_days The minimum orbital period in days
+ * @param max_period_days The maximum orbital period in days
+ * @param threshold Signal to noise needed to pass the pre-screen
+ * @returns zero on success
+ */
+static int bench_recall(synth_parameters * params, int stars,
+                        float min_period_days, float max_period_days,
+                        float threshold)
+{
+    synth_parameters synth;
+    synth_series generated;
+    prescreen_result screen;
+    fold_context fold;
+    transit_candidate result;
+    float * periods = NULL;
+    double * timestamp;
+    float * series;
+    int i, transit, depth, length, status, no_of_periods;
+    int kept[BENCH_RECALL_DEPTHS+1], total[BENCH_RECALL_DEPTHS+1];
+    int kept_observed[BENCH_RECALL_DEPTHS+1];
+    int observed[BENCH_RECALL_DEPTHS+1];
+    float min_snr[BENCH_RECALL_DEPTHS+1], max_snr[BENCH_RECALL_DEPTHS+1];
+    double start, screen_seconds = 0, search_seconds = 0;
+
+    memset(kept, 0, sizeof(kept));
+    memset(total, 0, sizeof(total));
+    memset(kept_observed, 0, sizeof(kept_observed));
+    memset(observed, 0, sizeof(observed));
+    for (i = 0; i < stars*2; i++) {
+        /* the last depth index is used for stars without a transit */
+        transit = (i % 2 == 0);
+        depth = transit ? ((i/2) % BENCH_RECALL_DEPTHS) : BENCH_RECALL_DEPTHS;
+        synth = *params;
+        synth.seed = params->seed + i;
+        synth.period_days = 0;
+        if (transit) {
+            synth.period_days = min_period_days +
+                ((max_period_days - min_period_days) * ((i/2) + 0.5) / stars);
+            synth.epoch_days = synth.start_days +
+                (synth.period_days * (i % 7) / 7.0);
+            synth.depth = params->depth * (depth + 1) / BENCH_RECALL_DEPTHS;
+        }
+        if (synth_generate(&synth, &generated) <= 0) {
+            printf("Unable to generate the light curve\n");
+            return -2;
+        }
+        length = bench_unflagged(&generated, &timestamp, &series);
+        synth_free(&generated);
+        if (length < 0) {
+            printf("Unable to allocate memory for the light curve\n");
+            return -2;
+        }
+
+        start = bench_time();
+        status = prescreen_star(timestamp, series, length,
+                                min_period_days, max_period_days,
+                                threshold, &screen);
+        screen_seconds += bench_time() - start;
+        if (status < 0) {
+            printf("Unable to pre-screen the light curve\n");
+            free(timestamp);
+            free(series);
+            return -4;
+        }
+        if ((total[depth] == 0) || (screen.snr < min_snr[depth])) {
+            min_snr[depth] = screen.snr;
+        }
+        if ((total[depth] == 0) || (screen.snr > max_snr[depth])) {
+            max_snr[depth] = screen.snr;
+        }
+        total[depth]++;
+        kept[depth] += status;
+        if (transit &&
+            (bench_transits_observed(&synth, timestamp, length) >=
+             BENCH_RECALL_OBSERVED)) {
+            observed[depth]++;
+            kept_observed[depth] += status;
+        }
+
+        /* time a full search of the first star to compare with */
+        if (i == 0) {
+            if (fold_context_init(&fold, timestamp, series, length) != 0) {
+                free(timestamp);
+                free(series);
+                return -4;
+            }
+            no_of_periods = period_grid_adaptive(&fold, min_period_days,
+                                                 max_period_days,
+                                                 DETECT_CURVE_LENGTH,
+                                                 GRID_OVERSAMPLE, &periods);
+            start = bench_time();
+            if (no_of_periods > 0) {
+                detect_orbital_period(&fold, periods, no_of_periods,
+                                      DETECT_METHOD_HEURISTIC, &result, 1);
+            }
+            search_seconds = bench_time() - start;
+            free(periods);
+            fold_context_free(&fold);
+        }
+        free(timestamp);
+        free(series);
+    }
+
+    printf("pre-screen threshold %.1f  %d stars with transits  "
+           "%d without  periods %g to %g days\n",
+           threshold, stars, stars, min_period_days, max_period_days);
+    for (depth = 0; depth <= BENCH_RECALL_DEPTHS; depth++) {
+        if (total[depth] == 0) continue;
+        if (depth < BENCH_RECALL_DEPTHS) {
+            printf("depth %.4f  ",
+                   params->depth * (depth + 1) / BENCH_RECALL_DEPTHS);
+        }
+        else {
+            printf("no transit    ");
+        }
+        printf("kept %3d of %3d  %5.1f%%  snr %6.2f to %6.2f",
+               kept[depth], total[depth], kept[depth]*100.0/total[depth],
+               min_snr[depth], max_snr[depth]);
+        if (observed[depth] > 0) {
+            printf("  observed %3d kept %5.1f%%", observed[depth],
+                   kept_observed[depth]*100.0/observed[depth]);
+        }
+        printf("\n");
+    }
+    printf("pre-screen %8.3f s per star  %5.1f%% of a full search "
+           "(%.3f s)\n",
+           screen_seconds / (stars*2),
+           (search_seconds > 0) ?
+           screen_seconds*100.0 / (stars*2) / search_seconds : 0,
+           search_seconds);
+    return 0;
+}
+
+/**
+ * @brief Compares the moments of a fold with those of the scalar kernel.
+ *        Inliers are weights, which like the sums depend upon the order
+ *        in which they're added unless every weight is a whole number.
+ * @param moments Moments from the kernel being checked
+ * @param reference Moments from the scalar kernel
+ * @param mismatches Incremented for each bucket whose counts differ
+ * @param max_difference Returned largest relative difference of the
+ *        inliers and sums
+ */
+static void bench_compare(fold_moments * moments, fold_moments * reference,
+                          int * mismatches, double * max_difference)
+{
+    double difference;
+    int j;
+
+    for (j = 0; j < DETECT_CURVE_LENGTH; j++) {
+        if (moments->count[j] != reference->count[j]) (*mismatches)++;
+        difference = fabs(moments->inliers[j] - reference->inliers[j]) /
+            (fabs(reference->inliers[j]) + 1);
+        if (difference > *max_difference) *max_difference = difference;
+        difference = fabs(moments->sum[j] - reference->sum[j]) /
+            (fabs(reference->sum[j]) + 1);
+        if (difference > *max_difference) *max_difference = difference;
+        difference =
+            fabs(moments->sum_squares[j] - reference->sum_squares[j]) /
+            (fabs(reference->sum_squares[j]) + 1);
+        if (difference > *max_difference) *max_difference = difference;
+    }
+}
+
+/**
+ * @brief Checks each fold kernel which the CPU supports against the
+ *        scalar kernel, and times them. A series with a companion is
+ *        folded together with it, and each is checked.
+ * @param fold Precalculated values for the series
+ * @param min_period_days The minimum orbital period in days
+ * @param max_period_days The maximum orbital period in days
+ * @returns The number of kernels which disagree with the scalar kernel
+ */
+static int bench_kernels(fold_context * fold,
+                         float min_period_days, float max_period_days)
+{
+    fold_moments reference, moments[FOLD_MAX_COLUMNS];
+    int kernel, i, c, mismatches, failures = 0;
+    int columns = (fold->companion != NULL) ? 2 : 1;
+    float period_days, * workspace;
+    double start, elapsed, max_difference;
+    int default_kernel = fold_kernel_select(-1);
+    int tile_periods = fold->tile_periods;
+
+    fold->tile_periods = 1;
+    for (kernel = FOLD_KERNEL_SCALAR; kernel <= FOLD_KERNEL_AVX512;
+         kernel++) {
+        if (fold_kernel_select(kernel) != kernel) continue;
+        workspace =
+            (float*)malloc(fold_bin_workspace(fold, DETECT_CURVE_LENGTH)*
+                           sizeof(float));
+        if (workspace == NULL) {
+            failures++;
+            break;
+        }
+
+        mismatches = 0;
+        max_difference = 0;
+        for (i = 0; i < BENCH_KERNEL_PERIODS; i++) {
+            period_days = min_period_days +
+                ((max_period_days - min_period_days)*i/BENCH_KERNEL_PERIODS);
+            fold_bin_tile(fold, &period_days, 1, DETECT_CURVE_LENGTH,
+                          moments, workspace);
+            for (c = 0; c < columns; c++) {
+                fold_bin_scalar((c == 0) ? fold : fold->companion,
+                                period_days, DETECT_CURVE_LENGTH,
+                                &reference);
+                bench_compare(&moments[c], &reference, &mismatches,
+                              &max_difference);
+            }
+        }
+
+        start = bench_time();
+        for (i = 0; i < BENCH_KERNEL_PERIODS; i++) {
+            period_days = min_period_days +
+                ((max_period_days - min_period_days)*i/BENCH_KERNEL_PERIODS);
+            fold_bin_tile(fold, &period_days, 1, DETECT_CURVE_LENGTH,
+                          moments, workspace);
+        }
+        elapsed = bench_time() - start;
+        free(workspace);
+
+        printf("kernel %-8s %6.2f ns/sample  mismatches %d  max difference %.1e  %s%s\n",
+               fold_kernel_name(kernel),
+               elapsed*1.0e9 / ((double)BENCH_KERNEL_PERIODS*fold->length),
+               mismatches, max_difference,
+               ((mismatches == 0) &&
+                (max_difference < BENCH_KERNEL_TOLERANCE)) ? "ok" : "FAILED",
+               (columns > 1) ? "  with raw flux" : "");
+        if ((mismatches != 0) || (max_difference >= BENCH_KERNEL_TOLERANCE)) {
+            failures++;
+        }
+    }
+    fold->tile_periods = tile_periods;
+    fold_kernel_select(default_kernel);
+    return failures;
+}
+
+/**
+ * @brief Searches a grid of periods, timing the search
+ * @param fold Precalculated values for the series, and any companion
+ * @param periods Grid of orbital periods to be tried
+ * @param no_of_periods The number of orbital periods within the grid
+ * @param method DETECT_METHOD_HEURISTIC or DETECT_METHOD_BLS
+ * @param result Returned best candidate, with a period of zero if none
+ *        was found
+ * @returns Time taken in seconds
+ */
+static double bench_search(fold_context * fold, float periods[],
+                           int no_of_periods, int method,
+                           transit_candidate * result)
+{
+    double start = bench_time();
+
+    if (detect_orbital_period(fold, periods, no_of_periods,
+                              method, result, 1) == 0) {
+        result->period_days = 0;
+    }
+    return bench_time() - start;
+}
+
+int main(int argc, char* argv[])
+{
+    int i, repeat = 3, no_of_periods, failures;
+    int recall = 0, * endpoints;
+    int weighted = 0, raw_flux = 0, keep_flagged = 0, raw_differs = 0;
+    float threshold = PRESCREEN_THRESHOLD, prebin_fraction = 0;
+    int method = DETECT_METHOD_HEURISTIC;
+    float min_period_days = 2.0f, max_period_days = 2.5f;
+    float curve[DETECT_CURVE_LENGTH], density[DETECT_CURVE_LENGTH];
+    char table_filename[256], save_filename[256];
+    double start, elapsed;
+    synth_parameters synth;
+    synth_series generated;
+    prebinned_series binned, raw_binned;
+    fold_context fold, raw;
+    transit_candidate result, raw_result, shared_result;
+    table_layout layout;
+    series_columns loaded;
+    float * periods = NULL;
+    float * weight = NULL, * raw_weight = NULL, * raw_series = NULL;
+    double * timestamp;
+    float * series;
+    double bin_seconds, search_seconds, raw_seconds;
+    arena memory;
+    int length;
+
+    synth_parameters_init(&synth);
+    sprintf(table_filename, "synthetic.tbl");
+    save_filename[0] = 0;
+
+    /* parse the options */
+    for (i = 1; i < argc; i++) {
+        if ((strcmp(argv[i],"-h")==0) ||
+            (strcmp(argv[i],"--help")==0)) {
+            show_help();
+            return 0;
+        }
+        if (strcmp(argv[i],"--seed")==0) {
+            i++;
+            if (i < argc) synth.seed = (unsigned int)atoi(argv[i]);
+        }
+        if (strcmp(argv[i],"--seasons")==0) {
+            i++;
+            if (i < argc) synth.seasons = atoi(argv[i]);
+        }
+        if (strcmp(argv[i],"--nights")==0) {
+            i++;
+            if (i < argc) synth.nights = atoi(argv[i]);
+        }
+        if (strcmp(argv[i],"--cadence")==0) {
+            i++;
+            if (i < argc) synth.cadence_seconds = atof(argv[i]);
+        }
+        if (strcmp(argv[i],"--period")==0) {
+            i++;
+            if (i < argc) synth.period_days = atof(argv[i]);
+        }
+        if (strcmp(argv[i],"--depth")==0) {
+            i++;
+            if (i < argc) synth.depth = atof(argv[i]);
+        }
+        if (strcmp(argv[i],"--duration")==0) {
+            i++;
+            if (i < argc) synth.duration_days = atof(argv[i]);
+        }
+        if (strcmp(argv[i],"--ingress")==0) {
+            i++;
+            if (i < argc) synth.ingress = atof(argv[i]);
+        }
+        if ((strcmp(argv[i],"-0")==0) ||
+            (strcmp(argv[i],"--min")==0)) {
+            i++;
+            if (i < argc) min_period_days = atof(argv[i]);
+        }
+        if ((strcmp(argv[i],"-1")==0) ||
+            (strcmp(argv[i],"--max")==0)) {
+            i++;
+            if (i < argc) max_period_days = atof(argv[i]);
+        }
+        if (strcmp(argv[i],"--method")==0) {
+            i++;
+            if (i < argc) {
+                if (strcmp(argv[i],"bls")==0) {
+                    method = DETECT_METHOD_BLS;
+                }
+                else if (strcmp(argv[i],"heuristic")==0) {
+                    method = DETECT_METHOD_HEURISTIC;
+                }
+                else {
+                    printf("Unknown method %s\n", argv[i]);
+                    return -1;
+                }
+            }
+        }
+        if (strcmp(argv[i],"--repeat")==0) {
+            i++;
+            if (i < argc) repeat = atoi(argv[i]);
+        }
+        if (strcmp(argv[i],"--save")==0) {
+            i++;
+            if (i < argc) sprintf(save_filename,"%s",argv[i]);
+        }
+        if (strcmp(argv[i],"--recall")==0) {
+            i++;
+            if (i < argc) recall = atoi(argv[i]);
+        }
+        if (strcmp(argv[i],"--prescreen-threshold")==0) {
+            i++;
+            if (i < argc) threshold = atof(argv[i]);
+        }
+        if (strcmp(argv[i],"--prebin")==0) {
+            i++;
+            if (i < argc) prebin_fraction = atof(argv[i]);
+        }
+        if (strcmp(argv[i],"--weights")==0) {
+            weighted = 1;
+        }
+        if (strcmp(argv[i],"--raw")==0) {
+            raw_flux = 1;
+        }
+        if (strcmp(argv[i],"--keep-flagged")==0) {
+            keep_flagged = 1;
+        }
+    }
+    if (repeat < 1) repeat = 1;
+    if (recall > 0) {
+        return bench_recall(&synth, recall, min_period_days,
+                            max_period_days, threshold);
+    }
+
+    /* generate */
+    if (synth_generate(&synth, &generated) <= 0) {
+        printf("Unable to generate the light curve\n");
+        return -2;
+    }
+    if (save_filename[0] != 0) {
+        if (synth_save(&generated, save_filename) != 0) {
+            printf("Unable to save %s\n", save_filename);
+            synth_free(&generated);
+            return -3;
+        }
+        printf("%d samples saved to %s\n", generated.length, save_filename);
+        synth_free(&generated);
+        return 0;
+    }
+    if (synth_save(&generated, table_filename) != 0) {
+        printf("Unable to save %s\n", table_filename);
+        synth_free(&generated);
+        return -3;
+    }
+    printf("injected period %.6f days  depth %.4f  duration %.3f days  ingress %.2f\n",
+           synth.period_days, synth.depth, synth.duration_days, synth.ingress);
+    printf("samples %d  seasons %d  nights %d  cadence %.0f s\n",
+           generated.length, synth.seasons, synth.nights,
+           synth.cadence_seconds);
+    synth_free(&generated);
+
+    /* load the columns of the table as the search would */
+    memset(&layout, 0, sizeof(table_layout));
+    layout.name[TABLE_COLUMN_TIME] = "TMID";
+    layout.name[TABLE_COLUMN_FLUX] = "TAMFLUX2";
+    layout.name[TABLE_COLUMN_ERROR] = "TAMFLUX2_ERR";
+    layout.name[TABLE_COLUMN_RAW_FLUX] = "FLUX2";
+    layout.name[TABLE_COLUMN_RAW_ERROR] = "FLUX2_ERR";
+    layout.name[TABLE_COLUMN_FLAG] = "FLAG";
+    layout.index[TABLE_COLUMN_TIME] = 0;
+    layout.index[TABLE_COLUMN_FLUX] = 3;
+    layout.index[TABLE_COLUMN_ERROR] = weighted ? 4 : -1;
+    layout.index[TABLE_COLUMN_RAW_FLUX] = raw_flux ? 1 : -1;
+    layout.index[TABLE_COLUMN_RAW_ERROR] = (weighted && raw_flux) ? 2 : -1;
+    layout.index[TABLE_COLUMN_FLAG] = keep_flagged ? -1 : 8;
+    memset(&memory, 0, sizeof(arena));
+    length = 0;
+    elapsed = 0;
+    for (i = 0; i < repeat; i++) {
+        arena_reset(&memory);
+        start = bench_time();
+        length = logfile_load_columns(table_filename, &layout, &memory,
+                                      &loaded);
+        if ((i == 0) || (bench_time() - start < elapsed)) {
+            elapsed = bench_time() - start;
+        }
+    }
+    if (length <= 0) {
+        printf("Unable to load %s\n", table_filename);
+        arena_free(&memory);
+        return -4;
+    }
+    timestamp = loaded.timestamp;
+    series = loaded.series;
+    printf("load      %8.3f s  %12.0f samples/s\n",
+           elapsed, length / elapsed);
+
+    /* inverse variance weights from the errors */
+    if (weighted) {
+        weight = (float*)arena_alloc(&memory, length*sizeof(float));
+        raw_weight = (float*)arena_alloc(&memory, length*sizeof(float));
+        if ((weight == NULL) || (raw_weight == NULL)) {
+            printf("Unable to allocate memory for the weights\n");
+            arena_free(&memory);
+            return -4;
+        }
+        fold_error_weights(loaded.error, length, weight);
+        if (raw_flux) fold_error_weights(loaded.raw_error, length, raw_weight);
+        else raw_weight = NULL;
+    }
+    if (raw_flux) raw_series = loaded.raw_series;
+
+    /* average samples within time bins, as the search would */
+    memset(&binned, 0, sizeof(prebinned_series));
+    memset(&raw_binned, 0, sizeof(prebinned_series));
+    if (prebin_fraction > 0) {
+        start = bench_time();
+        bin_seconds = prebin_fraction*min_period_days*60*60*24 /
+            DETECT_CURVE_LENGTH;
+        endpoints = (int*)malloc((length*2 + 1)*sizeof(int));
+        if ((endpoints == NULL) ||
+            (detect_endpoints(timestamp, length, endpoints) == 0) ||
+            (prebin_series(timestamp, series, weight, length, endpoints,
+                           bin_seconds, &memory, &binned) <= 0) ||
+            ((raw_series != NULL) &&
+             (prebin_series(timestamp, raw_series, raw_weight, length,
+                            endpoints, bin_seconds, &memory,
+                            &raw_binned) <= 0))) {
+            printf("Unable to average the samples\n");
+            free(endpoints);
+            arena_free(&memory);
+            return -4;
+        }
+        free(endpoints);
+        elapsed = bench_time() - start;
+        printf("prebin    %8.3f s  %12d bins     %12.1f samples/bin\n",
+               elapsed, binned.length, (double)length / binned.length);
+        if (raw_series != NULL) raw_series = raw_binned.series;
+    }
+
+    if (((binned.length == 0) &&
+         (fold_context_init(&fold, timestamp, series, length) != 0)) ||
+        ((binned.length > 0) &&
+         (fold_context_init(&fold, binned.timestamp, binned.series,
+                            binned.length) != 0))) {
+        printf("Unable to allocate memory for the search\n");
+        arena_free(&memory);
+        return -4;
+    }
+    if (binned.length > 0) {
+        fold_context_weight(&fold, binned.weight, binned.squares);
+    }
+    else if (weight != NULL) {
+        fold_context_weight(&fold, weight, NULL);
+    }
+
+    /* fold a single light curve at the injected period */
+    start = bench_time();
+    for (i = 0; i < repeat*100; i++) {
+        light_curve(timestamp, series, length, (float)synth.period_days,
+                    curve, density, DETECT_CURVE_LENGTH);
+    }
+    elapsed = (bench_time() - start) / (repeat*100);
+    printf("curve     %8.5f s  %12.0f samples/s\n",
+           elapsed, length / elapsed);
+
+    /* search for the period */
+    no_of_periods = period_grid_adaptive(&fold,
+                                         min_period_days, max_period_days,
+                                         DETECT_CURVE_LENGTH,
+                                         GRID_OVERSAMPLE, &periods);
+    if (no_of_periods <= 0) {
+        printf("Unable to create the period grid\n");
+        fold_context_free(&fold);
+        arena_free(&memory);
+        return -4;
+    }
+    elapsed = bench_search(&fold, periods, no_of_periods, method, &result);
+    search_seconds = elapsed;
+    printf("search    %8.3f s  %12.0f periods/s  %12.0f samples/s  %d periods\n",
+           elapsed, no_of_periods / elapsed,
+           (double)no_of_periods*fold.length / elapsed, no_of_periods);
+    printf("period    %.6f days  injected %.6f days  error %.2e  %s\n",
+           result.period_days, synth.period_days,
+           fabs(result.period_days - synth.period_days) / synth.period_days,
+           bench_recovery(synth.period_days, result.period_days,
+                          fold.baseline_days));
+
+    /* the raw flux searched on its own, then together with the
+       corrected flux, which should find the same periods in less
+       time than the two separate searches */
+    if (raw_series != NULL) {
+        if (fold_context_init(&raw, (binned.length > 0) ?
+                              binned.timestamp : timestamp,
+                              raw_series, fold.length) != 0) {
+            printf("Unable to allocate memory for the search\n");
+            free(periods);
+            fold_context_free(&fold);
+            arena_free(&memory);
+            return -4;
+        }
+        if (binned.length > 0) {
+            fold_context_weight(&raw, raw_binned.weight, raw_binned.squares);
+        }
+        else if (raw_weight != NULL) {
+            fold_context_weight(&raw, raw_weight, NULL);
+        }
+        raw_seconds = bench_search(&raw, periods, no_of_periods, method,
+                                   &raw_result);
+        fold_context_free(&raw);
+        printf("raw       %8.3f s  %12.0f periods/s  period %.6f days\n",
+               raw_seconds, no_of_periods / raw_seconds,
+               raw_result.period_days);
+
+        if (fold_context_companion(&fold, &raw, raw_series) != 0) {
+            printf("Unable to allocate memory for the search\n");
+            free(periods);
+            fold_context_free(&fold);
+            arena_free(&memory);
+            return -4;
+        }
+        if (binned.length > 0) {
+            fold_context_weight(&raw, raw_binned.weight, raw_binned.squares);
+        }
+        else if (raw_weight != NULL) {
+            fold_context_weight(&raw, raw_weight, NULL);
+        }
+        raw.results = &shared_result;
+        elapsed = bench_search(&fold, periods, no_of_periods, method,
+                               &result);
+        if (raw.no_of_results == 0) shared_result.period_days = 0;
+        printf("shared    %8.3f s  %12.0f periods/s  %.2fx separate  "
+               "periods %.6f %.6f days  %s\n",
+               elapsed, no_of_periods / elapsed,
+               (search_seconds + raw_seconds) / elapsed,
+               result.period_days, shared_result.period_days,
+               (shared_result.period_days == raw_result.period_days) ?
+               "same" : "DIFFERENT");
+        raw_differs =
+            (shared_result.period_days != raw_result.period_days);
+    }
+    free(periods);
+
+    /* plot */
+    start = bench_time();
+    plot_light_curve_distribution("Synthetic Light Curve",
+                                  timestamp, series, length,
+                                  "synthetic_distr.png", 1024, 640,
+                                  0.44, 0.93, "Flux",
+                                  (float)synth.period_days, 1.0f);
+    plot_light_curve("Synthetic Light Curve",
+                     timestamp, series, length,
+                     "synthetic.png", 1024, 640,
+                     0.44, 0.93, "Flux",
+                     (float)synth.period_days, 1.0f);
+    elapsed = bench_time() - start;
+    printf("plot      %8.3f s  %12.0f samples/s\n",
+           elapsed, 2 * length / elapsed);
+
+    /* every kernel should give the same moments as the scalar one */
+    failures = bench_kernels(&fold, min_period_days, max_period_days) +
+        raw_differs;
+
+    if (raw_series != NULL) fold_context_free(&raw);
+    fold_context_free(&fold);
+    arena_free(&memory);
+    return (failures == 0) ? 0 : 1;
+}
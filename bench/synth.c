@@ -0,0 +1,222 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Synthetic light curves resembling those of SuperWASP, with nightly
+   gaps, seasons lost to the weather, correlated noise and a transit
+   of known shape, so that the search can be timed and checked without
+   the archive. The random numbers are generated here rather than by
+   the C library so that a seed gives the same series everywhere. */
+
+#include "synth.h"
+
+/**
+ * @brief Returns a uniformly distributed random number
+ * @param state State of the generator, which is updated
+ * @returns Value in the range 0 to 1
+ */
+static double synth_uniform(unsigned int * state)
+{
+    /* xorshift */
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return (*state >> 8) / (double)(1 << 24);
+}
+
+/**
+ * @brief Returns a normally distributed random number
+ * @param state State of the generator, which is updated
+ * @returns Value with zero mean and unit standard deviation
+ */
+static double synth_gaussian(unsigned int * state)
+{
+    double u1 = synth_uniform(state), u2 = synth_uniform(state);
+
+    if (u1 < 1.0e-12) u1 = 1.0e-12;
+    return sqrt(-2.0*log(u1)) * cos(2.0*M_PI*u2);
+}
+
+/**
+ * @brief Sets default values resembling a bright SuperWASP star with
+ *        a hot jupiter, observed for two seasons
+ * @param params The parameters
+ */
+void synth_parameters_init(synth_parameters * params)
+{
+    memset(params, 0, sizeof(synth_parameters));
+    params->seed = 1;
+    params->start_days = 120.0;
+    params->seasons = 2;
+    params->nights = 120;
+    params->weather_loss = 0.2f;
+    params->night_hours = 8.0f;
+    params->cadence_seconds = 300.0f;
+    params->flux = 10000.0f;
+    params->white_noise = 0.01f;
+    params->red_noise = 0.003f;
+    params->red_noise_minutes = 30.0f;
+    params->night_offset = 0.002f;
+    params->flagged = 0.02f;
+    params->period_days = 2.2193;
+    params->epoch_days = params->start_days + 0.37;
+    params->depth = 0.015f;
+    params->duration_days = 0.1f;
+    params->ingress = 0.15f;
+}
+
+/**
+ * @brief Returns the fraction of light blocked by the transit
+ * @param params Description of the transit
+ * @param days Time in days since 2004-01-01
+ * @returns Fractional dip in flux, with a trapezoid shape
+ */
+float synth_transit(synth_parameters * params, double days)
+{
+    double phase, offset, half = params->duration_days*0.5;
+    double ingress_days = params->duration_days*params->ingress;
+
+    if ((params->period_days <= 0) || (params->depth <= 0)) return 0;
+
+    phase = (days - params->epoch_days) / params->period_days;
+    offset = fabs(phase - floor(phase + 0.5)) * params->period_days;
+    if (offset >= half) return 0;
+    if ((ingress_days <= 0) || (offset <= half - ingress_days)) {
+        return params->depth;
+    }
+    return (float)(params->depth * (half - offset) / ingress_days);
+}
+
+/**
+ * @brief Generates a light curve. Exposures are taken through each
+ *        night which isn't lost to the weather, so that the series has
+ *        the gaps between nights which detect_endpoints expects.
+ * @param params Description of the light curve
+ * @param star Returned light curve
+ * @returns The number of exposures, or negative if out of memory
+ */
+int synth_generate(synth_parameters * params, synth_series * star)
+{
+    unsigned int state = params->seed*2654435761u + 1;
+    int season, night, i, max_length, exposures;
+    double night_start, days, red = 0, decay, offset;
+    float value, noise;
+
+    if (state == 0) state = 1;
+    memset(star, 0, sizeof(synth_series));
+    if ((params->seasons < 1) || (params->nights < 1) ||
+        (params->cadence_seconds <= 0)) return -1;
+
+    exposures = (int)(params->night_hours*60*60 / params->cadence_seconds);
+    max_length = params->seasons*params->nights*exposures;
+    star->timestamp = (double*)malloc(max_length*sizeof(double));
+    star->series = (float*)malloc(max_length*sizeof(float));
+    star->error = (float*)malloc(max_length*sizeof(float));
+    star->flag = (int*)malloc(max_length*sizeof(int));
+    if ((star->timestamp == NULL) || (star->series == NULL) ||
+        (star->error == NULL) || (star->flag == NULL)) {
+        synth_free(star);
+        return -2;
+    }
+
+    /* correlation between consecutive exposures of the red noise */
+    decay = exp(-params->cadence_seconds /
+                (params->red_noise_minutes*60.0 + 1.0e-9));
+
+    for (season = 0; season < params->seasons; season++) {
+        for (night = 0; night < params->nights; night++) {
+            if (synth_uniform(&state) < params->weather_loss) continue;
+
+            /* the start of observing varies a little between nights */
+            night_start = params->start_days + (season*365.25) + night +
+                ((synth_uniform(&state) - 0.5) / 24.0);
+            offset = synth_gaussian(&state)*params->night_offset;
+            red = synth_gaussian(&state)*params->red_noise;
+
+            for (i = 0; i < exposures; i++) {
+                days = night_start +
+                    (i*params->cadence_seconds / (60.0*60.0*24.0));
+                red = (red*decay) +
+                    (synth_gaussian(&state)*params->red_noise *
+                     sqrt(1.0 - decay*decay));
+                noise = params->white_noise;
+
+                star->flag[star->length] = 0;
+                if (synth_uniform(&state) < params->flagged) {
+                    /* flagged exposures are much noisier */
+                    star->flag[star->length] = 4;
+                    noise *= 10;
+                }
+
+                value = params->flux *
+                    (float)(1.0 + offset + red +
+                            (synth_gaussian(&state)*noise) -
+                            synth_transit(params, days));
+                star->timestamp[star->length] = days*60.0*60.0*24.0;
+                star->series[star->length] = value;
+                star->error[star->length] = params->flux*noise;
+                star->length++;
+            }
+        }
+    }
+    return star->length;
+}
+
+/**
+ * @brief Frees memory allocated by synth_generate
+ * @param star The light curve
+ */
+void synth_free(synth_series * star)
+{
+    free(star->timestamp);
+    free(star->series);
+    free(star->error);
+    free(star->flag);
+    memset(star, 0, sizeof(synth_series));
+}
+
+/**
+ * @brief Saves a light curve as a SuperWASP table, which can be loaded
+ *        with the default table type
+ * @param star The light curve
+ * @param filename Table filename
+ * @returns zero on success
+ */
+int synth_save(synth_series * star, char * filename)
+{
+    FILE * fp;
+    int i;
+
+    fp = fopen(filename, "w");
+    if (fp == NULL) return -1;
+
+    fprintf(fp, "| TMID FLUX2 FLUX2_ERR TAMFLUX2 TAMFLUX2_ERR IMAGEID "
+            "CCDX CCDY FLAG HJD MAG2\n");
+    fprintf(fp, "| \"int\" \"double\" \"double\" \"double\" \"double\" "
+            "\"int\" \"double\" \"double\" \"int\" \"double\" \"double\"\n");
+    for (i = 0; i < star->length; i++) {
+        fprintf(fp, "%.0f %.3f %.3f %.3f %.3f %d %d %d %d %.6f %.4f\n",
+                star->timestamp[i], star->series[i]*1.01f,
+                star->error[i], star->series[i], star->error[i],
+                i, 100, 200, star->flag[i],
+                SYNTH_EPOCH_JD + (star->timestamp[i] / (60.0*60.0*24.0)),
+                15.0 - (2.5*log10(star->series[i] + 1.0e-9)));
+    }
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,66 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include "waspscan.h"
+
+/* Julian date of 2004-01-01, the origin of the TMID column */
+#define SYNTH_EPOCH_JD  2453005.5
+
+/* Description of a synthetic SuperWASP-like light curve */
+typedef struct {
+    unsigned int seed;
+    double start_days;        /* first night, in days since 2004-01-01 */
+    int seasons;              /* observing seasons, a year apart */
+    int nights;               /* nights within each season */
+    float weather_loss;       /* fraction of nights which are lost */
+    float night_hours;        /* length of each night */
+    float cadence_seconds;    /* time between exposures */
+    float flux;               /* mean flux of the star */
+    float white_noise;        /* fractional noise of each exposure */
+    float red_noise;          /* fractional correlated noise */
+    float red_noise_minutes;  /* correlation time of the red noise */
+    float night_offset;       /* fractional zero point change each night */
+    float flagged;            /* fraction of exposures which are flagged */
+    double period_days;       /* injected transit, or zero for none */
+    double epoch_days;        /* mid transit, in days since 2004-01-01 */
+    float depth;              /* fractional depth of the transit */
+    float duration_days;      /* first to last contact */
+    float ingress;            /* fraction of the duration spent in
+                                 ingress and in egress, zero for a box */
+} synth_parameters;
+
+/* A generated light curve */
+typedef struct {
+    int length;
+    double * timestamp;       /* seconds since 2004-01-01 */
+    float * series;           /* flux */
+    float * error;            /* flux error */
+    int * flag;               /* non-zero for flagged exposures */
+} synth_series;
+
+void synth_parameters_init(synth_parameters * params);
+float synth_transit(synth_parameters * params, double days);
+int synth_generate(synth_parameters * params, synth_series * star);
+void synth_free(synth_series * star);
+int synth_save(synth_series * star, char * filename);
+
+#endif
@@ -0,0 +1,119 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Memory for the buffers of one star. Allocations are taken from
+   large blocks and are all released together, and after a reset the
+   blocks are reused by the next star, so that a batch of stars
+   settles into a single block the size of the largest star. */
+
+#include "waspscan.h"
+
+/* header at the start of each block, padded to the alignment */
+struct arena_block {
+    struct arena_block * next;
+    size_t size;              /* bytes available after the header */
+    size_t used;              /* bytes allocated so far */
+};
+
+#define ARENA_HEADER_SIZE \
+    ((sizeof(arena_block) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+
+/**
+ * @brief Adds a new block to an arena
+ * @param mem The arena
+ * @param size The least number of bytes which the block must hold
+ * @returns The block, or NULL if out of memory
+ */
+static arena_block * arena_add_block(arena * mem, size_t size)
+{
+    void * block_memory;
+    arena_block * block;
+
+    /* malloc only guarantees the alignment of the largest scalar
+       type, so the block itself is aligned for vector loads */
+    if (size < ARENA_BLOCK_SIZE) size = ARENA_BLOCK_SIZE;
+    if (posix_memalign(&block_memory, ARENA_ALIGN,
+                       ARENA_HEADER_SIZE + size) != 0) {
+        return NULL;
+    }
+    block = (arena_block*)block_memory;
+
+    block->next = mem->blocks;
+    block->size = size;
+    block->used = 0;
+    mem->blocks = block;
+    mem->capacity += size;
+    return block;
+}
+
+/**
+ * @brief Allocates memory from an arena. The memory is aligned for
+ *        vector loads and remains valid until the arena is reset.
+ * @param mem The arena, which may be all zeros if not yet used
+ * @param size Number of bytes
+ * @returns The allocated memory, or NULL if out of memory
+ */
+void * arena_alloc(arena * mem, size_t size)
+{
+    arena_block * block = mem->blocks;
+    void * ptr;
+
+    size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    if ((block == NULL) || (block->size - block->used < size)) {
+        block = arena_add_block(mem, size);
+        if (block == NULL) return NULL;
+    }
+
+    ptr = (char*)block + ARENA_HEADER_SIZE + block->used;
+    block->used += size;
+    return ptr;
+}
+
+/**
+ * @brief Releases all allocations so that the memory can be reused.
+ *        If several blocks were needed they are replaced by a single
+ *        block which holds them all.
+ * @param mem The arena
+ */
+void arena_reset(arena * mem)
+{
+    size_t capacity = mem->capacity;
+
+    if ((mem->blocks != NULL) && (mem->blocks->next != NULL)) {
+        arena_free(mem);
+        arena_add_block(mem, capacity);
+    }
+    if (mem->blocks != NULL) mem->blocks->used = 0;
+}
+
+/**
+ * @brief Frees all of the memory held by an arena
+ * @param mem The arena
+ */
+void arena_free(arena * mem)
+{
+    arena_block * block, * next;
+
+    for (block = mem->blocks; block != NULL; block = next) {
+        next = block->next;
+        free(block);
+    }
+    mem->blocks = NULL;
+    mem->capacity = 0;
+}
@@ -0,0 +1,313 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "waspscan.h"
+
+/* number of stars which may be loaded ahead of the search */
+#define BATCH_SLOTS 2
+
+/* a star within the batch */
+typedef struct {
+    char filename[256];
+    long size;
+} batch_entry;
+
+/* stars loaded by the loader thread, waiting to be searched */
+typedef struct {
+    scan_parameters * params;
+    batch_entry * entries;
+    int no_of_entries;
+    scan_series slot[BATCH_SLOTS];
+    int loaded;          /* number of stars loaded so far */
+    int searched;        /* number of stars searched so far */
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} batch_queue;
+
+/**
+ * @brief Adds a file to the list of stars to be searched
+ * @param entries Array of stars, which may be reallocated
+ * @param no_of_entries Number of stars in the array
+ * @param max_entries Allocated size of the array
+ * @param filename The file to add
+ * @returns zero on success
+ */
+static int batch_add(batch_entry ** entries, int * no_of_entries,
+                     int * max_entries, char * filename)
+{
+    struct stat st;
+    batch_entry * e;
+
+    if (stat(filename, &st) != 0) {
+        printf("File not found %s\n", filename);
+        return -1;
+    }
+    if (*no_of_entries == *max_entries) {
+        *max_entries = (*max_entries == 0) ? 256 : (*max_entries)*2;
+        e = (batch_entry*)realloc(*entries,
+                                  (*max_entries)*sizeof(batch_entry));
+        if (e == NULL) return -2;
+        *entries = e;
+    }
+    e = &(*entries)[*no_of_entries];
+    snprintf(e->filename, sizeof(e->filename), "%s", filename);
+    e->size = (long)st.st_size;
+    (*no_of_entries)++;
+    return 0;
+}
+
+/**
+ * @brief Returns non-zero if a filename has the given extension
+ * @param filename The filename
+ * @param extension The extension, eg. ".tbl"
+ * @returns non-zero if the extension matches
+ */
+static int batch_extension(char * filename, char * extension)
+{
+    int len = strlen(filename), ext_len = strlen(extension);
+
+    if (len <= ext_len) return 0;
+    return (strcmp(&filename[len - ext_len], extension) == 0);
+}
+
+/**
+ * @brief Creates the list of stars to be searched, either from
+ *        the tables within a directory or from a manifest file
+ *        containing one filename per line
+ * @param path Directory or manifest filename
+ * @param entries Returned array of stars, which should be freed
+ * @returns The number of stars, or negative on error
+ */
+static int batch_list(char * path, batch_entry ** entries)
+{
+    DIR * dir;
+    struct dirent * ent;
+    FILE * fp;
+    char filename[512];
+    int no_of_entries = 0, max_entries = 0, len;
+
+    *entries = NULL;
+    dir = opendir(path);
+    if (dir != NULL) {
+        while ((ent = readdir(dir)) != NULL) {
+            if ((batch_extension(ent->d_name, ".tbl") == 0) &&
+                (batch_extension(ent->d_name, ".fits") == 0) &&
+                (batch_extension(ent->d_name, ".fit") == 0)) {
+                continue;
+            }
+            snprintf(filename, sizeof(filename), "%s/%s",
+                     path, ent->d_name);
+            batch_add(entries, &no_of_entries, &max_entries, filename);
+        }
+        closedir(dir);
+        return no_of_entries;
+    }
+
+    fp = fopen(path, "r");
+    if (!fp) return -1;
+    while (fgets(filename, sizeof(filename), fp) != NULL) {
+        len = strlen(filename);
+        while ((len > 0) &&
+               ((filename[len-1] == '\n') || (filename[len-1] == '\r') ||
+                (filename[len-1] == ' '))) {
+            filename[--len] = 0;
+        }
+        if ((len == 0) || (filename[0] == '#')) continue;
+        batch_add(entries, &no_of_entries, &max_entries, filename);
+    }
+    fclose(fp);
+    return no_of_entries;
+}
+
+/**
+ * @brief Used to sort stars so that the longest series come first
+ */
+static int batch_compare(const void * a, const void * b)
+{
+    const batch_entry * ea = (const batch_entry*)a;
+    const batch_entry * eb = (const batch_entry*)b;
+
+    if (ea->size > eb->size) return -1;
+    if (ea->size < eb->size) return 1;
+    return strcmp(ea->filename, eb->filename);
+}
+
+/**
+ * @brief Loads stars ahead of the search, so that reading files
+ *        overlaps with searching the previous star
+ * @param arg The queue of stars
+ */
+static void * batch_loader(void * arg)
+{
+    batch_queue * queue = (batch_queue*)arg;
+    int i;
+
+    for (i = 0; i < queue->no_of_entries; i++) {
+        /* wait for a free slot */
+        pthread_mutex_lock(&queue->lock);
+        while (i - queue->searched >= BATCH_SLOTS) {
+            pthread_cond_wait(&queue->changed, &queue->lock);
+        }
+        pthread_mutex_unlock(&queue->lock);
+
+        /* the slot is no longer being searched, so its memory
+           can be reused without holding the lock */
+        scan_load(queue->params, queue->entries[i].filename,
+                  &queue->slot[i % BATCH_SLOTS]);
+
+        pthread_mutex_lock(&queue->lock);
+        queue->loaded++;
+        pthread_cond_broadcast(&queue->changed);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Returns the current time in seconds
+ */
+static double batch_time()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+/**
+ * @brief Searches many stars within a single process. The next star
+ *        is loaded on a separate thread while the current one is
+ *        searched, and stars with the longest series are searched
+ *        first so that the work stays balanced towards the end.
+ *        One result line is written for each star.
+ * @param params Scan parameters
+ * @param path Directory containing tables, or a manifest file
+ *        containing one filename per line
+ * @returns zero on success
+ */
+int batch_run(scan_parameters * params, char * path)
+{
+    batch_queue queue;
+    batch_entry * entries;
+    pthread_t loader;
+    scan_series * star;
+    float orbital_period_days;
+    int i, no_of_entries, status, found = 0, screened = 0;
+    int text = (params->output == SCAN_OUTPUT_TEXT);
+    double start_time, elapsed;
+
+    no_of_entries = batch_list(path, &entries);
+    if (no_of_entries < 0) {
+        printf("Unable to read batch %s\n", path);
+        return -1;
+    }
+    if (no_of_entries == 0) {
+        printf("No tables found in %s\n", path);
+        free(entries);
+        return 0;
+    }
+    qsort(entries, no_of_entries, sizeof(batch_entry), batch_compare);
+
+    memset(&queue, 0, sizeof(batch_queue));
+    queue.params = params;
+    queue.entries = entries;
+    queue.no_of_entries = no_of_entries;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.changed, NULL);
+
+    start_time = batch_time();
+    if (pthread_create(&loader, NULL, batch_loader, &queue) != 0) {
+        printf("Unable to start the loader thread\n");
+        free(entries);
+        return -2;
+    }
+
+    for (i = 0; i < no_of_entries; i++) {
+        /* wait for the star to be loaded */
+        pthread_mutex_lock(&queue.lock);
+        while (queue.loaded <= i) {
+            pthread_cond_wait(&queue.changed, &queue.lock);
+        }
+        pthread_mutex_unlock(&queue.lock);
+
+        star = &queue.slot[i % BATCH_SLOTS];
+        if (text) printf("Scanning %s\n", star->filename);
+        status = 1;
+        if (star->length < params->minimum_data_samples) {
+            if (text) {
+                printf("result %s samples %d status too_few_samples\n",
+                       star->name, star->length);
+            }
+        }
+        else {
+            status = scan_search(params, star, &orbital_period_days);
+            if (status == 0) {
+                if (text) {
+                    printf("result %s samples %d orbital_period_days %.6f\n",
+                           star->name, star->length, orbital_period_days);
+                }
+                if (params->plot != 0) {
+                    scan_plot(params, star, orbital_period_days);
+                }
+                found++;
+            }
+            else {
+                if (status == 3) screened++;
+                if (text) {
+                    printf("result %s samples %d status %s\n",
+                           star->name, star->length,
+                           (status == -5) ? "no_transit" :
+                           ((status == 3) ? "prescreened" : "failed"));
+                }
+            }
+        }
+        scan_report(params, star, status);
+        scan_stats_report(params, star);
+        fflush(stdout);
+
+        scan_series_release(star);
+        pthread_mutex_lock(&queue.lock);
+        queue.searched++;
+        pthread_cond_broadcast(&queue.changed);
+        pthread_mutex_unlock(&queue.lock);
+    }
+
+    pthread_join(loader, NULL);
+    for (i = 0; i < BATCH_SLOTS; i++) {
+        scan_series_free(&queue.slot[i]);
+    }
+    pthread_mutex_destroy(&queue.lock);
+    pthread_cond_destroy(&queue.changed);
+    free(entries);
+
+    elapsed = batch_time() - start_time;
+    if (!text) return 0;
+    printf("%d stars searched in %.1f seconds, %.1f stars/hour, "
+           "%d with transits\n",
+           no_of_entries, elapsed,
+           (elapsed > 0) ? no_of_entries*3600.0/elapsed : 0, found);
+    if (params->prescreen != 0) {
+        printf("%d stars rejected by the pre-screen\n", screened);
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Box Least Squares (Kovacs, Zucker & Mazeh 2002).
+   The light curve is modelled as a constant level with a single box
+   shaped dip. For each trial period the samples are folded once, and
+   every transit start and duration is then evaluated from circular
+   prefix sums of the folded buckets. */
+
+#include "waspscan.h"
+
+/**
+ * @brief Evaluates every box shaped transit for one trial period,
+ *        from samples which have already been folded
+ * @param fold Precalculated values for the series being searched
+ * @param moments Moments of each bucket folded at the trial period
+ * @param period_days The trial orbital period
+ * @param curve_length The number of buckets within the folded curve,
+ *        up to FOLD_MAX_CURVE_LENGTH
+ * @param candidate Returned details of the best transit, which may be
+ *        NULL if only the score is needed
+ * @returns Signal residue of the best transit, or zero if there is
+ *          no dip
+ */
+float bls_moments_response(fold_context * fold, fold_moments * moments,
+                           float period_days, int curve_length,
+                           transit_candidate * candidate)
+{
+    float weight[FOLD_MAX_CURVE_LENGTH*2 + 1];
+    float deviation[FOLD_MAX_CURVE_LENGTH*2 + 1];
+    float residue[FOLD_MAX_CURVE_LENGTH];
+    double total_weight = 0, total_sum = 0, total_squares = 0;
+    double mean, prefix_weight = 0, prefix_deviation = 0;
+    float in_weight, out_weight, in_deviation, best_residue = 0;
+    double variance;
+    int i, j, start, duration, valid, best_start = 0, best_duration = 0;
+    int min_duration = (int)(curve_length*BLS_MIN_DURATION);
+    int max_duration = (int)ceil(curve_length*BLS_MAX_DURATION);
+
+    if (min_duration < 1) min_duration = 1;
+    if (max_duration >= curve_length) max_duration = curve_length - 1;
+
+    for (i = 0; i < curve_length; i++) {
+        total_weight += moments->inliers[i];
+        total_sum += moments->sum[i];
+        total_squares += moments->sum_squares[i];
+    }
+    /* scatter lost when samples were averaged together */
+    total_squares += fold->squares;
+    if (total_weight < BLS_MIN_TRANSIT_SAMPLES*2) return 0;
+    mean = total_sum / total_weight;
+
+    /* prefix sums of deviations from the mean over two turns of
+       phase, so that transits which wrap around phase zero are
+       contiguous */
+    weight[0] = deviation[0] = 0;
+    for (i = 0; i < curve_length*2; i++) {
+        j = i % curve_length;
+        prefix_weight += moments->inliers[j];
+        prefix_deviation += moments->sum[j] - (mean*moments->inliers[j]);
+        weight[i+1] = (float)prefix_weight;
+        deviation[i+1] = (float)prefix_deviation;
+    }
+
+    for (duration = min_duration; duration <= max_duration; duration++) {
+        /* kept free of branches so that it can be vectorised */
+        for (start = 0; start < curve_length; start++) {
+            in_weight = weight[start+duration] - weight[start];
+            out_weight = (float)total_weight - in_weight;
+            in_deviation = deviation[start+duration] - deviation[start];
+            valid = (in_weight >= BLS_MIN_TRANSIT_SAMPLES) &
+                (out_weight >= BLS_MIN_TRANSIT_SAMPLES) &
+                (in_deviation < 0);
+            residue[start] = in_deviation*in_deviation /
+                (in_weight*out_weight + 1.0e-30f);
+            /* only dips are of interest */
+            if (!valid) residue[start] = 0;
+        }
+        for (start = 0; start < curve_length; start++) {
+            if (residue[start] > best_residue) {
+                best_residue = residue[start];
+                best_start = start;
+                best_duration = duration;
+            }
+        }
+    }
+    best_residue *= (float)total_weight;
+    if ((best_residue == 0) || (candidate == NULL)) {
+        return best_residue;
+    }
+
+    in_weight = weight[best_start+best_duration] - weight[best_start];
+    out_weight = (float)total_weight - in_weight;
+    in_deviation = deviation[best_start+best_duration] - deviation[best_start];
+    variance = (total_squares / total_weight) -
+        ((total_sum / total_weight) - fold->mean) *
+        ((total_sum / total_weight) - fold->mean);
+
+    candidate->period_days = period_days;
+    candidate->score = best_residue;
+    candidate->depth = -in_deviation*(float)total_weight /
+        (in_weight*out_weight);
+    candidate->duration_days = period_days*best_duration/curve_length;
+    candidate->epoch_days = fold->origin_days +
+        (fmod((best_start + best_duration*0.5)/curve_length, 1.0) *
+         period_days);
+    candidate->snr = 0;
+    if (variance > 0) {
+        candidate->snr = (float)sqrt(best_residue / variance);
+    }
+    return best_residue;
+}
+
+/**
+ * @brief Evaluates every box shaped transit for one trial period
+ * @param fold Precalculated values for the series being searched
+ * @param period_days The trial orbital period
+ * @param curve_length The number of buckets within the folded curve,
+ *        up to FOLD_MAX_CURVE_LENGTH
+ * @param candidate Returned details of the best transit, which may be
+ *        NULL if only the score is needed
+ * @param workspace Array of fold_bin_workspace floats
+ * @returns Signal residue of the best transit, or zero if there is
+ *          no dip
+ */
+float bls_period_response(fold_context * fold,
+                          float period_days, int curve_length,
+                          transit_candidate * candidate,
+                          float workspace[])
+{
+    fold_moments moments;
+
+    fold_bin(fold, period_days, curve_length, &moments, workspace);
+    return bls_moments_response(fold, &moments, period_days, curve_length,
+                                candidate);
+}
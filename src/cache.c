@@ -0,0 +1,324 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "waspscan.h"
+
+/* identifies a cache file */
+#define CACHE_MAGIC     "WSPC"
+
+/* incremented whenever the layout of the cache changes */
+#define CACHE_VERSION   3
+
+/* header at the start of a cache file. Column arrays follow it,
+   each starting on a CACHE_ALIGN byte boundary */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t source_size;
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    uint64_t source_checksum;
+    uint64_t column_key;
+    uint32_t series_length;
+    uint32_t present;         /* bit for each column which was loaded */
+    uint32_t reserved[2];
+} cache_header;
+
+#define CACHE_ALIGN     64
+
+/* number of columns and the size of each value within them: time
+   (double), flux, flux error, raw flux and raw flux error (float).
+   Flagged samples were dropped when the table was loaded. */
+#define CACHE_COLUMNS   5
+static const size_t cache_column_size[CACHE_COLUMNS] = {
+    sizeof(double), sizeof(float), sizeof(float), sizeof(float),
+    sizeof(float)
+};
+
+/**
+ * @brief Returns a 64 bit checksum for a block of memory
+ * @param data The data
+ * @param size Size of the data in bytes
+ * @returns Checksum value
+ */
+static uint64_t cache_checksum(const unsigned char * data, size_t size)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ size;
+    uint64_t w;
+    size_t i;
+
+    for (i = 0; i + 8 <= size; i += 8) {
+        memcpy(&w, &data[i], 8);
+        h ^= w * 0x87c37b91114253d5ULL;
+        h = ((h << 31) | (h >> 33)) * 0x4cf5ad432745937fULL;
+    }
+    for (; i < size; i++) {
+        h ^= data[i];
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * @brief Returns the filename of the cache for a given log file
+ * @param filename Log filename
+ * @param cache_filename Returned cache filename
+ * @param max_length Size of the cache filename buffer
+ */
+static void cache_filename(char * filename, char * cache_filename,
+                           int max_length)
+{
+    snprintf(cache_filename, max_length, "%s.wspc", filename);
+}
+
+/**
+ * @brief Returns the offset of a column within a cache file.
+ *        Only the columns which were loaded are stored.
+ * @param series_length Number of data points
+ * @param present Bit for each column which was loaded
+ * @param column Index of the column
+ * @returns Byte offset from the start of the file
+ */
+static size_t cache_column_offset(uint32_t series_length, uint32_t present,
+                                  int column)
+{
+    size_t offset =
+        ((sizeof(cache_header) + CACHE_ALIGN - 1) /
+         CACHE_ALIGN) * CACHE_ALIGN;
+    int i;
+
+    for (i = 0; i < column; i++) {
+        if ((present & (1u << i)) == 0) continue;
+        offset += ((series_length*cache_column_size[i] + CACHE_ALIGN - 1) /
+                   CACHE_ALIGN) * CACHE_ALIGN;
+    }
+    return offset;
+}
+
+/**
+ * @brief Returns a column of a memory mapped cache
+ * @param data Start of the cache
+ * @param header Header of the cache
+ * @param column Index of the column
+ * @returns The column, or NULL if it wasn't loaded
+ */
+static void * cache_column(unsigned char * data, cache_header * header,
+                           int column)
+{
+    if ((header->present & (1u << column)) == 0) return NULL;
+    return &data[cache_column_offset(header->series_length,
+                                     header->present, column)];
+}
+
+/**
+ * @brief Returns a key identifying which columns were loaded, so that
+ *        a cache created for one table type isn't used for another
+ * @param columns Description of the columns, eg. "TMID,TAMFLUX2"
+ * @returns Key value
+ */
+static uint64_t cache_column_key(char * columns)
+{
+    return cache_checksum((const unsigned char*)columns, strlen(columns));
+}
+
+/**
+ * @brief Gets details of a source file and its checksum
+ * @param filename Source filename
+ * @param st Returned file status
+ * @param checksum Returned checksum of the file contents
+ * @returns zero on success
+ */
+static int cache_source(char * filename, struct stat * st,
+                        uint64_t * checksum)
+{
+    int fd;
+    void * data;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    if ((fstat(fd, st) != 0) || (st->st_size == 0)) {
+        close(fd);
+        return -1;
+    }
+    data = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+    *checksum = cache_checksum((const unsigned char*)data, st->st_size);
+    munmap(data, st->st_size);
+    return 0;
+}
+
+/**
+ * @brief Opens the cache for a log file, if one exists and is
+ *        still valid. The columns are memory mapped and used in place.
+ * @param filename Log filename
+ * @param columns Description of the columns which were loaded
+ * @param cache Returned cache
+ * @returns zero if a valid cache was opened
+ */
+int cache_open(char * filename, char * columns, series_cache * cache)
+{
+    char cache_name[512];
+    struct stat st, cache_st;
+    cache_header * header;
+    uint64_t checksum;
+    unsigned char * data;
+    int fd;
+
+    memset(cache, 0, sizeof(series_cache));
+
+    cache_filename(filename, cache_name, sizeof(cache_name));
+    fd = open(cache_name, O_RDONLY);
+    if (fd < 0) return -1;
+    if ((fstat(fd, &cache_st) != 0) ||
+        (cache_st.st_size < (off_t)sizeof(cache_header))) {
+        close(fd);
+        return -2;
+    }
+    data = (unsigned char*)mmap(NULL, cache_st.st_size, PROT_READ,
+                                MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -3;
+
+    header = (cache_header*)data;
+    if ((memcmp(header->magic, CACHE_MAGIC, 4) != 0) ||
+        (header->version != CACHE_VERSION) ||
+        (header->column_key != cache_column_key(columns)) ||
+        ((header->present & 3) != 3) ||
+        ((size_t)cache_st.st_size <
+         cache_column_offset(header->series_length, header->present,
+                             CACHE_COLUMNS))) {
+        munmap(data, cache_st.st_size);
+        return -4;
+    }
+
+    /* has the source changed since the cache was created? */
+    if ((cache_source(filename, &st, &checksum) != 0) ||
+        ((uint64_t)st.st_size != header->source_size) ||
+        ((int64_t)st.st_mtim.tv_sec != header->source_mtime_sec) ||
+        ((int64_t)st.st_mtim.tv_nsec != header->source_mtime_nsec) ||
+        (checksum != header->source_checksum)) {
+        munmap(data, cache_st.st_size);
+        return -5;
+    }
+
+    cache->columns.length = (int)header->series_length;
+    cache->columns.timestamp = (double*)cache_column(data, header, 0);
+    cache->columns.series = (float*)cache_column(data, header, 1);
+    cache->columns.error = (float*)cache_column(data, header, 2);
+    cache->columns.raw_series = (float*)cache_column(data, header, 3);
+    cache->columns.raw_error = (float*)cache_column(data, header, 4);
+    cache->mapping = data;
+    cache->mapping_size = cache_st.st_size;
+    return 0;
+}
+
+/**
+ * @brief Releases a cache opened with cache_open
+ * @param cache The cache
+ */
+void cache_close(series_cache * cache)
+{
+    if (cache->mapping != NULL) {
+        munmap(cache->mapping, cache->mapping_size);
+    }
+    memset(cache, 0, sizeof(series_cache));
+}
+
+/**
+ * @brief Saves loaded columns as a cache alongside the log file.
+ *        The cache is written to a temporary file and then renamed,
+ *        so that a partially written cache is never used.
+ * @param filename Log filename
+ * @param columns Description of the columns which were loaded
+ * @param loaded The loaded columns
+ * @returns zero on success
+ */
+int cache_save(char * filename, char * columns, series_columns * loaded)
+{
+    char cache_name[512], temp_name[540];
+    cache_header header;
+    struct stat st;
+    uint64_t checksum;
+    size_t size;
+    unsigned char * data;
+    void * column[CACHE_COLUMNS];
+    FILE * fp;
+    int i, retval = 0, series_length = loaded->length;
+
+    if ((series_length <= 0) || (loaded->timestamp == NULL) ||
+        (loaded->series == NULL)) return -1;
+    if (cache_source(filename, &st, &checksum) != 0) return -2;
+
+    memset(&header, 0, sizeof(cache_header));
+    memcpy(header.magic, CACHE_MAGIC, 4);
+    header.version = CACHE_VERSION;
+    header.source_size = st.st_size;
+    header.source_mtime_sec = st.st_mtim.tv_sec;
+    header.source_mtime_nsec = st.st_mtim.tv_nsec;
+    header.source_checksum = checksum;
+    header.column_key = cache_column_key(columns);
+    header.series_length = series_length;
+
+    column[0] = loaded->timestamp;
+    column[1] = loaded->series;
+    column[2] = loaded->error;
+    column[3] = loaded->raw_series;
+    column[4] = loaded->raw_error;
+    for (i = 0; i < CACHE_COLUMNS; i++) {
+        if (column[i] != NULL) header.present |= 1u << i;
+    }
+
+    size = cache_column_offset(series_length, header.present, CACHE_COLUMNS);
+    data = (unsigned char*)calloc(size, 1);
+    if (data == NULL) return -3;
+
+    memcpy(data, &header, sizeof(cache_header));
+    for (i = 0; i < CACHE_COLUMNS; i++) {
+        if (column[i] == NULL) continue;
+        memcpy(cache_column(data, &header, i), column[i],
+               series_length*cache_column_size[i]);
+    }
+
+    cache_filename(filename, cache_name, sizeof(cache_name));
+    snprintf(temp_name, sizeof(temp_name), "%s.%d", cache_name,
+             (int)getpid());
+    fp = fopen(temp_name, "wb");
+    if (!fp) {
+        free(data);
+        return -4;
+    }
+    if (fwrite(data, size, 1, fp) != 1) retval = -5;
+    if (fclose(fp) != 0) retval = -5;
+    free(data);
+
+    if ((retval != 0) || (rename(temp_name, cache_name) != 0)) {
+        unlink(temp_name);
+        return -6;
+    }
+    return 0;
+}
@@ -0,0 +1,221 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Checkpoints of a long period search. The best peaks found within
+   the trial periods searched so far are saved, together with the
+   number of periods searched, so that a search which is interrupted
+   can carry on from the same point. A checkpoint is only used by a
+   search of the same series with the same weights, grid and method,
+   which is checked with a hash of all of them. The peaks of any
+   companion series follow those of the first. */
+
+#include <unistd.h>
+#include "waspscan.h"
+
+#define CHECKPOINT_MAGIC    0x50435357
+#define CHECKPOINT_VERSION  2
+
+/* the start of a checkpoint file, followed by the peaks */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    int32_t no_of_periods;
+    int32_t next_period;      /* first period not yet searched */
+    int32_t columns;          /* series searched together */
+    int32_t length[FOLD_MAX_COLUMNS]; /* number of peaks of each series */
+    int32_t max_length;
+    int64_t outcomes[DETECT_OUTCOMES];
+} checkpoint_header;
+
+/**
+ * @brief Adds bytes to a FNV-1a hash
+ * @param hash The hash so far
+ * @param data The bytes
+ * @param size The number of bytes
+ * @returns The updated hash
+ */
+static uint64_t checkpoint_hash(uint64_t hash, const void * data,
+                                size_t size)
+{
+    const unsigned char * bytes = (const unsigned char*)data;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Returns a hash which identifies a search, from the series and
+ *        any companion, the grid of trial periods and the way in which
+ *        they're scored
+ * @param fold Precalculated values for the series being searched
+ * @param periods Grid of orbital periods to be tried
+ * @param no_of_periods The number of orbital periods within the grid
+ * @param curve_length The number of buckets within the light curve
+ * @param method DETECT_METHOD_HEURISTIC or DETECT_METHOD_BLS
+ * @param max_length The maximum number of peaks kept
+ * @returns The hash
+ */
+uint64_t checkpoint_key(fold_context * fold,
+                        float periods[], int no_of_periods,
+                        int curve_length, int method, int max_length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    int32_t values[6];
+
+    values[0] = CHECKPOINT_VERSION;
+    values[1] = fold->length;
+    values[2] = fold->tick_shift;
+    values[3] = curve_length;
+    values[4] = method;
+    values[5] = max_length;
+    hash = checkpoint_hash(hash, values, sizeof(values));
+    hash = checkpoint_hash(hash, &fold->origin_days, sizeof(double));
+    hash = checkpoint_hash(hash, fold->ticks,
+                           fold->length*sizeof(uint32_t));
+    hash = checkpoint_hash(hash, fold->series, fold->length*sizeof(float));
+    hash = checkpoint_hash(hash, fold->inlier, fold->length*sizeof(float));
+    if (fold->companion != NULL) {
+        hash = checkpoint_hash(hash, fold->companion->series,
+                               fold->length*sizeof(float));
+        hash = checkpoint_hash(hash, fold->companion->inlier,
+                               fold->length*sizeof(float));
+    }
+    return checkpoint_hash(hash, periods, no_of_periods*sizeof(float));
+}
+
+/**
+ * @brief Loads a checkpoint of the search, if there is one
+ * @param checkpoint The checkpoint, with the key of the search
+ * @param no_of_periods The number of orbital periods within the grid
+ * @param columns Number of series searched together
+ * @param list Returned best peaks so far, max_length for each series
+ * @param length Returned number of peaks of each series
+ * @param max_length The maximum number of peaks of each series
+ * @param outcomes Returned counts of the periods searched so far,
+ *        by outcome
+ * @returns The first period not yet searched, which is zero if there
+ *          is no checkpoint for this search
+ */
+int checkpoint_load(search_checkpoint * checkpoint, int no_of_periods,
+                    int columns, transit_candidate list[], int length[],
+                    int max_length, long outcomes[])
+{
+    checkpoint_header header;
+    FILE * fp;
+    int i, c, valid;
+
+    for (c = 0; c < columns; c++) length[c] = 0;
+    memset(outcomes, 0, DETECT_OUTCOMES*sizeof(long));
+    fp = fopen(checkpoint->filename, "rb");
+    if (fp == NULL) return 0;
+
+    valid = ((fread(&header, sizeof(checkpoint_header), 1, fp) == 1) &&
+             (header.magic == CHECKPOINT_MAGIC) &&
+             (header.version == CHECKPOINT_VERSION) &&
+             (header.key == checkpoint->key) &&
+             (header.no_of_periods == no_of_periods) &&
+             (header.columns == columns) &&
+             (header.max_length == max_length) &&
+             (header.next_period >= 0) &&
+             (header.next_period <= no_of_periods));
+    for (c = 0; valid && (c < columns); c++) {
+        valid = ((header.length[c] >= 0) &&
+                 (header.length[c] <= max_length) &&
+                 (fread(&list[c*max_length], sizeof(transit_candidate),
+                        header.length[c], fp) == (size_t)header.length[c]));
+    }
+    fclose(fp);
+    if (!valid) return 0;
+
+    for (c = 0; c < columns; c++) length[c] = header.length[c];
+    for (i = 0; i < DETECT_OUTCOMES; i++) {
+        outcomes[i] = (long)header.outcomes[i];
+    }
+    return header.next_period;
+}
+
+/**
+ * @brief Saves a checkpoint of the search. The file is replaced
+ *        atomically, so that after a crash it holds either the old
+ *        or the new checkpoint.
+ * @param checkpoint The checkpoint, with the key of the search
+ * @param no_of_periods The number of orbital periods within the grid
+ * @param next_period The first period not yet searched
+ * @param columns Number of series searched together
+ * @param list Best peaks so far, max_length for each series
+ * @param length Number of peaks of each series
+ * @param max_length The maximum number of peaks of each series
+ * @param outcomes Counts of the periods searched so far, by outcome
+ * @returns zero on success
+ */
+int checkpoint_save(search_checkpoint * checkpoint, int no_of_periods,
+                    int next_period, int columns, transit_candidate list[],
+                    int length[], int max_length, long outcomes[])
+{
+    checkpoint_header header;
+    char temporary[300];
+    FILE * fp;
+    int i, c, status = 0;
+
+    memset(&header, 0, sizeof(checkpoint_header));
+    header.magic = CHECKPOINT_MAGIC;
+    header.version = CHECKPOINT_VERSION;
+    header.key = checkpoint->key;
+    header.no_of_periods = no_of_periods;
+    header.next_period = next_period;
+    header.columns = columns;
+    for (c = 0; c < columns; c++) header.length[c] = length[c];
+    header.max_length = max_length;
+    for (i = 0; i < DETECT_OUTCOMES; i++) {
+        header.outcomes[i] = outcomes[i];
+    }
+
+    snprintf(temporary, sizeof(temporary), "%s.tmp", checkpoint->filename);
+    fp = fopen(temporary, "wb");
+    if (fp == NULL) return -1;
+    if (fwrite(&header, sizeof(checkpoint_header), 1, fp) != 1) status = -2;
+    for (c = 0; (status == 0) && (c < columns); c++) {
+        if (fwrite(&list[c*max_length], sizeof(transit_candidate),
+                   length[c], fp) != (size_t)length[c]) {
+            status = -2;
+        }
+    }
+    if ((status == 0) &&
+        ((fflush(fp) != 0) || (fsync(fileno(fp)) != 0))) {
+        status = -2;
+    }
+    if (fclose(fp) != 0) status = -3;
+    if (status == 0) status = rename(temporary, checkpoint->filename);
+    if (status != 0) unlink(temporary);
+    return status;
+}
+
+/**
+ * @brief Removes the checkpoint once the search is complete
+ * @param checkpoint The checkpoint
+ */
+void checkpoint_remove(search_checkpoint * checkpoint)
+{
+    unlink(checkpoint->filename);
+}
@@ -0,0 +1,366 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Claims of batches of work within a directory shared between
+   machines, so that any number of daemons can divide an archive
+   between them without a coordinator.
+
+   A lease holds the name of the machine and the next line to be
+   searched. Leases are numbered, and the batch belongs to the machine
+   holding the lease with the highest number. A lease is claimed by
+   writing a temporary file and linking it to the name of the lease,
+   which fails if the lease exists, so only one machine can create
+   each number and a lease never appears half written. A lease is
+   only replaced by the machine which holds it, when it is renewed,
+   which also updates its modification time. A lease which hasn't
+   been renewed for longer than the lease time belongs to a machine
+   which has stopped, and the batch may be taken over by creating the
+   next number, carrying on from the line where the last machine
+   stopped. Leases are never moved or removed while the batch is
+   being searched, so there's no moment at which a third machine
+   could claim it. A machine which stalled for longer than the lease
+   time finds that a higher number exists when it next renews, and
+   gives up the batch. Once a batch has been searched a done file is
+   created and the leases removed. Batches are numbered by their
+   lines, so the first daemon records the length of the script and of
+   the batches, and others which don't match them are refused.
+
+   Ages are measured against the clock of the shared filesystem
+   rather than that of the machine, so machines whose clocks differ
+   still agree on when a lease expires. Leases should be several
+   times longer than the interval at which they're renewed. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "waspscan.h"
+
+/**
+ * @brief Returns the filename of a lease or done file
+ * @param filename Returned filename
+ * @param directory The shared directory
+ * @param batch Index of the batch
+ * @param suffix "lease" or "done"
+ */
+static void claim_filename(char * filename, char * directory, int batch,
+                           char * suffix)
+{
+    sprintf(filename, "%s/%08d.%s", directory, batch, suffix);
+}
+
+/**
+ * @brief Returns the filename of one of the numbered leases of a batch
+ * @param filename Returned filename
+ * @param directory The shared directory
+ * @param batch Index of the batch
+ * @param generation Number of the lease
+ */
+static void claim_lease_filename(char * filename, char * directory,
+                                 int batch, int generation)
+{
+    sprintf(filename, "%s/%08d.lease.%d", directory, batch, generation);
+}
+
+/**
+ * @brief Returns the highest number of the leases of a batch. Leases
+ *        are numbered from zero and only removed once the batch is done.
+ * @param directory The shared directory
+ * @param batch Index of the batch
+ * @returns The number of the current lease, or -1 if there is none
+ */
+static int claim_generation(char * directory, int batch)
+{
+    char filename[512];
+    struct stat st;
+    int generation = 0;
+
+    while (1) {
+        claim_lease_filename(filename, directory, batch, generation);
+        if (stat(filename, &st) != 0) break;
+        generation++;
+    }
+    return generation - 1;
+}
+
+/**
+ * @brief Returns the current time according to the shared filesystem,
+ *        by touching a file belonging to this machine
+ * @param directory The shared directory
+ * @param node Name of this machine
+ * @returns Seconds since the epoch, or negative on failure
+ */
+static double claim_now(char * directory, char * node)
+{
+    char filename[512];
+    struct stat st;
+    int fd;
+
+    snprintf(filename, sizeof(filename), "%s/.clock.%s", directory, node);
+    fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    if ((write(fd, "\n", 1) != 1) || (fstat(fd, &st) != 0)) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return (double)st.st_mtime;
+}
+
+/**
+ * @brief Writes a lease, which first appears in full under a temporary
+ *        name belonging to this machine
+ * @param filename The lease file
+ * @param node Name of this machine
+ * @param next_line The next line of the batch to be searched
+ * @param exclusive Non-zero to create the lease only if it doesn't
+ *        exist, otherwise the lease is replaced
+ * @returns zero on success, otherwise negative with errno set, which
+ *          is EEXIST if an exclusive lease already exists
+ */
+static int claim_write(char * filename, char * node, long next_line,
+                       int exclusive)
+{
+    char content[128], temporary[600];
+    int fd, len, error;
+
+    len = snprintf(content, sizeof(content), "%s %ld\n", node, next_line);
+    snprintf(temporary, sizeof(temporary), "%s.%s.tmp", filename, node);
+    fd = open(temporary, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    if (write(fd, content, len) != len) {
+        close(fd);
+        unlink(temporary);
+        return -2;
+    }
+    if (close(fd) != 0) {
+        unlink(temporary);
+        return -3;
+    }
+    if (exclusive == 0) {
+        if (rename(temporary, filename) != 0) {
+            unlink(temporary);
+            return -4;
+        }
+        return 0;
+    }
+
+    /* a link is never made over an existing file */
+    if (link(temporary, filename) != 0) {
+        error = errno;
+        unlink(temporary);
+        errno = error;
+        return -5;
+    }
+    unlink(temporary);
+    return 0;
+}
+
+/**
+ * @brief Reads a lease
+ * @param filename The lease file
+ * @param node Returned name of the machine holding the lease
+ * @param next_line Returned next line of the batch to be searched
+ * @returns zero on success
+ */
+static int claim_read(char * filename, char * node, long * next_line)
+{
+    FILE * fp;
+    int fields;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL) return -1;
+    fields = fscanf(fp, "%63s %ld", node, next_line);
+    fclose(fp);
+    return (fields == 2) ? 0 : -2;
+}
+
+/**
+ * @brief Reads the current lease of a batch
+ * @param directory The shared directory
+ * @param batch Index of the batch
+ * @param filename Returned filename of the lease
+ * @param node Returned name of the machine holding the lease
+ * @param next_line Returned next line of the batch to be searched
+ * @returns The number of the lease, or negative if there is none or it
+ *          couldn't be read
+ */
+static int claim_current(char * directory, int batch, char * filename,
+                         char * node, long * next_line)
+{
+    int generation = claim_generation(directory, batch);
+
+    if (generation < 0) return -1;
+    claim_lease_filename(filename, directory, batch, generation);
+    if (claim_read(filename, node, next_line) != 0) return -2;
+    return generation;
+}
+
+/**
+ * @brief Checks that this daemon divides the work into the same
+ *        batches as the others sharing the directory
+ * @param directory The shared directory
+ * @param no_of_lines Lines of the script
+ * @param batch_size Lines within each batch
+ * @returns zero if the batches match
+ */
+int claim_layout(char * directory, long no_of_lines, int batch_size)
+{
+    char filename[512], content[64];
+    long lines = 0;
+    int fd, len, size = 0;
+    FILE * fp;
+
+    snprintf(filename, sizeof(filename), "%s/layout", directory);
+    len = sprintf(content, "%ld %d\n", no_of_lines, batch_size);
+    fd = open(filename, O_CREAT | O_EXCL | O_WRONLY, 0644);
+    if (fd >= 0) {
+        if (write(fd, content, len) != len) {
+            close(fd);
+            unlink(filename);
+            return -1;
+        }
+        return close(fd);
+    }
+
+    fp = fopen(filename, "r");
+    if (fp == NULL) return -2;
+    if (fscanf(fp, "%ld %d", &lines, &size) != 2) {
+        fclose(fp);
+        return -3;
+    }
+    fclose(fp);
+    return ((lines == no_of_lines) && (size == batch_size)) ? 0 : -4;
+}
+
+/**
+ * @brief Attempts to claim a batch of work. A lease which this machine
+ *        held before it was restarted is claimed again.
+ * @param directory The shared directory
+ * @param node Name of this machine
+ * @param batch Index of the batch
+ * @param lease_seconds Time after which a lease which hasn't been
+ *        renewed may be taken over
+ * @param next_line Returned line where an earlier holder of the lease
+ *        stopped, or zero
+ * @returns CLAIM_CLAIMED, CLAIM_LEASED if another machine holds the
+ *          batch, CLAIM_DONE if it has been searched, or negative on
+ *          failure
+ */
+int claim_batch(char * directory, char * node, int batch,
+                double lease_seconds, long * next_line)
+{
+    char lease[512], done[512], owner[64];
+    struct stat st;
+    double now;
+    int generation;
+
+    *next_line = 0;
+    claim_filename(done, directory, batch, "done");
+    if (stat(done, &st) == 0) return CLAIM_DONE;
+
+    generation = claim_current(directory, batch, lease, owner, next_line);
+    if (generation == -2) {
+        /* removed once done */
+        *next_line = 0;
+        return (stat(done, &st) == 0) ? CLAIM_DONE : CLAIM_LEASED;
+    }
+    if (generation >= 0) {
+        if (strcmp(owner, node) == 0) {
+            if (claim_write(lease, node, *next_line, 0) != 0) return -1;
+            return CLAIM_CLAIMED;
+        }
+        now = claim_now(directory, node);
+        if ((now < 0) || (stat(lease, &st) != 0) ||
+            (now - (double)st.st_mtime < lease_seconds)) {
+            *next_line = 0;
+            return CLAIM_LEASED;
+        }
+    }
+
+    /* only one machine can create the next lease */
+    claim_lease_filename(lease, directory, batch, generation + 1);
+    if (claim_write(lease, node, *next_line, 1) != 0) {
+        *next_line = 0;
+        return (errno == EEXIST) ? CLAIM_LEASED : -1;
+    }
+
+    /* the batch may have been finished since it was checked */
+    if (stat(done, &st) == 0) {
+        unlink(lease);
+        *next_line = 0;
+        return CLAIM_DONE;
+    }
+    return CLAIM_CLAIMED;
+}
+
+/**
+ * @brief Renews a lease, recording how far the batch has been searched
+ * @param directory The shared directory
+ * @param node Name of this machine
+ * @param batch Index of the batch
+ * @param next_line The next line of the batch to be searched
+ * @returns zero on success, or negative if the lease has been lost
+ */
+int claim_renew(char * directory, char * node, int batch, long next_line)
+{
+    char lease[512], owner[64];
+    long line;
+
+    /* nobody else replaces a lease, so if this machine holds the
+       highest numbered one then the batch is still its own */
+    if ((claim_current(directory, batch, lease, owner, &line) < 0) ||
+        (strcmp(owner, node) != 0)) {
+        return -1;
+    }
+    return claim_write(lease, node, next_line, 0);
+}
+
+/**
+ * @brief Marks a batch as searched and removes its leases, provided
+ *        that this machine still holds it
+ * @param directory The shared directory
+ * @param node Name of this machine
+ * @param batch Index of the batch
+ * @returns zero on success, or negative if the lease has been lost
+ */
+int claim_done(char * directory, char * node, int batch)
+{
+    char lease[512], done[512], owner[64];
+    long line;
+    int generation;
+    FILE * fp;
+
+    generation = claim_current(directory, batch, lease, owner, &line);
+    if ((generation < 0) || (strcmp(owner, node) != 0)) return -1;
+
+    claim_filename(done, directory, batch, "done");
+    fp = fopen(done, "w");
+    if (fp == NULL) return -2;
+    fprintf(fp, "%s\n", node);
+    if (fclose(fp) != 0) return -3;
+
+    /* a machine which claims the batch while the leases are removed
+       finds the done file and lets go */
+    for (; generation >= 0; generation--) {
+        claim_lease_filename(lease, directory, batch, generation);
+        unlink(lease);
+    }
+    return 0;
+}
@@ -0,0 +1,1173 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Searches every star listed in a bulk download script, such as the
+   wget script of the SuperWASP archive, as a pipeline of stages.
+   Several fetcher threads download stars ahead of the search, a loader
+   thread reads the next star while the current one is searched, and
+   the search itself uses all of the cores. Stars are searched in the
+   order of the script, and after each one the number of the next line
+   is saved so that a restarted daemon carries on where it stopped.
+
+   Daemons on several machines can share one script by claiming small
+   batches of its lines within a shared directory. Each daemon claims
+   another batch whenever it is ready for more stars, so faster
+   machines search more of them, and the batches of a machine which
+   stops are taken over by the others once its leases expire. The
+   progress within each batch is kept in its lease in place of the
+   cursor. */
+
+#include <pthread.h>
+#include <dirent.h>
+#include <limits.h>
+#include <netdb.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "waspscan.h"
+
+/* directories within the working directory */
+#define DAEMON_INCOMING    "incoming"
+#define DAEMON_CANDIDATES  "candidates"
+#define DAEMON_CHECKPOINT  "search.checkpoint"
+
+/* state of a star taken from the script */
+#define DAEMON_JOB_FETCHING  0
+#define DAEMON_JOB_FETCHED   1
+#define DAEMON_JOB_FAILED    2
+
+/* a star taken from the script */
+typedef struct {
+    long line_no;
+    char filename[256];       /* within the incoming directory */
+    int state;
+    int batch;                /* claimed batch containing the line */
+    int last_in_batch;        /* non-zero for the last star of a batch */
+} daemon_job;
+
+/* stages of the pipeline, and the stars passing between them */
+typedef struct {
+    scan_parameters * params;
+    daemon_parameters * daemon;
+    FILE * log;
+    long line_no;             /* lines read from the script so far */
+    long end_line;            /* last line to be searched */
+    int finished;             /* non-zero once the script is read */
+    long jobs;                /* stars taken from the script so far */
+    long loaded;              /* stars loaded so far */
+    long searched;            /* stars searched so far */
+    daemon_job job[DAEMON_MAX_AHEAD];
+    scan_series slot[DAEMON_SLOTS];
+    long no_of_lines;         /* lines of the script, when claiming */
+    long * batch_offset;      /* position of each batch in the script */
+    int no_of_batches;
+    int next_batch;           /* next batch to try to claim */
+    int batch;                /* batch being read, or -1 */
+    long batch_end;           /* last line of the batch being read */
+    long batch_jobs;          /* stars taken before the batch */
+    double claim_wait;        /* time before claiming is tried again */
+    int held[DAEMON_MAX_AHEAD + 1];       /* batches claimed and not done */
+    long held_line[DAEMON_MAX_AHEAD + 1]; /* next line of each batch */
+    int no_of_held;
+    int stopping;             /* non-zero once the search has ended */
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} daemon_queue;
+
+/**
+ * @brief Sets default values for the daemon
+ * @param daemon The daemon parameters
+ */
+void daemon_parameters_init(daemon_parameters * daemon)
+{
+    memset(daemon, 0, sizeof(daemon_parameters));
+    sprintf(daemon->working_dir, ".");
+    sprintf(daemon->cursor, "cursor.txt");
+    daemon->fetchers = DAEMON_FETCHERS;
+    daemon->end_percent = 100;
+    daemon->claim_size = DAEMON_CLAIM_SIZE;
+    daemon->lease_seconds = DAEMON_LEASE_SECONDS;
+}
+
+/**
+ * @brief Reads a whole line, discarding anything beyond the buffer
+ * @param fp The file
+ * @param line Returned line without its ending
+ * @param size Size of the buffer
+ * @returns zero at the end of the file, otherwise non-zero
+ */
+static int daemon_read_line(FILE * fp, char * line, int size)
+{
+    int c, len = 0;
+
+    c = fgetc(fp);
+    if (c == EOF) return 0;
+    while ((c != EOF) && (c != '\n')) {
+        if ((c != '\r') && (len < size - 1)) line[len++] = (char)c;
+        c = fgetc(fp);
+    }
+    line[len] = 0;
+    return 1;
+}
+
+/**
+ * @brief Splits a shell command into its arguments, removing quotes
+ * @param line The command, which is modified
+ * @param token Returned arguments, within the line
+ * @param max_tokens Size of the array of arguments
+ * @returns The number of arguments
+ */
+static int daemon_tokens(char * line, char * token[], int max_tokens)
+{
+    int no_of_tokens = 0;
+    char * src = line, * dst = line;
+    char quote;
+
+    while ((*src != 0) && (no_of_tokens < max_tokens)) {
+        while ((*src == ' ') || (*src == '\t')) src++;
+        if (*src == 0) break;
+        token[no_of_tokens++] = dst;
+        quote = 0;
+        while (*src != 0) {
+            if (quote != 0) {
+                if (*src == quote) quote = 0;
+                else *dst++ = *src;
+            }
+            else if ((*src == '\'') || (*src == '"')) quote = *src;
+            else if ((*src == ' ') || (*src == '\t')) break;
+            else *dst++ = *src;
+            src++;
+        }
+        if (*src != 0) src++;
+        *dst++ = 0;
+    }
+    return no_of_tokens;
+}
+
+/**
+ * @brief Gets the location and filename of a star from a line of a
+ *        download script. Lines may be wget or curl commands, or
+ *        simply a url or the path of a local file.
+ * @param line The line, which is modified
+ * @param url Returned location of the star
+ * @param name Returned filename, without any directory
+ * @returns zero on success, or non-zero if the line isn't a star
+ */
+static int daemon_parse(char * line, char ** url, char * name)
+{
+    char * token[64], * output = NULL, * base;
+    int i, no_of_tokens, len;
+
+    *url = NULL;
+    no_of_tokens = daemon_tokens(line, token, 64);
+    if ((no_of_tokens == 0) || (token[0][0] == '#')) return -1;
+
+    if ((strcmp(token[0], "wget") == 0) || (strcmp(token[0], "curl") == 0)) {
+        for (i = 1; i < no_of_tokens; i++) {
+            if ((i < no_of_tokens - 1) &&
+                (((strcmp(token[0], "wget") == 0) &&
+                  (strcmp(token[i], "-O") == 0)) ||
+                 ((strcmp(token[0], "curl") == 0) &&
+                  (strcmp(token[i], "-o") == 0)))) {
+                output = token[++i];
+                continue;
+            }
+            if (strncmp(token[i], "--output-document=", 18) == 0) {
+                output = &token[i][18];
+                continue;
+            }
+            if ((*url == NULL) && (strstr(token[i], "://") != NULL)) {
+                *url = token[i];
+            }
+        }
+        if (*url == NULL) return -1;
+    }
+    else {
+        *url = token[0];
+    }
+
+    /* the filename is never allowed to leave the working directory */
+    if (output == NULL) output = *url;
+    len = strcspn(output, "?");
+    base = output;
+    for (i = 0; i < len; i++) {
+        if (output[i] == '/') base = &output[i+1];
+    }
+    len -= (int)(base - output);
+    if ((len <= 0) || (len > 200) ||
+        (strncmp(base, ".", len) == 0) || (strncmp(base, "..", len) == 0)) {
+        return -1;
+    }
+    memcpy(name, base, len);
+    name[len] = 0;
+    return 0;
+}
+
+/**
+ * @brief Copies a file
+ * @param source The file to copy
+ * @param destination The copy
+ * @returns zero on success
+ */
+static int daemon_copy(char * source, char * destination)
+{
+    FILE * in, * out;
+    char buffer[65536];
+    size_t n;
+    int status = 0;
+
+    in = fopen(source, "rb");
+    if (in == NULL) return -1;
+    out = fopen(destination, "wb");
+    if (out == NULL) {
+        fclose(in);
+        return -2;
+    }
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, n, out) != n) {
+            status = -3;
+            break;
+        }
+    }
+    if (ferror(in)) status = -4;
+    fclose(in);
+    if (fclose(out) != 0) status = -5;
+    return status;
+}
+
+/**
+ * @brief Downloads a url with wget, for schemes such as https which
+ *        aren't handled directly
+ * @param url The url
+ * @param filename The downloaded file
+ * @returns zero on success
+ */
+static int daemon_wget(char * url, char * filename)
+{
+    char timeout[16];
+    pid_t pid;
+    int status;
+
+    sprintf(timeout, "%d", DAEMON_TIMEOUT_SECONDS);
+    pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        execlp("wget", "wget", "-q", "-T", timeout, "-O", filename, url,
+               (char*)NULL);
+        _exit(127);
+    }
+    if (waitpid(pid, &status, 0) < 0) return -2;
+    return (WIFEXITED(status) && (WEXITSTATUS(status) == 0)) ? 0 : -3;
+}
+
+static int daemon_download(char * url, char * filename, int redirects);
+
+/**
+ * @brief Downloads a url over HTTP, following any redirects
+ * @param url The url, beginning with http://
+ * @param filename The downloaded file
+ * @param redirects The number of further redirects allowed
+ * @returns zero on success
+ */
+static int daemon_http_get(char * url, char * filename, int redirects)
+{
+    char host[256], port[8], location[DAEMON_LINE_LENGTH];
+    char header[16384], request[DAEMON_LINE_LENGTH + 512];
+    char * path, * p, * end, * body = NULL;
+    struct addrinfo hints, * addresses, * a;
+    struct timeval timeout;
+    long content_length = -1, received = 0;
+    int sock = -1, code = 0, used = 0, n, len;
+    FILE * fp;
+
+    /* http://host[:port]/path */
+    p = url + 7;
+    path = strchr(p, '/');
+    len = (path != NULL) ? (int)(path - p) : (int)strlen(p);
+    if ((len == 0) || (len >= (int)sizeof(host))) return -1;
+    memcpy(host, p, len);
+    host[len] = 0;
+    if (path == NULL) path = "/";
+    sprintf(port, "80");
+    p = strchr(host, ':');
+    if (p != NULL) {
+        *p = 0;
+        snprintf(port, sizeof(port), "%s", p + 1);
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &addresses) != 0) return -2;
+    for (a = addresses; a != NULL; a = a->ai_next) {
+        sock = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (sock < 0) continue;
+        timeout.tv_sec = DAEMON_TIMEOUT_SECONDS;
+        timeout.tv_usec = 0;
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (connect(sock, a->ai_addr, a->ai_addrlen) == 0) break;
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(addresses);
+    if (sock < 0) return -3;
+
+    len = snprintf(request, sizeof(request),
+                   "GET %s HTTP/1.0\r\nHost: %s\r\n"
+                   "User-Agent: waspscan\r\nConnection: close\r\n\r\n",
+                   path, host);
+    if ((len >= (int)sizeof(request)) ||
+        (send(sock, request, len, MSG_NOSIGNAL) != len)) {
+        close(sock);
+        return -4;
+    }
+
+    /* the headers, and possibly the start of the body */
+    while (body == NULL) {
+        n = recv(sock, &header[used], sizeof(header) - 1 - used, 0);
+        if (n <= 0) {
+            close(sock);
+            return -5;
+        }
+        used += n;
+        header[used] = 0;
+        body = strstr(header, "\r\n\r\n");
+        if ((body == NULL) && (used == (int)sizeof(header) - 1)) {
+            close(sock);
+            return -6;
+        }
+    }
+    body += 4;
+    sscanf(header, "HTTP/%*s %d", &code);
+
+    location[0] = 0;
+    for (p = header; p < body - 2; p = end + 2) {
+        end = strstr(p, "\r\n");
+        *end = 0;
+        if (strncasecmp(p, "Content-Length:", 15) == 0) {
+            content_length = atol(p + 15);
+        }
+        if (strncasecmp(p, "Location:", 9) == 0) {
+            p += 9;
+            while (*p == ' ') p++;
+            if (p[0] == '/') {
+                snprintf(location, sizeof(location), "http://%s:%s%s",
+                         host, port, p);
+            }
+            else {
+                snprintf(location, sizeof(location), "%s", p);
+            }
+        }
+    }
+
+    if ((code == 301) || (code == 302) || (code == 303) ||
+        (code == 307) || (code == 308)) {
+        close(sock);
+        if ((location[0] == 0) || (redirects <= 0)) return -7;
+        return daemon_download(location, filename, redirects - 1);
+    }
+    if (code != 200) {
+        close(sock);
+        return -8;
+    }
+
+    fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        close(sock);
+        return -9;
+    }
+    /* the headers may or may not have arrived with some of the body */
+    n = used - (int)(body - header);
+    while (n >= 0) {
+        if (fwrite(body, 1, n, fp) != (size_t)n) {
+            received = -1;
+            break;
+        }
+        received += n;
+        body = header;
+        n = recv(sock, header, sizeof(header), 0);
+        if (n == 0) break;
+    }
+    close(sock);
+    if ((fclose(fp) != 0) || (n < 0) || (received < 0)) return -10;
+    if ((content_length >= 0) && (received != content_length)) return -11;
+    return 0;
+}
+
+/**
+ * @brief Downloads a url, or copies a local file
+ * @param url The url, or the path of a local file
+ * @param filename The downloaded file
+ * @param redirects The number of further redirects allowed
+ * @returns zero on success
+ */
+static int daemon_download(char * url, char * filename, int redirects)
+{
+    if (strncmp(url, "http://", 7) == 0) {
+        return daemon_http_get(url, filename, redirects);
+    }
+    if (strncmp(url, "file://", 7) == 0) {
+        return daemon_copy(url + 7, filename);
+    }
+    if (strstr(url, "://") == NULL) {
+        return daemon_copy(url, filename);
+    }
+    return daemon_wget(url, filename);
+}
+
+/**
+ * @brief Fetches a star, either from its url or from the mirror
+ *        directory. The file only appears under its final name once
+ *        it is complete.
+ * @param daemon The daemon parameters
+ * @param url Location of the star
+ * @param name Filename of the star
+ * @param filename The fetched file
+ * @returns zero on success
+ */
+static int daemon_fetch(daemon_parameters * daemon, char * url,
+                        char * name, char * filename)
+{
+    char partial[300], source[512];
+    int attempt, status = -1;
+
+    snprintf(partial, sizeof(partial), "%s.part", filename);
+    for (attempt = 0; attempt < DAEMON_RETRIES; attempt++) {
+        if (attempt > 0) sleep(attempt);
+        if (daemon->mirror[0] != 0) {
+            snprintf(source, sizeof(source), "%s/%s", daemon->mirror, name);
+            status = daemon_copy(source, partial);
+        }
+        else {
+            status = daemon_download(url, partial, DAEMON_REDIRECTS);
+        }
+        if (status == 0) break;
+    }
+    if ((status == 0) && (rename(partial, filename) == 0)) return 0;
+    unlink(partial);
+    return -1;
+}
+
+/**
+ * @brief Saves the line of the script which is to be searched next.
+ *        The file is replaced atomically, so that it is always either
+ *        the old or the new line after a crash.
+ * @param filename The cursor file
+ * @param line_no The next line
+ * @returns zero on success
+ */
+static int daemon_cursor_save(char * filename, long line_no)
+{
+    char temporary[300];
+    FILE * fp;
+
+    snprintf(temporary, sizeof(temporary), "%s.tmp", filename);
+    fp = fopen(temporary, "w");
+    if (fp == NULL) return -1;
+    fprintf(fp, "%ld\n", line_no);
+    if ((fflush(fp) != 0) || (fsync(fileno(fp)) != 0)) {
+        fclose(fp);
+        return -2;
+    }
+    if (fclose(fp) != 0) return -3;
+    return rename(temporary, filename);
+}
+
+/**
+ * @brief Loads the line of the script which is to be searched next
+ * @param filename The cursor file
+ * @returns The line number, or 1 if there is no cursor
+ */
+static long daemon_cursor_load(char * filename)
+{
+    FILE * fp;
+    long line_no = 1;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL) return 1;
+    if ((fscanf(fp, "%ld", &line_no) != 1) || (line_no < 1)) line_no = 1;
+    fclose(fp);
+    return line_no;
+}
+
+/**
+ * @brief Removes files left in a directory by an earlier run
+ * @param path The directory
+ */
+static void daemon_clean(char * path)
+{
+    DIR * dir;
+    struct dirent * ent;
+    char filename[512];
+
+    dir = opendir(path);
+    if (dir == NULL) return;
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.') continue;
+        snprintf(filename, sizeof(filename), "%s/%s", path, ent->d_name);
+        unlink(filename);
+    }
+    closedir(dir);
+}
+
+/**
+ * @brief Returns the current time in seconds
+ */
+static double daemon_time()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+/**
+ * @brief Finds where each batch of lines starts within the script,
+ *        leaving it at its start
+ * @param queue The queue of stars
+ * @returns zero on success
+ */
+static int daemon_batches(daemon_queue * queue)
+{
+    char line[DAEMON_LINE_LENGTH];
+    long position, * offset;
+    int size = 0;
+
+    queue->no_of_lines = 0;
+    queue->no_of_batches = 0;
+    while (1) {
+        position = ftell(queue->log);
+        if (daemon_read_line(queue->log, line, sizeof(line)) == 0) break;
+        if (queue->no_of_lines % queue->daemon->claim_size == 0) {
+            if (queue->no_of_batches >= size) {
+                size = (size == 0) ? 1024 : size*2;
+                offset = (long*)realloc(queue->batch_offset,
+                                        size*sizeof(long));
+                if (offset == NULL) return -1;
+                queue->batch_offset = offset;
+            }
+            queue->batch_offset[queue->no_of_batches++] = position;
+        }
+        queue->no_of_lines++;
+    }
+    rewind(queue->log);
+    return 0;
+}
+
+/**
+ * @brief Returns the position of a batch within those held by this
+ *        daemon, or -1
+ * @param queue The queue of stars
+ * @param batch Index of the batch
+ */
+static int daemon_held(daemon_queue * queue, int batch)
+{
+    int i;
+
+    for (i = 0; i < queue->no_of_held; i++) {
+        if (queue->held[i] == batch) return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Forgets a batch held by this daemon
+ * @param queue The queue of stars
+ * @param i Position of the batch within those held
+ */
+static void daemon_forget(daemon_queue * queue, int i)
+{
+    queue->no_of_held--;
+    queue->held[i] = queue->held[queue->no_of_held];
+    queue->held_line[i] = queue->held_line[queue->no_of_held];
+}
+
+/**
+ * @brief Marks a batch as searched and forgets it. A batch whose lease
+ *        was lost isn't marked, since another daemon now holds it.
+ * @param queue The queue of stars
+ * @param batch Index of the batch
+ */
+static void daemon_release(daemon_queue * queue, int batch)
+{
+    int i = daemon_held(queue, batch);
+
+    if (i < 0) return;
+    if (claim_done(queue->daemon->claims, queue->daemon->node,
+                   batch) != 0) {
+        printf("Unable to mark batch %d as done\n", batch);
+    }
+    daemon_forget(queue, i);
+}
+
+/**
+ * @brief Forgets a batch whose lease was lost to another daemon, which
+ *        carries on searching it. No more of its lines are taken from
+ *        the script, and it is never marked as done here.
+ * @param queue The queue of stars
+ * @param batch Index of the batch
+ */
+static void daemon_lost(daemon_queue * queue, int batch)
+{
+    int i = daemon_held(queue, batch);
+
+    printf("Lost the lease of batch %d\n", batch);
+    if (i >= 0) daemon_forget(queue, i);
+    if (queue->batch == batch) queue->batch = -1;
+}
+
+/**
+ * @brief Called once every line of the batch being read has been taken.
+ *        The batch is done when its last star has been searched.
+ * @param queue The queue of stars
+ */
+static void daemon_batch_read(daemon_queue * queue)
+{
+    if ((queue->jobs == queue->batch_jobs) ||
+        (queue->searched >= queue->jobs)) {
+        daemon_release(queue, queue->batch);
+    }
+    else {
+        queue->job[(queue->jobs - 1) % DAEMON_MAX_AHEAD].last_in_batch = 1;
+    }
+    queue->batch = -1;
+}
+
+/**
+ * @brief Claims the next batch which isn't held by another daemon, and
+ *        moves to where its search is to carry on
+ * @param queue The queue of stars
+ * @returns 1 if a batch was claimed, zero if all of the remaining
+ *          batches are held by other daemons, or -1 once every batch
+ *          has been searched
+ */
+static int daemon_claim(daemon_queue * queue)
+{
+    daemon_parameters * daemon = queue->daemon;
+    char line[DAEMON_LINE_LENGTH];
+    long next_line;
+    double poll = daemon->lease_seconds/DAEMON_RENEWALS;
+    int i, batch, status, leased = 0;
+
+    if ((daemon_time() < queue->claim_wait) ||
+        (queue->no_of_held > DAEMON_MAX_AHEAD)) {
+        return 0;
+    }
+
+    for (i = 0; i < queue->no_of_batches; i++) {
+        batch = queue->next_batch;
+        queue->next_batch = (batch + 1) % queue->no_of_batches;
+        /* already being searched here */
+        if (daemon_held(queue, batch) >= 0) continue;
+
+        status = claim_batch(daemon->claims, daemon->node, batch,
+                             daemon->lease_seconds, &next_line);
+        if (status < 0) {
+            printf("Unable to claim batch %d within %s\n",
+                   batch, daemon->claims);
+        }
+        if (status == CLAIM_DONE) continue;
+        if (status != CLAIM_CLAIMED) {
+            leased++;
+            continue;
+        }
+
+        /* the start of the batch, or where its last holder stopped */
+        fseek(queue->log, queue->batch_offset[batch], SEEK_SET);
+        queue->line_no = (long)batch*daemon->claim_size;
+        queue->batch_end = queue->line_no + daemon->claim_size;
+        if (queue->batch_end > queue->no_of_lines) {
+            queue->batch_end = queue->no_of_lines;
+        }
+        while ((queue->line_no < next_line - 1) &&
+               (queue->line_no < queue->batch_end) &&
+               (daemon_read_line(queue->log, line, sizeof(line)) != 0)) {
+            queue->line_no++;
+        }
+        queue->batch = batch;
+        queue->batch_jobs = queue->jobs;
+        queue->held[queue->no_of_held] = batch;
+        queue->held_line[queue->no_of_held] = queue->line_no + 1;
+        queue->no_of_held++;
+        return 1;
+    }
+    if (leased == 0) return -1;
+
+    /* look again later, for batches abandoned by stopped daemons */
+    if (poll > DAEMON_CLAIM_POLL) poll = DAEMON_CLAIM_POLL;
+    queue->claim_wait = daemon_time() + poll;
+    return 0;
+}
+
+/**
+ * @brief Reads the next line of the script which describes a star,
+ *        claiming batches of lines when they are shared
+ * @param queue The queue of stars
+ * @param line Returned line
+ * @param url Returned address of the star
+ * @param name Returned name of the downloaded file
+ * @returns 1 if a star was read, zero once the script is finished, or
+ *          -1 if the daemon should wait for other daemons' leases
+ */
+static int daemon_next_star(daemon_queue * queue, char * line,
+                            char ** url, char * name)
+{
+    int claiming = (queue->daemon->claims[0] != 0);
+    int status;
+
+    while (1) {
+        if (claiming && ((queue->batch < 0) ||
+                         (queue->line_no >= queue->batch_end))) {
+            if (queue->batch >= 0) daemon_batch_read(queue);
+            status = daemon_claim(queue);
+            if (status < 0) break;
+            if (status == 0) return -1;
+        }
+        if ((queue->line_no >= queue->end_line) ||
+            (daemon_read_line(queue->log, line, DAEMON_LINE_LENGTH) == 0)) {
+            if (!claiming) break;
+            queue->line_no = queue->batch_end;
+            continue;
+        }
+        queue->line_no++;
+        if (daemon_parse(line, url, name) == 0) return 1;
+    }
+    queue->finished = 1;
+    return 0;
+}
+
+/**
+ * @brief Renews the leases of the batches being searched, so that a
+ *        long search doesn't lose them
+ * @param arg The queue of stars
+ */
+static void * daemon_renewer(void * arg)
+{
+    daemon_queue * queue = (daemon_queue*)arg;
+    daemon_parameters * daemon = queue->daemon;
+    double interval = daemon->lease_seconds/DAEMON_RENEWALS;
+    struct timespec deadline;
+    int i;
+
+    if (interval < 1) interval = 1;
+    pthread_mutex_lock(&queue->lock);
+    while (queue->stopping == 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += (time_t)interval;
+        while ((queue->stopping == 0) &&
+               (pthread_cond_timedwait(&queue->changed, &queue->lock,
+                                       &deadline) == 0)) {
+        }
+        if (queue->stopping != 0) break;
+
+        i = 0;
+        while (i < queue->no_of_held) {
+            if (claim_renew(daemon->claims, daemon->node,
+                            queue->held[i], queue->held_line[i]) != 0) {
+                /* the last batch held takes its place */
+                daemon_lost(queue, queue->held[i]);
+                continue;
+            }
+            i++;
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+/**
+ * @brief Takes stars from the script in order and downloads them.
+ *        Several of these run at once, so that the network is kept
+ *        busy while stars are searched.
+ * @param arg The queue of stars
+ */
+static void * daemon_fetcher(void * arg)
+{
+    daemon_queue * queue = (daemon_queue*)arg;
+    char line[DAEMON_LINE_LENGTH], name[208], filename[256];
+    char * url;
+    daemon_job * job;
+    int status;
+
+    while (1) {
+        pthread_mutex_lock(&queue->lock);
+        while ((queue->finished == 0) &&
+               (queue->jobs - queue->searched >= queue->daemon->ahead)) {
+            pthread_cond_wait(&queue->changed, &queue->lock);
+        }
+
+        /* the next line which describes a star */
+        status = 0;
+        if (queue->finished == 0) {
+            status = daemon_next_star(queue, line, &url, name);
+        }
+        if (status < 0) {
+            /* every remaining batch is held by other daemons */
+            pthread_mutex_unlock(&queue->lock);
+            sleep(1);
+            continue;
+        }
+        if (status == 0) {
+            pthread_cond_broadcast(&queue->changed);
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+        job = &queue->job[queue->jobs % DAEMON_MAX_AHEAD];
+        job->line_no = queue->line_no;
+        job->state = DAEMON_JOB_FETCHING;
+        job->batch = queue->batch;
+        job->last_in_batch = 0;
+        snprintf(filename, sizeof(filename), "%s/%s",
+                 DAEMON_INCOMING, name);
+        sprintf(job->filename, "%s", filename);
+        queue->jobs++;
+        pthread_mutex_unlock(&queue->lock);
+
+        status = daemon_fetch(queue->daemon, url, name, filename);
+        if (status != 0) printf("Unable to fetch %s\n", url);
+
+        pthread_mutex_lock(&queue->lock);
+        job->state = (status == 0) ? DAEMON_JOB_FETCHED : DAEMON_JOB_FAILED;
+        pthread_cond_broadcast(&queue->changed);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Loads stars in the order of the script as they are fetched,
+ *        ahead of the search
+ * @param arg The queue of stars
+ */
+static void * daemon_loader(void * arg)
+{
+    daemon_queue * queue = (daemon_queue*)arg;
+    daemon_job * job;
+    long i;
+
+    for (i = 0; ; i++) {
+        /* wait for the star to be fetched and for a free slot */
+        pthread_mutex_lock(&queue->lock);
+        while (((i >= queue->jobs) && (queue->finished == 0)) ||
+               ((i < queue->jobs) &&
+                ((queue->job[i % DAEMON_MAX_AHEAD].state ==
+                  DAEMON_JOB_FETCHING) ||
+                 (i - queue->searched >= DAEMON_SLOTS)))) {
+            pthread_cond_wait(&queue->changed, &queue->lock);
+        }
+        if (i >= queue->jobs) {
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+        job = &queue->job[i % DAEMON_MAX_AHEAD];
+        pthread_mutex_unlock(&queue->lock);
+
+        /* stars which failed to download are loaded too, so that
+           they are reported with their names */
+        scan_load(queue->params, job->filename,
+                  &queue->slot[i % DAEMON_SLOTS]);
+
+        pthread_mutex_lock(&queue->lock);
+        queue->loaded++;
+        pthread_cond_broadcast(&queue->changed);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Moves a file into the candidates directory, if it exists
+ * @param filename The file
+ * @param name Its name within the candidates directory
+ */
+static void daemon_candidate(char * filename, char * name)
+{
+    char destination[600];
+
+    snprintf(destination, sizeof(destination), "%s/%s",
+             DAEMON_CANDIDATES, name);
+    rename(filename, destination);
+}
+
+/**
+ * @brief Counts the lines of a file, leaving it at its start
+ * @param fp The file
+ * @returns The number of lines
+ */
+static long daemon_count_lines(FILE * fp)
+{
+    char line[DAEMON_LINE_LENGTH];
+    long no_of_lines = 0;
+
+    while (daemon_read_line(fp, line, sizeof(line)) != 0) no_of_lines++;
+    rewind(fp);
+    return no_of_lines;
+}
+
+/**
+ * @brief Searches every star listed in a download script. Stars are
+ *        fetched into an incoming directory within the working
+ *        directory and deleted once searched, unless a transit is
+ *        found, in which case they are moved into the candidates
+ *        directory together with their plots.
+ * @param params Scan parameters
+ * @param daemon The daemon parameters
+ * @returns zero on success
+ */
+int daemon_run(scan_parameters * params, daemon_parameters * daemon)
+{
+    daemon_queue queue;
+    daemon_job job;
+    pthread_t fetcher[DAEMON_MAX_AHEAD], loader, renewer;
+    scan_series * star;
+    FILE * searched_log;
+    char line[DAEMON_LINE_LENGTH], name[512], * mirror, * claims;
+    float orbital_period_days;
+    long start_line = 1, no_of_lines, i;
+    int no_of_fetchers = 0, status, found = 0, not_fetched = 0, held;
+    int claiming = (daemon->claims[0] != 0);
+    int text = (params->output == SCAN_OUTPUT_TEXT);
+    double start_time, elapsed;
+
+    memset(&queue, 0, sizeof(daemon_queue));
+    queue.params = params;
+    queue.daemon = daemon;
+    queue.end_line = LONG_MAX;
+    queue.batch = -1;
+    if (daemon->fetchers < 1) daemon->fetchers = 1;
+    if (daemon->fetchers > DAEMON_MAX_AHEAD) {
+        daemon->fetchers = DAEMON_MAX_AHEAD;
+    }
+    if (daemon->ahead < daemon->fetchers) {
+        daemon->ahead = daemon->fetchers*2;
+    }
+    if (daemon->ahead > DAEMON_MAX_AHEAD) daemon->ahead = DAEMON_MAX_AHEAD;
+
+    /* paths given relative to where the daemon was started */
+    queue.log = fopen(daemon->log, "r");
+    if (queue.log == NULL) {
+        printf("Log file not found %s\n", daemon->log);
+        return -1;
+    }
+    if (daemon->mirror[0] != 0) {
+        mirror = realpath(daemon->mirror, NULL);
+        if ((mirror == NULL) || (strlen(mirror) >= sizeof(daemon->mirror))) {
+            printf("Mirror directory not found %s\n", daemon->mirror);
+            free(mirror);
+            fclose(queue.log);
+            return -1;
+        }
+        sprintf(daemon->mirror, "%s", mirror);
+        free(mirror);
+    }
+    if (claiming) {
+        mkdir(daemon->claims, 0755);
+        claims = realpath(daemon->claims, NULL);
+        if ((claims == NULL) || (strlen(claims) >= sizeof(daemon->claims))) {
+            printf("Claims directory not found %s\n", daemon->claims);
+            free(claims);
+            fclose(queue.log);
+            return -1;
+        }
+        sprintf(daemon->claims, "%s", claims);
+        free(claims);
+        if (daemon->node[0] == 0) {
+            gethostname(daemon->node, sizeof(daemon->node) - 1);
+        }
+        if (daemon->claim_size < 1) daemon->claim_size = 1;
+        if (daemon_batches(&queue) != 0) {
+            printf("Unable to read the log file %s\n", daemon->log);
+            fclose(queue.log);
+            return -1;
+        }
+        if (claim_layout(daemon->claims, queue.no_of_lines,
+                         daemon->claim_size) != 0) {
+            printf("The log file or claim size differs from other "
+                   "daemons sharing %s\n", daemon->claims);
+            free(queue.batch_offset);
+            fclose(queue.log);
+            return -1;
+        }
+    }
+    if (chdir(daemon->working_dir) != 0) {
+        printf("Working directory not found %s\n", daemon->working_dir);
+        fclose(queue.log);
+        return -1;
+    }
+    /* a restart shouldn't throw away a long search */
+    if (params->checkpoint[0] == 0) {
+        sprintf(params->checkpoint, "%s", DAEMON_CHECKPOINT);
+    }
+    mkdir(DAEMON_INCOMING, 0755);
+    mkdir(DAEMON_CANDIDATES, 0755);
+    daemon_clean(DAEMON_INCOMING);
+
+    /* the range of lines to be searched, unless batches are claimed */
+    if (claiming) {
+        start_line = 1;
+    }
+    else if ((daemon->start_percent > 0) || (daemon->end_percent < 100)) {
+        no_of_lines = daemon_count_lines(queue.log);
+        start_line = (long)(no_of_lines*daemon->start_percent/100) + 1;
+        queue.end_line = (long)(no_of_lines*daemon->end_percent/100);
+    }
+    i = claiming ? 1 : daemon_cursor_load(daemon->cursor);
+    if (i > start_line) start_line = i;
+    while ((queue.line_no < start_line - 1) &&
+           (daemon_read_line(queue.log, line, sizeof(line)) != 0)) {
+        queue.line_no++;
+    }
+
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.changed, NULL);
+    start_time = daemon_time();
+    for (no_of_fetchers = 0; no_of_fetchers < daemon->fetchers;
+         no_of_fetchers++) {
+        if (pthread_create(&fetcher[no_of_fetchers], NULL,
+                           daemon_fetcher, &queue) != 0) break;
+    }
+    if ((no_of_fetchers == 0) ||
+        (pthread_create(&loader, NULL, daemon_loader, &queue) != 0) ||
+        (claiming &&
+         (pthread_create(&renewer, NULL, daemon_renewer, &queue) != 0))) {
+        printf("Unable to start the daemon threads\n");
+        return -2;
+    }
+
+    for (i = 0; ; i++) {
+        /* wait for the star to be loaded */
+        pthread_mutex_lock(&queue.lock);
+        while ((queue.loaded <= i) &&
+               ((queue.finished == 0) || (i < queue.jobs))) {
+            pthread_cond_wait(&queue.changed, &queue.lock);
+        }
+        if (queue.loaded <= i) {
+            pthread_mutex_unlock(&queue.lock);
+            break;
+        }
+        job = queue.job[i % DAEMON_MAX_AHEAD];
+        pthread_mutex_unlock(&queue.lock);
+
+        star = &queue.slot[i % DAEMON_SLOTS];
+        if (text) printf("Scanning %s\n", job.filename);
+        if (job.state == DAEMON_JOB_FAILED) {
+            status = SCAN_STATUS_NOT_FETCHED;
+            not_fetched++;
+        }
+        else if (star->length < params->minimum_data_samples) {
+            status = 1;
+        }
+        else {
+            status = scan_search(params, star, &orbital_period_days);
+        }
+
+        if (status == 0) {
+            if (params->plot != 0) {
+                scan_plot(params, star, orbital_period_days);
+                snprintf(name, sizeof(name), "%s.png", star->name);
+                daemon_candidate(name, name);
+                snprintf(name, sizeof(name), "%s_distr.png", star->name);
+                daemon_candidate(name, name);
+            }
+            daemon_candidate(job.filename,
+                             &job.filename[strlen(DAEMON_INCOMING) + 1]);
+            if (text) {
+                printf("result %s samples %d orbital_period_days %.6f\n",
+                       star->name, star->length, orbital_period_days);
+                printf("candidate %s/%s\n", DAEMON_CANDIDATES,
+                       &job.filename[strlen(DAEMON_INCOMING) + 1]);
+            }
+            found++;
+        }
+        else {
+            unlink(job.filename);
+            if (text) {
+                printf("result %s samples %d status %s\n",
+                       star->name, star->length, scan_status_name(status));
+            }
+        }
+        scan_report(params, star, status);
+        scan_stats_report(params, star);
+
+        searched_log = fopen("searched.log", "a");
+        if (searched_log != NULL) {
+            fprintf(searched_log, "%s\n",
+                    &job.filename[strlen(DAEMON_INCOMING) + 1]);
+            fclose(searched_log);
+        }
+        if ((!claiming) &&
+            (daemon_cursor_save(daemon->cursor, job.line_no + 1) != 0)) {
+            printf("Unable to save the cursor %s\n", daemon->cursor);
+        }
+
+        scan_series_release(star);
+        pthread_mutex_lock(&queue.lock);
+        if (claiming) {
+            /* progress is kept within the lease of the batch */
+            held = daemon_held(&queue, job.batch);
+            if (held >= 0) {
+                queue.held_line[held] = job.line_no + 1;
+                if (claim_renew(daemon->claims, daemon->node, job.batch,
+                                job.line_no + 1) != 0) {
+                    daemon_lost(&queue, job.batch);
+                }
+            }
+            if (queue.job[i % DAEMON_MAX_AHEAD].last_in_batch != 0) {
+                daemon_release(&queue, job.batch);
+            }
+        }
+        fflush(stdout);
+        queue.searched++;
+        pthread_cond_broadcast(&queue.changed);
+        pthread_mutex_unlock(&queue.lock);
+    }
+
+    for (i = 0; i < no_of_fetchers; i++) {
+        pthread_join(fetcher[i], NULL);
+    }
+    pthread_join(loader, NULL);
+    if (claiming) {
+        pthread_mutex_lock(&queue.lock);
+        queue.stopping = 1;
+        pthread_cond_broadcast(&queue.changed);
+        pthread_mutex_unlock(&queue.lock);
+        pthread_join(renewer, NULL);
+        free(queue.batch_offset);
+    }
+    for (i = 0; i < DAEMON_SLOTS; i++) {
+        scan_series_free(&queue.slot[i]);
+    }
+    pthread_mutex_destroy(&queue.lock);
+    pthread_cond_destroy(&queue.changed);
+    fclose(queue.log);
+
+    elapsed = daemon_time() - start_time;
+    if (!text) return 0;
+    printf("%ld stars searched in %.1f seconds, %.1f stars/hour, "
+           "%d with transits, %d not fetched\n",
+           queue.searched, elapsed,
+           (elapsed > 0) ? queue.searched*3600.0/elapsed : 0,
+           found, not_fetched);
+    return 0;
+}
@@ -16,14 +16,12 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "waspscan.h"
 
-/* length of the light curve used for transit detection */
-#define DETECT_CURVE_LENGTH 256
-
-/* maximum percentage of the light curve which may be missing */
-#define MISSING_THRESHOLD   4
-
 /**
  * @brief Detects the starting and ending indexes of active
  *        data sections within a time series
@@ -32,12 +30,12 @@
  * @param endpoints An array of returned start and end indexes
  * @returns The number of data sections within the series
  */
-int detect_endpoints(float timestamp[], int series_length,
+int detect_endpoints(double timestamp[], int series_length,
                      int endpoints[])
 {
     int start_index = 0;
-    float variance;
-    float threshold, dt, mean_dt = 0, dt_variance = 0;
+    double variance;
+    double threshold, dt, mean_dt = 0, dt_variance = 0;
     int i,ctr=0;
 
     for (i = 1; i < series_length; i++) {
@@ -49,7 +47,7 @@ int detect_endpoints(float timestamp[], int series_length,
         variance = (timestamp[i] - timestamp[i-1]) - mean_dt;
         dt_variance += variance*variance;
     }
-    dt_variance = (float)sqrt(dt_variance/(series_length-1));
+    dt_variance = sqrt(dt_variance/(series_length-1));
     threshold = dt_variance*10;
 
     for (i = 1; i < series_length-1; i++) {
@@ -66,162 +64,163 @@ int detect_endpoints(float timestamp[], int series_length,
 }
 
 /**
- * @brief Calculates the amount of variance for a light curve
- * @param period_days Orbital period in days
- * @param timestamp
+ * @brief Returns the average value for all data points
+ * @param series Array containing the data points
+ * @param series_length Length of the array
+ * @returns Average value
  */
-static float light_curve_variance(float period_days,
-                                  float timestamp[],
-                                  float series[],
-                                  int series_length,
-                                  float curve[], int curve_length)
+float detect_mean(float series[], int series_length)
 {
-    int i, index;
-    float days, variance = 0;
+    int i;
+    double mean = 0;
 
     for (i = 0; i < series_length; i++) {
-        days = timestamp[i] / (60.0f*60.0f*24.0f);
-        index = (int)(fmod(days,period_days) * curve_length / period_days);
-        variance += (series[i] - curve[index])*(series[i] - curve[index]);
+        mean += series[i];
     }
-    return (float)sqrt(variance/series_length);
+    return (float)(mean/series_length);
 }
 
 /**
- * @brief Returns an array containing a light curve for the given orbital period_days
- * @param timestamp Array of imaging times
- * @param series Array containing magnitudes
- * @param series_length The length of the data series
- * @param period_days The expected orbital period
- * @param curve Returned light curve Array
- * @param density Density of samples
- * @param curve_length The number of buckets within the curve
+ * @brief Returns the variance for all data points in a series
+ * @param series Array containing data points
+ * @param series_length Length of the Array
+ * @param mean Pre-calculated mean value
+ * @returns Variance value
  */
-static void light_curve_base(float timestamp[],
-                             float series[], int series_length,
-                             float period_days,
-                             float curve[], float density[], int curve_length)
+float detect_variance(float series[], int series_length, float mean)
 {
-    int i, index;
-    float days, max_samples=0;
-
-    for (i = 0; i < curve_length; i++) {
-        curve[i] = 0;
-        density[i] = 0;
-    }
+    int i;
+    double variance = 0;
 
     for (i = 0; i < series_length; i++) {
-        days = timestamp[i] / (60.0f*60.0f*24.0f);
-        index = (int)(fmod(days,period_days) * curve_length / period_days);
-        curve[index] += series[i];
-        density[index]++;
+        variance += (series[i] - mean)*(series[i] - mean);
     }
+    return (float)sqrt(variance/series_length);
+}
 
-    for (i = 0; i < curve_length; i++) {
-        if (density[i] > 0) {
-            curve[i] /= density[i];
-        }
-        if (density[i] > max_samples) {
-            max_samples = density[i];
-        }
-    }
-    /* normalise */
-    for (i = 0; i < curve_length; i++) {
-        density[i] /= max_samples;
-    }
+/**
+ * @brief Compares two magnitudes, for sorting
+ */
+static int detect_compare_values(const void * a, const void * b)
+{
+    float fa = *(const float*)a, fb = *(const float*)b;
+
+    if (fa < fb) return -1;
+    if (fa > fb) return 1;
+    return 0;
 }
 
 /**
- * @brief Resamples a light curve within bounds.
- *        This is used to disguard outliers which otherwise
- *        cause distraction.
- * @param min_value Minimum value
- * @param max_value Maximum value
- * @param timestamp Array of imaging times
+ * @brief Calculates the median and a robust standard deviation from
+ *        the median absolute deviation, which outliers and transits
+ *        hardly affect
  * @param series Array containing magnitudes
  * @param series_length The length of the data series
- * @param period_days The expected orbital period
- * @param curve Returned light curve Array
- * @param density Density of samples
- * @param curve_length The number of buckets within the curve
+ * @param median Returned median
+ * @param scatter Returned standard deviation
+ * @returns zero on success
  */
-static void light_curve_resample(float min_value, float max_value,
-                                 float timestamp[],
-                                 float series[], int series_length,
-                                 float period_days,
-                                 float curve[], int curve_length)
+int detect_scatter(float series[], int series_length,
+                   float * median, float * scatter)
 {
-    int i, index;
-    float days;
-    int hits[512];
+    float * sorted = (float*)malloc(series_length*sizeof(float));
+    int i;
 
-    for (i = 0; i < curve_length; i++) {
-        curve[i] = 0;
-        hits[i] = 0;
-    }
+    if (sorted == NULL) return -1;
+
+    memcpy(sorted, series, series_length*sizeof(float));
+    qsort(sorted, series_length, sizeof(float), detect_compare_values);
+    *median = sorted[series_length/2];
 
     for (i = 0; i < series_length; i++) {
-        if ((series[i] < min_value) ||
-            (series[i] > max_value)) {
-            continue;
-        }
-        days = timestamp[i] / (60.0f*60.0f*24.0f);
-        index = (int)(fmod(days,period_days) * curve_length / period_days);
-        curve[index] += series[i];
-        hits[index]++;
-    }
-    for (i = 0; i < curve_length; i++) {
-        if (curve[i] > 0) {
-            curve[i] /= hits[i];
-        }
+        sorted[i] = (float)fabs(series[i] - *median);
     }
+    qsort(sorted, series_length, sizeof(float), detect_compare_values);
+    /* scaled so that it matches the standard deviation of noise */
+    *scatter = sorted[series_length/2]*1.4826f;
 
-    /* fill any holes */
-    for (i = 0; i < curve_length; i++) {
-        if (curve[i] == 0) {
-            if (i > 0) {
-                curve[i] = curve[i-1];
-            }
-            else {
-                curve[i] = curve[curve_length-1];
-            }
-        }
-    }
+    free(sorted);
+    return 0;
 }
 
+/* A magnitude and its weight, for finding weighted medians */
+typedef struct {
+    float value;
+    float weight;
+} detect_weighted_value;
+
 /**
- * @brief Returns the average value for all data points
- * @param series Array containing the data points
- * @param series_length Length of the array
- * @returns Average value
+ * @brief Compares two weighted magnitudes, for sorting
  */
-float detect_mean(float series[], int series_length)
+static int detect_compare_weighted(const void * a, const void * b)
+{
+    return detect_compare_values(&((const detect_weighted_value*)a)->value,
+                                 &((const detect_weighted_value*)b)->value);
+}
+
+/**
+ * @brief Returns the weighted median of values which are sorted
+ * @param sorted Array of values and weights in ascending order
+ * @param length The number of values
+ * @param total_weight The sum of the weights
+ * @returns The value at which half of the weight has been passed
+ */
+static float detect_weighted_median(detect_weighted_value sorted[],
+                                    int length, double total_weight)
 {
+    double cumulative = 0;
     int i;
-    double mean = 0;
 
-    for (i = 0; i < series_length; i++) {
-        mean += series[i];
+    for (i = 0; i < length - 1; i++) {
+        cumulative += sorted[i].weight;
+        if (cumulative >= total_weight*0.5) break;
     }
-    return (float)(mean/series_length);
+    return sorted[i].value;
 }
 
 /**
- * @brief Returns the variance for all data points in a series
- * @param series Array containing data points
- * @param series_length Length of the Array
- * @param mean Pre-calculated mean value
- * @returns Variance value
+ * @brief Calculates the median and robust standard deviation of
+ *        weighted magnitudes, as detect_scatter does, so that a sample
+ *        with twice the weight counts as two samples
+ * @param series Array containing magnitudes
+ * @param weight Array containing the weight of each magnitude
+ * @param series_length The length of the data series
+ * @param median Returned weighted median
+ * @param scatter Returned standard deviation
+ * @returns zero on success
  */
-float detect_variance(float series[], int series_length, float mean)
+int detect_weighted_scatter(float series[], float weight[],
+                            int series_length,
+                            float * median, float * scatter)
 {
+    detect_weighted_value * sorted;
+    double total_weight = 0;
     int i;
-    double variance = 0;
+
+    sorted = (detect_weighted_value*)
+        malloc(series_length*sizeof(detect_weighted_value));
+    if (sorted == NULL) return -1;
 
     for (i = 0; i < series_length; i++) {
-        variance += (series[i] - mean)*(series[i] - mean);
+        sorted[i].value = series[i];
+        sorted[i].weight = weight[i];
+        total_weight += weight[i];
     }
-    return (float)sqrt(variance/series_length);
+    qsort(sorted, series_length, sizeof(detect_weighted_value),
+          detect_compare_weighted);
+    *median = detect_weighted_median(sorted, series_length, total_weight);
+
+    for (i = 0; i < series_length; i++) {
+        sorted[i].value = (float)fabs(series[i] - *median);
+        sorted[i].weight = weight[i];
+    }
+    qsort(sorted, series_length, sizeof(detect_weighted_value),
+          detect_compare_weighted);
+    *scatter =
+        detect_weighted_median(sorted, series_length, total_weight)*1.4826f;
+
+    free(sorted);
+    return 0;
 }
 
 /**
@@ -252,27 +251,21 @@ int missing_data(float density[], int curve_length)
  * @param curve_length The number of buckets within the curve
  * @return zero on success
  */
-int light_curve(float timestamp[],
+int light_curve(double timestamp[],
                 float series[], int series_length,
                 float period_days,
                 float curve[], float density[], int curve_length)
 {
-    float mean, variance;
-
-    light_curve_base(timestamp, series, series_length,
-                     period_days, curve, density, curve_length);
-
-    if (missing_data(density, curve_length)*100/curve_length >
-        MISSING_THRESHOLD)
-        return -1;
+    fold_context fold;
+    int retval;
 
-    mean = detect_mean(series, series_length);
-    variance = detect_variance(series, series_length, mean);
+    if (fold_context_init(&fold, timestamp, series, series_length) != 0)
+        return -2;
 
-    light_curve_resample(mean - variance, mean + variance,
-                         timestamp, series, series_length,
-                         period_days, curve, curve_length);
-    return 0;
+    retval = fold_light_curve(&fold, period_days,
+                              curve, density, curve_length);
+    fold_context_free(&fold);
+    return retval;
 }
 
 /**
@@ -327,184 +320,926 @@ void adjust_curve(float curve[], int curve_length, int offset)
 }
 
 /**
- * @brief Attempts to detect the orbital period via the transit method.
- *        This tries many possible periods and looks for a dip in
- *        magnitude.
- * @param timestamp Times for observations
- * @param series Magnitude observations
- * @param series_length Length of the Array
- * @param min_period_days The minimum orbital period in days
- * @param max_period_days The maximum orbital period in days
- * @param increment_days The time increment used within the min/max range
- * @returns The best candidate orbital period, or zero if no transit found
+ * @brief Returns the transit detection response for a single
+ *        trial orbital period
+ * @param moments Moments of each bucket folded at the trial period
+ * @param curve_length The number of buckets within the light curve,
+ *        up to DETECT_CURVE_LENGTH
+ * @param outcome Returned DETECT_SCORED, or the reason for rejecting
+ *        the period
+ * @returns Response value, or zero if no transit is apparent
  */
-float detect_orbital_period(float timestamp[],
-                            float series[], int series_length,
-                            float min_period_days,
-                            float max_period_days,
-                            float increment_days)
+static float detect_period_response(fold_moments * moments,
+                                    int curve_length, int * outcome)
 {
-    float period_days=0;
-    float max_response = 0;
-    const int expected_width = DETECT_CURVE_LENGTH*2/100;
-    const int max_dipped = DETECT_CURVE_LENGTH*15/100;
-    const int max_nondipped = DETECT_CURVE_LENGTH*10/100;
-    int step = 0;
-    int steps = (int)((max_period_days - min_period_days)/increment_days);
-    float response[MAX_SEARCH_STEPS];
-
-    if (steps > MAX_SEARCH_STEPS) {
-        printf("Maximum number of time steps exceeded\n");
+    float curve[DETECT_CURVE_LENGTH];
+    float density[DETECT_CURVE_LENGTH];
+    float response = 0;
+    const int expected_width = curve_length*2/100;
+    const int max_dipped = curve_length*15/100;
+    const int max_nondipped = curve_length*10/100;
+
+    if (fold_moments_curve(moments, curve, density, curve_length) != 0) {
+        *outcome = DETECT_MISSING_DATA;
         return 0;
     }
 
-    /* Try different orbital periods in parallel */
-#pragma omp parallel for
-    for (step = 0; step < steps; step++) {
-        float curve[DETECT_CURVE_LENGTH];
-        float density[DETECT_CURVE_LENGTH];
-        float orbital_period_days = min_period_days + (step*increment_days);
+    /* calculate the mean */
+    float mean = 0;
+    int hits = 0;
+    for (int j = 0; j < curve_length; j++) {
+        if (curve[j]>0) {
+            mean += curve[j];
+            hits++;
+        }
+    }
+    /* there should be no gaps in the series */
+    if (hits < curve_length) {
+        *outcome = DETECT_GAPS;
+        return 0;
+    }
+    mean /= hits;
 
-        if (light_curve(timestamp, series, series_length,
-                        orbital_period_days,
-                        curve, density, DETECT_CURVE_LENGTH) != 0)
-            continue;
+    /* average density of samples */
+    float mean_density = 0;
+    hits = 0;
+    for (int j = 0; j < curve_length; j++) {
+        if (density[j] > 0) {
+            mean_density += density[j];
+            hits++;
+        }
+    }
+    mean_density /= hits;
 
-        float variance =
-            light_curve_variance(orbital_period_days,
-                                 timestamp, series,
-                                 series_length,
-                                 curve, DETECT_CURVE_LENGTH);
-
-        /* calculate the mean */
-        float mean = 0;
-        int hits = 0;
-        for (int j = 0; j < DETECT_CURVE_LENGTH; j++) {
-            if (curve[j]>0) {
-                mean += curve[j];
+    /* variation in the density of samples */
+    float density_variance = 0;
+    hits = 0;
+    for (int j = 0; j < curve_length; j++) {
+        if (density[j] > 0) {
+            density_variance +=
+                (density[j] - mean_density)*
+                (density[j] - mean_density);
+            hits++;
+        }
+    }
+    density_variance =
+        (float)(density_variance/hits);
+
+    /* find the minimum */
+    float minimum = 0;
+    for (int j = 0; j < curve_length; j++) {
+        float v = 0;
+        hits = 0;
+        for (int k = j-expected_width; k <= j+expected_width; k++) {
+            int l = k;
+            if (l < 0) l += curve_length;
+            if (l >= curve_length) l -= curve_length;
+            if (curve[l] > 0) {
+                v += curve[l];
                 hits++;
+                if (k == j) {
+                    v += curve[l];
+                    hits++;
+                }
             }
         }
-        /* there should be no gaps in the series */
-        if (hits < DETECT_CURVE_LENGTH) {
-            response[step] = 0;
-            continue;
+        if (hits > 0) {
+            v /= hits;
+            if ((v < minimum) || (minimum == 0)) {
+                minimum = v;
+            }
         }
-        mean /= hits;
+    }
 
-        /* average density of samples */
-        float mean_density = 0;
-        hits = 0;
-        for (int j = 0; j < DETECT_CURVE_LENGTH; j++) {
-            if (density[j] > 0) {
-                mean_density += density[j];
-                hits++;
+    /* How much difference from the mean? */
+    int dipped = 0;
+    float threshold_dipped = minimum + ((mean-minimum)*0.2);
+    for (int j = 0; j < curve_length; j++) {
+        if (curve[j] < threshold_dipped) {
+            dipped++;
+            if (dipped > max_dipped) {
+                break;
             }
         }
-        mean_density /= hits;
+    }
+    /* we only expect a small percentage
+       of the curve to be dipped */
+    if (dipped > max_dipped) {
+        *outcome = DETECT_TOO_MANY_DIPPED;
+        return 0;
+    }
+    if (dipped == 0) {
+        *outcome = DETECT_NO_DIP;
+        return 0;
+    }
 
-        /* variation in the density of samples */
-        float density_variance = 0;
-        hits = 0;
-        for (int j = 0; j < DETECT_CURVE_LENGTH; j++) {
-            if (density[j] > 0) {
-                density_variance +=
-                    (density[j] - mean_density)*
-                    (density[j] - mean_density);
-                hits++;
+    /* How much difference from the mean? */
+    int nondipped = 0;
+    float threshold_upper = mean - ((mean-minimum)*0.2);
+    for (int j = 0; j < curve_length; j++) {
+        if ((curve[j] < threshold_upper) &&
+            (curve[j] > threshold_dipped)) {
+            nondipped++;
+            if (nondipped > max_nondipped) {
+                break;
             }
         }
-        density_variance =
-            (float)(density_variance/hits);
-
-        /* find the minimum */
-        float minimum = 0;
-        for (int j = 0; j < DETECT_CURVE_LENGTH; j++) {
-            float v = 0;
-            hits = 0;
-            for (int k = j-expected_width; k <= j+expected_width; k++) {
-                int l = k;
-                if (l < 0) l += DETECT_CURVE_LENGTH;
-                if (l >= DETECT_CURVE_LENGTH) l -= DETECT_CURVE_LENGTH;
-                if (curve[l] > 0) {
-                    v += curve[l];
-                    hits++;
-                    if (k == j) {
-                        v += curve[l];
-                        hits++;
-                    }
-                }
+    }
+    if (nondipped > max_nondipped) {
+        *outcome = DETECT_TOO_MANY_NONDIPPED;
+        return 0;
+    }
+    *outcome = DETECT_SCORED;
+
+    float variance = 0;
+    hits = 0;
+    for (int j = 0; j < curve_length; j++) {
+        if (curve[j] > 0) {
+            variance += (curve[j] - mean)*(curve[j] - mean);
+            hits++;
+        }
+    }
+    if (hits > 0) {
+        response =
+            (mean-minimum) /
+            (float)sqrt(variance/hits);
+        response =
+            (mean-minimum)*dipped*100/(mean*(1+nondipped));
+        response /= (density_variance*variance);
+    }
+    return response;
+}
+
+/**
+ * @brief Returns the response of the chosen detection method to
+ *        samples folded at a trial orbital period
+ * @param fold Precalculated values for the series being searched
+ * @param moments Moments of each bucket folded at the trial period
+ * @param period_days The trial orbital period
+ * @param curve_length The number of buckets within the light curve
+ * @param method DETECT_METHOD_HEURISTIC or DETECT_METHOD_BLS
+ * @param outcome Returned DETECT_SCORED, or the reason for rejecting
+ *        the period
+ * @returns Response value, or zero if no transit is apparent
+ */
+static float detect_moments_response(fold_context * fold,
+                                     fold_moments * moments,
+                                     float period_days, int curve_length,
+                                     int method, int * outcome)
+{
+    float response, weight = 0;
+    int i;
+
+    if (method != DETECT_METHOD_BLS) {
+        return detect_period_response(moments, curve_length, outcome);
+    }
+
+    response = bls_moments_response(fold, moments, period_days,
+                                    curve_length, NULL);
+    *outcome = DETECT_SCORED;
+    if (response == 0) {
+        for (i = 0; i < curve_length; i++) {
+            weight += moments->inliers[i];
+        }
+        *outcome = (weight < BLS_MIN_TRANSIT_SAMPLES*2) ?
+            DETECT_TOO_FEW_SAMPLES : DETECT_NO_DIP;
+    }
+    return response;
+}
+
+/**
+ * @brief Returns the response of the chosen detection method to a
+ *        trial orbital period
+ * @param fold Precalculated values for the series being searched
+ * @param period_days The trial orbital period
+ * @param curve_length The number of buckets within the light curve
+ * @param method DETECT_METHOD_HEURISTIC or DETECT_METHOD_BLS
+ * @param outcome Returned DETECT_SCORED, or the reason for rejecting
+ *        the period
+ * @param workspace Array of fold_bin_workspace floats
+ * @returns Response value, or zero if no transit is apparent
+ */
+static float detect_response(fold_context * fold,
+                             float period_days, int curve_length,
+                             int method, int * outcome, float workspace[])
+{
+    fold_moments moments;
+
+    fold_bin(fold, period_days, curve_length, &moments, workspace);
+    return detect_moments_response(fold, &moments, period_days,
+                                   curve_length, method, outcome);
+}
+
+/**
+ * @brief Adds the counters of one thread to those of the search.
+ *        This should be called within a critical section.
+ * @param fold Precalculated values for the series being searched
+ * @param outcomes Number of trial periods with each outcome
+ */
+static void detect_count(fold_context * fold, long outcomes[])
+{
+    int i;
+
+    if (fold->statistics == NULL) return;
+    for (i = 0; i < DETECT_OUTCOMES; i++) {
+        fold->statistics->periods[i] += outcomes[i];
+    }
+#ifdef _OPENMP
+    if (omp_get_num_threads() > fold->statistics->threads) {
+        fold->statistics->threads = omp_get_num_threads();
+    }
+#else
+    if (fold->statistics->threads < 1) fold->statistics->threads = 1;
+#endif
+}
+
+/**
+ * @brief Orders candidates by descending score, and those with equal
+ *        scores by ascending period, so that the order never depends
+ *        on which was found first
+ */
+static int detect_compare_candidates(const void * a, const void * b)
+{
+    const transit_candidate * ca = (const transit_candidate*)a;
+    const transit_candidate * cb = (const transit_candidate*)b;
+
+    if (ca->score > cb->score) return -1;
+    if (ca->score < cb->score) return 1;
+    if (ca->period_days < cb->period_days) return -1;
+    if (ca->period_days > cb->period_days) return 1;
+    return 0;
+}
+
+/**
+ * @brief Inserts a candidate into a list of the best candidates, which
+ *        is kept in the order of detect_compare_candidates. Candidates
+ *        closer in frequency than the width of a peak belong to the
+ *        same peak, and only the highest point of each peak is kept,
+ *        so a new highest point replaces every listed peak within the
+ *        width of it.
+ * @param list The best candidates
+ * @param length The current number of candidates, which is updated
+ * @param max_length The maximum number of candidates
+ * @param peak_width Width of a peak in cycles per day
+ * @param candidate The new candidate
+ */
+static void detect_insert_candidate(transit_candidate list[],
+                                    int * length, int max_length,
+                                    double peak_width,
+                                    transit_candidate * candidate)
+{
+    double freq = 1.0 / candidate->period_days;
+    int i, j;
+
+    if (candidate->score <= 0) return;
+    if ((*length == max_length) &&
+        (detect_compare_candidates(candidate, &list[*length-1]) >= 0)) {
+        return;
+    }
+
+    /* is this a higher point of peaks which are already listed? */
+    for (i = 0; i < *length; i++) {
+        if ((fabs((1.0 / list[i].period_days) - freq) < peak_width) &&
+            (detect_compare_candidates(candidate, &list[i]) >= 0)) {
+            return;
+        }
+    }
+    for (i = 0, j = 0; i < *length; i++) {
+        if (fabs((1.0 / list[i].period_days) - freq) < peak_width) {
+            continue;
+        }
+        list[j++] = list[i];
+    }
+    *length = j;
+
+    if (*length < max_length) (*length)++;
+    for (i = *length-1; i > 0; i--) {
+        if (detect_compare_candidates(&list[i-1], candidate) <= 0) break;
+        list[i] = list[i-1];
+    }
+    list[i] = *candidate;
+}
+
+/**
+ * @brief Returns whether two frequencies are harmonics of each other
+ *        or are separated by a whole number of sidereal days, either
+ *        of which would produce a peak at the same transits
+ * @param freq1 The first frequency in cycles per day
+ * @param freq2 The second frequency in cycles per day
+ * @param peak_width Width of a peak in cycles per day
+ * @returns Non-zero if the frequencies are aliases
+ */
+static int detect_is_alias(double freq1, double freq2, double peak_width)
+{
+    int n, m;
+
+    for (n = 1; n <= DETECT_HARMONICS; n++) {
+        for (m = 1; m <= DETECT_HARMONICS; m++) {
+            if (fabs(freq2 - (freq1*n/m)) < peak_width*(1 + (double)n/m)) {
+                return 1;
             }
-            if (hits > 0) {
-                v /= hits;
-                if ((v < minimum) || (minimum == 0)) {
-                    minimum = v;
-                }
+        }
+    }
+    for (n = 1; n <= DETECT_DAY_ALIASES; n++) {
+        if (fabs(fabs(freq2 - freq1) - (n/DETECT_SIDEREAL_DAY)) <
+            peak_width*2) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Groups candidates which are aliases of a stronger candidate
+ *        with that candidate, leaving only distinct candidates
+ * @param list Candidates in descending order of score
+ * @param length The number of candidates
+ * @param peak_width Width of a peak in cycles per day
+ * @returns The number of distinct candidates
+ */
+static int detect_group_aliases(transit_candidate list[], int length,
+                                double peak_width)
+{
+    int i, j, distinct = 0;
+
+    for (i = 0; i < length; i++) {
+        for (j = 0; j < distinct; j++) {
+            if (detect_is_alias(1.0 / list[j].period_days,
+                                1.0 / list[i].period_days, peak_width)) {
+                list[j].aliases++;
+                break;
             }
         }
+        if (j == distinct) {
+            list[distinct] = list[i];
+            list[distinct++].aliases = 0;
+        }
+    }
+    return distinct;
+}
+
+/**
+ * @brief Returns the best distinct candidates from a list, filling in
+ *        the details of each transit. The depth, duration and epoch
+ *        come from the best box shaped transit at the period, while
+ *        the score remains that of the method.
+ * @param fold Precalculated values for the series being searched
+ * @param list Candidates in descending order of score
+ * @param length The number of candidates
+ * @param method DETECT_METHOD_HEURISTIC or DETECT_METHOD_BLS
+ * @param results Returned best distinct candidates
+ * @param max_results The maximum number of results
+ * @returns The number of results
+ */
+static int detect_results(fold_context * fold,
+                          transit_candidate list[], int length, int method,
+                          transit_candidate results[], int max_results)
+{
+    double peak_width = 1.0 / fold->baseline_days;
+    int i;
+    float * workspace =
+        (float*)malloc(fold_bin_workspace(fold, DETECT_CURVE_LENGTH) *
+                       sizeof(float));
+
+    if (workspace == NULL) {
+        printf("Unable to allocate memory for the candidates\n");
+        return 0;
+    }
+    length = detect_group_aliases(list, length, peak_width);
+    if (length > max_results) length = max_results;
+    for (i = 0; i < length; i++) {
+        results[i] = list[i];
+        bls_period_response(fold, list[i].period_days,
+                            DETECT_CURVE_LENGTH, &results[i], workspace);
+        results[i].aliases = list[i].aliases;
+        if (method != DETECT_METHOD_BLS) results[i].score = list[i].score;
+    }
+    free(workspace);
+    return length;
+}
+
+/**
+ * @brief Scores a grid of trial periods in parallel. Each thread keeps
+ *        its own list of the best peaks, so that scores for the whole
+ *        grid are never stored. The lists are merged highest peak
+ *        first once all threads have finished, so that the result
+ *        doesn't depend upon the order in which the threads finish.
+ *        Threads take tiles of neighbouring periods, which are folded
+ *        together so that the samples stay in cache across the tile.
+ *        Any companion of the series is folded in the same pass and
+ *        has its own list of peaks.
+ * @param fold Precalculated values for the series being searched
+ * @param periods Grid of orbital periods to be tried
+ * @param no_of_periods The number of orbital periods within the grid
+ * @param curve_length The number of buckets within the light curve
+ * @param method DETECT_METHOD_HEURISTIC or DETECT_METHOD_BLS
+ * @param list Returned best peaks in descending order of score, with
+ *        room for max_length peaks of the series followed by max_length
+ *        peaks of any companion
+ * @param length Returned number of peaks of the series and of any
+ *        companion
+ * @param max_length The maximum number of peaks
+ * @returns zero on success, or negative if out of memory
+ */
+static int detect_best_peaks(fold_context * fold,
+                             float periods[], int no_of_periods,
+                             int curve_length, int method,
+                             transit_candidate list[], int length[],
+                             int max_length)
+{
+    double peak_width = 1.0 / fold->baseline_days;
+    int tile_periods = fold->tile_periods;
+    int columns = (fold->companion != NULL) ? 2 : 1;
+    int threads = 1, c, i, no_of_tiles, failed = 0;
+    int pool_length[FOLD_MAX_COLUMNS] = {0};
+    transit_candidate * pool;
+
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    /* the best peaks of every thread, which are merged once all
+       threads have finished so that the result doesn't depend upon
+       the order in which they finish */
+    pool = (transit_candidate*)malloc(columns*threads*max_length *
+                                      sizeof(transit_candidate));
+    if (pool == NULL) return -1;
+
+    if (tile_periods < 1) tile_periods = 1;
+    if (tile_periods > FOLD_MAX_TILE_PERIODS) {
+        tile_periods = FOLD_MAX_TILE_PERIODS;
+    }
+    fold->tile_periods = tile_periods;
+    no_of_tiles = (no_of_periods + tile_periods - 1) / tile_periods;
+    for (c = 0; c < columns; c++) length[c] = 0;
+
+#pragma omp parallel
+    {
+        transit_candidate candidate;
+        transit_candidate * local =
+            (transit_candidate*)malloc(columns*max_length *
+                                       sizeof(transit_candidate));
+        fold_moments * moments =
+            (fold_moments*)malloc(columns*tile_periods*sizeof(fold_moments));
+        float * workspace =
+            (float*)malloc(fold_bin_workspace(fold, curve_length) *
+                           sizeof(float));
+        fold_context * series;
+        long outcomes[DETECT_OUTCOMES];
+        int i, k, t, first, tile_length, outcome;
+        int local_length[FOLD_MAX_COLUMNS] = {0};
+        int allocated =
+            (local != NULL) && (moments != NULL) && (workspace != NULL);
+
+        memset(&candidate, 0, sizeof(transit_candidate));
+        memset(outcomes, 0, sizeof(outcomes));
+#pragma omp for schedule(static)
+        for (t = 0; t < no_of_tiles; t++) {
+            if (!allocated) continue;
+            first = t*tile_periods;
+            tile_length = no_of_periods - first;
+            if (tile_length > tile_periods) tile_length = tile_periods;
 
-        /* How much difference from the mean? */
-        int dipped = 0;
-        float threshold_dipped = minimum + ((mean-minimum)*0.2);
-        for (int j = 0; j < DETECT_CURVE_LENGTH; j++) {
-            if (curve[j] < threshold_dipped) {
-                dipped++;
-                if (dipped > max_dipped) {
-                    break;
+            fold_bin_tile(fold, &periods[first], tile_length, curve_length,
+                          moments, workspace);
+            for (k = 0; k < columns; k++) {
+                series = (k == 0) ? fold : fold->companion;
+                for (i = 0; i < tile_length; i++) {
+                    candidate.period_days = periods[first + i];
+                    candidate.score =
+                        detect_moments_response(series,
+                                                &moments[k*tile_length + i],
+                                                periods[first + i],
+                                                curve_length, method,
+                                                &outcome);
+                    /* periods are counted once, by their outcome for
+                       the first series */
+                    if (k == 0) outcomes[outcome]++;
+                    detect_insert_candidate(&local[k*max_length],
+                                            &local_length[k], max_length,
+                                            peak_width, &candidate);
                 }
             }
         }
-        /* we only expect a small percentage
-           of the curve to be dipped */
-        if (dipped > max_dipped) {
-            dipped = 0;
+
+#pragma omp critical
+        {
+            if (!allocated) failed = 1;
+            detect_count(fold, outcomes);
+            for (k = 0; k < columns; k++) {
+                memcpy(&pool[k*threads*max_length + pool_length[k]],
+                       &local[k*max_length],
+                       local_length[k]*sizeof(transit_candidate));
+                pool_length[k] += local_length[k];
+            }
         }
-        if (dipped == 0) {
-            response[step] = 0;
-            continue;
+        free(local);
+        free(moments);
+        free(workspace);
+    }
+
+    /* inserting the highest first gives the same peaks whatever the
+       order in which they were pooled */
+    for (c = 0; c < columns; c++) {
+        qsort(&pool[c*threads*max_length], pool_length[c],
+              sizeof(transit_candidate), detect_compare_candidates);
+        for (i = 0; i < pool_length[c]; i++) {
+            detect_insert_candidate(&list[c*max_length], &length[c],
+                                    max_length, peak_width,
+                                    &pool[c*threads*max_length + i]);
         }
+    }
+    free(pool);
+    if (failed != 0) return -1;
+    return 0;
+}
 
-        /* How much difference from the mean? */
-        int nondipped = 0;
-        float threshold_upper = mean - ((mean-minimum)*0.2);
-        for (int j = 0; j < DETECT_CURVE_LENGTH; j++) {
-            if ((curve[j] < threshold_upper) &&
-                (curve[j] > threshold_dipped)) {
-                nondipped++;
-                if (nondipped > max_nondipped) {
-                    break;
-                }
+/**
+ * @brief Scores a grid of trial periods in chunks, saving the best
+ *        peaks after a chunk whenever the checkpoint interval has
+ *        passed. If a checkpoint of the same search exists then the
+ *        search carries on from it. The chunks are the same whether
+ *        or not the search was interrupted, so a resumed search gives
+ *        the same peaks as an uninterrupted one.
+ * @param fold Precalculated values for the series being searched,
+ *        with the checkpoint
+ * @param periods Grid of orbital periods to be tried
+ * @param no_of_periods The number of orbital periods within the grid
+ * @param curve_length The number of buckets within the light curve
+ * @param method DETECT_METHOD_HEURISTIC or DETECT_METHOD_BLS
+ * @param list Returned best peaks in descending order of score, for
+ *        the series and any companion as with detect_best_peaks
+ * @param length Returned number of peaks of the series and of any
+ *        companion
+ * @param max_length The maximum number of peaks
+ * @returns zero on success, or negative if out of memory
+ */
+static int detect_best_peaks_checkpointed(fold_context * fold,
+                                          float periods[],
+                                          int no_of_periods,
+                                          int curve_length, int method,
+                                          transit_candidate list[],
+                                          int length[], int max_length)
+{
+    search_checkpoint * checkpoint = fold->checkpoint;
+    detect_statistics * statistics = fold->statistics;
+    double peak_width = 1.0 / fold->baseline_days;
+    long before[DETECT_OUTCOMES], outcomes[DETECT_OUTCOMES];
+    time_t saved = time(NULL);
+    int columns = (fold->companion != NULL) ? 2 : 1;
+    int chunk_length[FOLD_MAX_COLUMNS];
+    int i, c, first, chunk;
+    transit_candidate * chunk_list =
+        (transit_candidate*)malloc(columns*max_length *
+                                   sizeof(transit_candidate));
+
+    if (chunk_list == NULL) return -1;
+
+    checkpoint->key = checkpoint_key(fold, periods, no_of_periods,
+                                     curve_length, method, max_length);
+    first = checkpoint_load(checkpoint, no_of_periods, columns,
+                            list, length, max_length, outcomes);
+
+    /* counts of the periods searched before the checkpoint */
+    for (i = 0; i < DETECT_OUTCOMES; i++) {
+        before[i] = 0;
+        if (statistics == NULL) continue;
+        statistics->periods[i] += outcomes[i];
+        before[i] = statistics->periods[i] - outcomes[i];
+    }
+
+    for (; first < no_of_periods; first += chunk) {
+        chunk = no_of_periods - first;
+        if (chunk > CHECKPOINT_PERIODS) chunk = CHECKPOINT_PERIODS;
+        if (detect_best_peaks(fold, &periods[first], chunk,
+                              curve_length, method,
+                              chunk_list, chunk_length, max_length) != 0) {
+            free(chunk_list);
+            return -1;
+        }
+        for (c = 0; c < columns; c++) {
+            for (i = 0; i < chunk_length[c]; i++) {
+                detect_insert_candidate(&list[c*max_length], &length[c],
+                                        max_length, peak_width,
+                                        &chunk_list[c*max_length + i]);
             }
         }
-        if (nondipped > max_nondipped) {
-            response[step] = 0;
+
+        if ((first + chunk == no_of_periods) ||
+            (difftime(time(NULL), saved) < checkpoint->interval_seconds)) {
             continue;
         }
+        for (i = 0; i < DETECT_OUTCOMES; i++) {
+            outcomes[i] = (statistics != NULL) ?
+                statistics->periods[i] - before[i] : 0;
+        }
+        if (checkpoint_save(checkpoint, no_of_periods, first + chunk,
+                            columns, list, length, max_length,
+                            outcomes) != 0) {
+            printf("Unable to save the checkpoint %s\n",
+                   checkpoint->filename);
+        }
+        saved = time(NULL);
+    }
+    checkpoint_remove(checkpoint);
+    free(chunk_list);
+    return 0;
+}
 
-        variance = 0;
-        hits = 0;
-        for (int j = 0; j < DETECT_CURVE_LENGTH; j++) {
-            if (curve[j] > 0) {
-                variance += (curve[j] - mean)*(curve[j] - mean);
-                hits++;
+/**
+ * @brief Clips the samples of a series and of any companion for the
+ *        method which scores the trial periods, if they aren't already
+ * @param fold Precalculated values for the series being searched
+ * @param method DETECT_METHOD_HEURISTIC or DETECT_METHOD_BLS
+ */
+static void detect_clip(fold_context * fold, int method)
+{
+    if (fold->clip_method != method) fold_context_clip(fold, method);
+    if ((fold->companion != NULL) &&
+        (fold->companion->clip_method != method)) {
+        fold_context_clip(fold->companion, method);
+    }
+}
+
+/**
+ * @brief Attempts to detect the orbital period via the transit method.
+ *        This tries many possible periods and looks for a dip in
+ *        magnitude.
+ * @param fold Precalculated values for the series being searched.
+ *        If it has a checkpoint then the search is saved from time
+ *        to time and resumed from any earlier save. If it has a
+ *        companion then the companion is searched in the same pass,
+ *        and its results are returned within the companion.
+ * @param periods Grid of orbital periods to be tried
+ * @param no_of_periods The number of orbital periods within the grid
+ * @param method DETECT_METHOD_HEURISTIC or DETECT_METHOD_BLS
+ * @param results Returned best distinct candidates, in descending
+ *        order of score
+ * @param max_results The maximum number of results
+ * @returns The number of results, which is zero if no transit was found
+ */
+int detect_orbital_period(fold_context * fold,
+                          float periods[], int no_of_periods, int method,
+                          transit_candidate results[], int max_results)
+{
+    int status, length[FOLD_MAX_COLUMNS] = {0};
+    int max_length = max_results*DETECT_CANDIDATE_POOL;
+    int columns = (fold->companion != NULL) ? 2 : 1;
+    transit_candidate * list =
+        (transit_candidate*)malloc(columns*max_length *
+                                   sizeof(transit_candidate));
+
+    if (list == NULL) {
+        printf("Unable to allocate memory for the candidates\n");
+        return 0;
+    }
+
+    detect_clip(fold, method);
+    if (fold->checkpoint != NULL) {
+        status = detect_best_peaks_checkpointed(fold, periods,
+                                                no_of_periods,
+                                                DETECT_CURVE_LENGTH, method,
+                                                list, length, max_length);
+    }
+    else {
+        status = detect_best_peaks(fold, periods, no_of_periods,
+                                   DETECT_CURVE_LENGTH, method,
+                                   list, length, max_length);
+    }
+    if (status != 0) {
+        printf("Unable to allocate memory for the candidates\n");
+        length[0] = length[1] = 0;
+    }
+    if (columns > 1) {
+        fold->companion->no_of_results =
+            detect_results(fold->companion, &list[max_length], length[1],
+                           method, fold->companion->results, max_results);
+    }
+    length[0] = detect_results(fold, list, length[0], method,
+                               results, max_results);
+    free(list);
+    return length[0];
+}
+
+/**
+ * @brief Refines the survivors of the coarse pass of a search with
+ *        progressively finer grids around each of them, until the
+ *        resolution of the full adaptive grid is reached
+ * @param fold Precalculated values for the series being searched
+ * @param candidates Survivors, which are returned refined
+ * @param no_of_candidates The number of survivors
+ * @param stage Array of max_candidates used while refining
+ * @param max_candidates The number of peaks surviving each stage
+ * @param method DETECT_METHOD_HEURISTIC or DETECT_METHOD_BLS
+ * @param mask Periodogram marking frequencies which are not to be
+ *        searched, or NULL to search them all
+ * @param min_freq The lowest frequency searched in cycles per day
+ * @param max_freq The highest frequency searched in cycles per day
+ * @param freq_increment Grid step of the coarse pass
+ * @param final_increment Grid step of the full adaptive grid
+ * @param evaluated Number of trial periods evaluated, which is updated
+ * @returns The number of refined survivors
+ */
+static int detect_refine(fold_context * fold,
+                         transit_candidate candidates[],
+                         int no_of_candidates,
+                         transit_candidate stage[], int max_candidates,
+                         int method, periodogram * mask,
+                         double min_freq, double max_freq,
+                         double freq_increment, double final_increment,
+                         int * evaluated)
+{
+    int i, j, steps, window, stage_candidates;
+    float * response;
+    transit_candidate candidate;
+    double freq, next_increment;
+
+    memset(&candidate, 0, sizeof(transit_candidate));
+    while ((no_of_candidates > 0) &&
+           (freq_increment > final_increment*1.0001)) {
+        next_increment = freq_increment / HIERARCHICAL_REFINE;
+        if (next_increment < final_increment) {
+            next_increment = final_increment;
+        }
+        window = (int)ceil(HIERARCHICAL_WINDOW *
+                           freq_increment / next_increment);
+        steps = window*2 + 1;
+
+        response = (float*)malloc(no_of_candidates*steps*sizeof(float));
+        if (response == NULL) break;
+
+#pragma omp parallel
+        {
+            long outcomes[DETECT_OUTCOMES];
+            int k, outcome;
+            double f;
+            float * workspace =
+                (float*)malloc(fold_bin_workspace(fold, DETECT_CURVE_LENGTH)*
+                               sizeof(float));
+
+            memset(outcomes, 0, sizeof(outcomes));
+#pragma omp for
+            for (k = 0; k < no_of_candidates*steps; k++) {
+                f = (1.0 / candidates[k/steps].period_days) +
+                    (((k % steps) - window)*next_increment);
+                response[k] = 0;
+                if (workspace == NULL) continue;
+                if ((f < min_freq) || (f > max_freq)) continue;
+                if (periodogram_masked(mask, f)) {
+                    outcomes[DETECT_MASKED]++;
+                    continue;
+                }
+                response[k] =
+                    detect_response(fold, (float)(1.0 / f),
+                                    DETECT_CURVE_LENGTH, method, &outcome,
+                                    workspace);
+                outcomes[outcome]++;
             }
+
+#pragma omp critical
+            detect_count(fold, outcomes);
+            free(workspace);
         }
-        response[step] = 0;
-        if (hits > 0) {
-            response[step] =
-                (mean-minimum) /
-                (float)sqrt(variance/hits);
-            response[step] =
-                (mean-minimum)*dipped*100/(mean*(1+nondipped));
-            response[step] /= (density_variance*variance);
+        *evaluated += no_of_candidates*steps;
+
+        /* each survivor moves to the best response within its window */
+        stage_candidates = 0;
+        for (j = 0; j < no_of_candidates; j++) {
+            candidate.score = 0;
+            for (i = 0; i < steps; i++) {
+                if (response[j*steps + i] > candidate.score) {
+                    freq = (1.0 / candidates[j].period_days) +
+                        ((i - window)*next_increment);
+                    candidate.score = response[j*steps + i];
+                    candidate.period_days = (float)(1.0 / freq);
+                }
+            }
+            detect_insert_candidate(stage, &stage_candidates,
+                                    max_candidates,
+                                    1.0 / fold->baseline_days, &candidate);
         }
+        free(response);
+
+        no_of_candidates = stage_candidates;
+        memcpy(candidates, stage,
+               no_of_candidates*sizeof(transit_candidate));
+        freq_increment = next_increment;
     }
+    return no_of_candidates;
+}
+
+/**
+ * @brief Coarse to fine search for the orbital period.
+ *        A coarse pass over the whole range uses a light curve with
+ *        fewer buckets, which allows a proportionally sparser grid.
+ *        The highest response peaks survive, and progressively finer
+ *        grids are then searched around each survivor until the
+ *        resolution of the full adaptive grid is reached.
+ *        Any companion of the series shares the coarse pass, and its
+ *        own survivors are then refined.
+ * @param fold Precalculated values for the series being searched
+ * @param min_period_days The minimum orbital period in days
+ * @param max_period_days The maximum orbital period in days
+ * @param oversample Number of grid steps per bucket of phase drift
+ * @param max_candidates The number of peaks surviving each stage
+ * @param method DETECT_METHOD_HEURISTIC or DETECT_METHOD_BLS
+ * @param mask Periodogram marking frequencies which are not to be
+ *        searched, or NULL to search them all
+ * @param results Returned best distinct candidates, in descending
+ *        order of score. Those of any companion are returned within
+ *        the companion.
+ * @param max_results The maximum number of results
+ * @param evaluated Returned number of trial periods evaluated for the
+ *        series
+ * @returns The number of results, which is zero if no transit was found
+ */
+int detect_orbital_period_hierarchical(fold_context * fold,
+                                       float min_period_days,
+                                       float max_period_days,
+                                       float oversample,
+                                       int max_candidates,
+                                       int method,
+                                       periodogram * mask,
+                                       transit_candidate results[],
+                                       int max_results,
+                                       int * evaluated)
+{
+    int i, no_of_periods, companion_evaluated = 0;
+    int no_of_candidates[FOLD_MAX_COLUMNS] = {0};
+    int columns = (fold->companion != NULL) ? 2 : 1;
+    float * periods = NULL;
+    transit_candidate * candidates, * stage;
+    double freq_increment, final_increment;
+    double min_freq = 1.0 / max_period_days;
+    double max_freq = 1.0 / min_period_days;
 
-    for (int i = 0; i < steps; i++) {
-        if (response[i] > max_response) {
-            max_response = response[i];
-            period_days = min_period_days + (i*increment_days);
+    *evaluated = 0;
+    if (max_candidates < max_results) max_candidates = max_results;
+    detect_clip(fold, method);
+
+    no_of_periods = period_grid_adaptive(fold,
+                                         min_period_days, max_period_days,
+                                         HIERARCHICAL_CURVE_LENGTH,
+                                         oversample, &periods);
+    if (no_of_periods <= 0) return 0;
+    if (mask != NULL) {
+        i = no_of_periods;
+        no_of_periods = periodogram_mask_periods(mask, periods,
+                                                 no_of_periods);
+        if (fold->statistics != NULL) {
+            fold->statistics->periods[DETECT_MASKED] += i - no_of_periods;
         }
     }
-    return period_days;
+
+    candidates =
+        (transit_candidate*)malloc(columns*max_candidates *
+                                   sizeof(transit_candidate));
+    stage =
+        (transit_candidate*)malloc(max_candidates*sizeof(transit_candidate));
+    if ((candidates == NULL) || (stage == NULL)) {
+        no_of_periods = 0;
+    }
+
+    /* coarse pass over the whole range, where the highest
+       peaks survive */
+    if ((no_of_periods > 0) &&
+        (detect_best_peaks(fold, periods, no_of_periods,
+                           HIERARCHICAL_CURVE_LENGTH, method,
+                           candidates, no_of_candidates,
+                           max_candidates) != 0)) {
+        no_of_candidates[0] = no_of_candidates[1] = 0;
+    }
+    *evaluated += no_of_periods;
+    free(periods);
+
+    freq_increment =
+        period_grid_frequency_increment(fold, HIERARCHICAL_CURVE_LENGTH,
+                                        oversample);
+    final_increment =
+        period_grid_frequency_increment(fold, DETECT_CURVE_LENGTH,
+                                        oversample);
+
+    /* refine around each survivor */
+    no_of_candidates[0] =
+        detect_refine(fold, candidates, no_of_candidates[0], stage,
+                      max_candidates, method, mask, min_freq, max_freq,
+                      freq_increment, final_increment, evaluated);
+    if (columns > 1) {
+        no_of_candidates[1] =
+            detect_refine(fold->companion, &candidates[max_candidates],
+                          no_of_candidates[1], stage, max_candidates,
+                          method, mask, min_freq, max_freq,
+                          freq_increment, final_increment,
+                          &companion_evaluated);
+        fold->companion->no_of_results =
+            detect_results(fold->companion, &candidates[max_candidates],
+                           no_of_candidates[1], method,
+                           fold->companion->results, max_results);
+    }
+
+    no_of_candidates[0] = detect_results(fold, candidates,
+                                         no_of_candidates[0],
+                                         method, results, max_results);
+    free(candidates);
+    free(stage);
+    return no_of_candidates[0];
 }
@@ -0,0 +1,551 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <ctype.h>
+#include <limits.h>
+#include "waspscan.h"
+
+/* fits files consist of blocks of this size */
+#define FITS_BLOCK_SIZE  2880
+
+/* length of each header card */
+#define FITS_CARD_LENGTH 80
+
+/* maximum number of columns within a binary table */
+#define FITS_MAX_FIELDS  999
+
+/* values extracted from the header of a HDU */
+typedef struct {
+    char xtension[FITS_CARD_LENGTH+1];
+    char extname[FITS_CARD_LENGTH+1];
+    int bitpix;
+    int naxis;
+    long naxes[9];
+    long pcount;
+    long gcount;
+    int tfields;
+} fits_header;
+
+/**
+ * @brief Returns the value of a header card as a string, with
+ *        any quotes and padding removed
+ * @param card The header card
+ * @param value Returned value
+ */
+static void fits_card_value(char * card, char * value)
+{
+    int i = 10, ctr = 0;
+
+    /* values begin after "KEYWORD = " */
+    while ((i < FITS_CARD_LENGTH) && (card[i] == ' ')) i++;
+
+    if ((i < FITS_CARD_LENGTH) && (card[i] == '\'')) {
+        i++;
+        while ((i < FITS_CARD_LENGTH) && (card[i] != '\'')) {
+            value[ctr++] = card[i++];
+        }
+    }
+    else {
+        while ((i < FITS_CARD_LENGTH) &&
+               (card[i] != ' ') && (card[i] != '/')) {
+            value[ctr++] = card[i++];
+        }
+    }
+
+    /* remove trailing spaces */
+    while ((ctr > 0) && (value[ctr-1] == ' ')) ctr--;
+    value[ctr] = 0;
+}
+
+/**
+ * @brief Returns non-zero if a header card has the given keyword
+ * @param card The header card
+ * @param keyword The keyword
+ * @returns non-zero if the keyword matches
+ */
+static int fits_card_keyword(char * card, char * keyword)
+{
+    int len = strlen(keyword);
+
+    if (strncmp(card, keyword, len) != 0) return 0;
+    return ((card[len] == ' ') || (card[len] == '='));
+}
+
+/**
+ * @brief Returns non-zero if two strings are the same, ignoring case
+ * @param a First string
+ * @param b Second string
+ * @returns non-zero if the strings match
+ */
+static int fits_equal(char * a, char * b)
+{
+    while ((*a != 0) && (*b != 0)) {
+        if (toupper((unsigned char)*a) != toupper((unsigned char)*b)) {
+            return 0;
+        }
+        a++;
+        b++;
+    }
+    return (*a == *b);
+}
+
+/**
+ * @brief Reads the header of a HDU. For a binary table the column
+ *        names and formats are also returned.
+ * @param fp File pointer positioned at the start of the header
+ * @param header Returned header values
+ * @param ttype Returned column names, or NULL
+ * @param tform Returned column formats, or NULL
+ * @param tscal Returned column scaling factors, or NULL
+ * @param tzero Returned column offsets, or NULL
+ * @returns zero on success
+ */
+static int fits_read_header(FILE * fp, fits_header * header,
+                            char ttype[][FITS_CARD_LENGTH+1],
+                            char tform[][FITS_CARD_LENGTH+1],
+                            double tscal[], double tzero[])
+{
+    char block[FITS_BLOCK_SIZE];
+    char value[FITS_CARD_LENGTH+1];
+    char * card;
+    int i, n, end = 0;
+
+    memset(header, 0, sizeof(fits_header));
+    header->gcount = 1;
+    for (i = 0; i < FITS_MAX_FIELDS; i++) {
+        if (ttype != NULL) ttype[i][0] = 0;
+        if (tform != NULL) tform[i][0] = 0;
+        if (tscal != NULL) tscal[i] = 1;
+        if (tzero != NULL) tzero[i] = 0;
+    }
+
+    while (end == 0) {
+        if (fread(block, FITS_BLOCK_SIZE, 1, fp) != 1) return -1;
+
+        for (i = 0; i < FITS_BLOCK_SIZE; i += FITS_CARD_LENGTH) {
+            card = &block[i];
+            if (fits_card_keyword(card, "END")) {
+                end = 1;
+                break;
+            }
+            if (card[8] != '=') continue;
+            fits_card_value(card, value);
+
+            if (fits_card_keyword(card, "XTENSION")) {
+                strcpy(header->xtension, value);
+            }
+            else if (fits_card_keyword(card, "EXTNAME")) {
+                strcpy(header->extname, value);
+            }
+            else if (fits_card_keyword(card, "BITPIX")) {
+                header->bitpix = atoi(value);
+            }
+            else if (fits_card_keyword(card, "NAXIS")) {
+                header->naxis = atoi(value);
+            }
+            else if ((strncmp(card, "NAXIS", 5) == 0) &&
+                     (isdigit((unsigned char)card[5]))) {
+                n = atoi(&card[5]);
+                if ((n >= 1) && (n <= 9)) {
+                    header->naxes[n-1] = atol(value);
+                }
+            }
+            else if (fits_card_keyword(card, "PCOUNT")) {
+                header->pcount = atol(value);
+            }
+            else if (fits_card_keyword(card, "GCOUNT")) {
+                header->gcount = atol(value);
+            }
+            else if (fits_card_keyword(card, "TFIELDS")) {
+                header->tfields = atoi(value);
+            }
+            else if ((strncmp(card, "TTYPE", 5) == 0) ||
+                     (strncmp(card, "TFORM", 5) == 0) ||
+                     (strncmp(card, "TSCAL", 5) == 0) ||
+                     (strncmp(card, "TZERO", 5) == 0)) {
+                n = atoi(&card[5]);
+                if ((n < 1) || (n > FITS_MAX_FIELDS)) continue;
+                if ((card[1] == 'T') && (ttype != NULL)) {
+                    strcpy(ttype[n-1], value);
+                }
+                if ((card[1] == 'F') && (tform != NULL)) {
+                    strcpy(tform[n-1], value);
+                }
+                if ((card[1] == 'S') && (tscal != NULL)) {
+                    tscal[n-1] = atof(value);
+                }
+                if ((card[1] == 'Z') && (tzero != NULL)) {
+                    tzero[n-1] = atof(value);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the size of the data following a header,
+ *        including padding to a whole number of blocks
+ * @param header Header values
+ * @returns Size of the data in bytes
+ */
+static long fits_data_size(fits_header * header)
+{
+    int i;
+    long size;
+
+    if (header->naxis == 0) return 0;
+
+    size = 1;
+    for (i = 0; i < header->naxis; i++) {
+        size *= header->naxes[i];
+    }
+    size = (labs(header->bitpix)/8) * header->gcount *
+        (header->pcount + size);
+    return ((size + FITS_BLOCK_SIZE - 1) / FITS_BLOCK_SIZE) *
+        FITS_BLOCK_SIZE;
+}
+
+/**
+ * @brief Returns the number of bytes used by a binary table
+ *        column format such as "1D" or "E"
+ * @param tform The column format
+ * @param type Returned data type character
+ * @returns Width of the column in bytes, or -1 if unsupported
+ */
+static int fits_column_width(char * tform, char * type)
+{
+    int repeat = 1;
+    int i = 0;
+
+    while (tform[i] == ' ') i++;
+    if (isdigit((unsigned char)tform[i])) {
+        repeat = atoi(&tform[i]);
+        while (isdigit((unsigned char)tform[i])) i++;
+    }
+    *type = tform[i];
+
+    switch(*type) {
+    case 'L': case 'X': case 'B': case 'A': return repeat;
+    case 'I': return repeat*2;
+    case 'J': case 'E': return repeat*4;
+    case 'K': case 'D': case 'C': return repeat*8;
+    case 'M': return repeat*16;
+    case 'P': return repeat*8;
+    case 'Q': return repeat*16;
+    }
+    return -1;
+}
+
+/**
+ * @brief Converts the first element of a column into doubles for
+ *        every row of a binary table. Big endian values are
+ *        gathered and byte swapped in bulk.
+ * @param data Table data
+ * @param rows Number of rows
+ * @param row_width Number of bytes within each row
+ * @param offset Byte offset of the column within each row
+ * @param type Data type of the column
+ * @param scale Column scaling factor
+ * @param zero Column offset
+ * @param result Returned values
+ * @returns zero on success
+ */
+static int fits_read_column(unsigned char * data, long rows,
+                            long row_width, long offset,
+                            char type, double scale, double zero,
+                            double result[])
+{
+    long i;
+    unsigned char * p = &data[offset];
+    uint16_t u16;
+    uint32_t u32;
+    uint64_t u64;
+    float f32;
+    double f64;
+
+    switch(type) {
+    case 'B': {
+        for (i = 0; i < rows; i++, p += row_width) {
+            result[i] = *p;
+        }
+        break;
+    }
+    case 'I': {
+        for (i = 0; i < rows; i++, p += row_width) {
+            memcpy(&u16, p, 2);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            u16 = __builtin_bswap16(u16);
+#endif
+            result[i] = (int16_t)u16;
+        }
+        break;
+    }
+    case 'J': {
+        for (i = 0; i < rows; i++, p += row_width) {
+            memcpy(&u32, p, 4);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            u32 = __builtin_bswap32(u32);
+#endif
+            result[i] = (int32_t)u32;
+        }
+        break;
+    }
+    case 'K': {
+        for (i = 0; i < rows; i++, p += row_width) {
+            memcpy(&u64, p, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            u64 = __builtin_bswap64(u64);
+#endif
+            result[i] = (double)(int64_t)u64;
+        }
+        break;
+    }
+    case 'E': {
+        for (i = 0; i < rows; i++, p += row_width) {
+            memcpy(&u32, p, 4);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            u32 = __builtin_bswap32(u32);
+#endif
+            memcpy(&f32, &u32, 4);
+            result[i] = f32;
+        }
+        break;
+    }
+    case 'D': {
+        for (i = 0; i < rows; i++, p += row_width) {
+            memcpy(&u64, p, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            u64 = __builtin_bswap64(u64);
+#endif
+            memcpy(&f64, &u64, 8);
+            result[i] = f64;
+        }
+        break;
+    }
+    default: {
+        return -1;
+    }
+    }
+
+    if ((scale != 1) || (zero != 0)) {
+        for (i = 0; i < rows; i++) {
+            result[i] = zero + (scale * result[i]);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns non-zero if the given file is in fits format
+ * @param filename The file to check
+ * @returns non-zero if the file begins with a fits primary header
+ */
+int fits_is_fits(char * filename)
+{
+    char magic[10];
+    FILE * fp = fopen(filename, "rb");
+    int retval = 0;
+
+    if (!fp) return 0;
+    if (fread(magic, 9, 1, fp) == 1) {
+        magic[9] = 0;
+        retval = (strncmp(magic, "SIMPLE  =", 9) == 0);
+    }
+    fclose(fp);
+    return retval;
+}
+
+/**
+ * @brief Loads the columns of a light curve from a binary table within
+ *        a fits file, dropping any flagged samples as
+ *        logfile_load_columns does for a table
+ * @param filename fits filename
+ * @param table_name Name of the table (EXTNAME), or NULL to select
+ *        the table by index
+ * @param table_index Index of the HDU, where zero is the primary HDU
+ * @param layout Names and indexes of the columns to be loaded, which
+ *        must include the time and the flux. Names which are present
+ *        within the table take priority over indexes.
+ * @param mem Arena from which the arrays are allocated
+ * @param result Returned columns
+ * @returns The number of data points loaded, or negative on error
+ */
+int fits_load(char * filename,
+              char * table_name, int table_index,
+              table_layout * layout, arena * mem, series_columns * result)
+{
+    FILE * fp;
+    fits_header header;
+    char (*ttype)[FITS_CARD_LENGTH+1];
+    char (*tform)[FITS_CARD_LENGTH+1];
+    double tscal[FITS_MAX_FIELDS], tzero[FITS_MAX_FIELDS];
+    int hdu, c, i, width, found = 0, series_length, failed = 0;
+    int field_index[TABLE_COLUMNS];
+    long field_offset[TABLE_COLUMNS], offset, rows, row;
+    char field_type[TABLE_COLUMNS], type;
+    unsigned char * data;
+    double * values, * timestamp;
+    float * columns[TABLE_COLUMNS];
+
+    memset(result, 0, sizeof(series_columns));
+    if ((layout->index[TABLE_COLUMN_TIME] < 0) ||
+        (layout->index[TABLE_COLUMN_FLUX] < 0)) {
+        return -2;
+    }
+
+    fp = fopen(filename, "rb");
+    if (!fp) return -1;
+
+    ttype = malloc(FITS_MAX_FIELDS * sizeof(*ttype));
+    tform = malloc(FITS_MAX_FIELDS * sizeof(*tform));
+    if ((ttype == NULL) || (tform == NULL)) {
+        free(ttype);
+        free(tform);
+        fclose(fp);
+        return -2;
+    }
+
+    /* find the table */
+    for (hdu = 0; found == 0; hdu++) {
+        if (fits_read_header(fp, &header, ttype, tform,
+                             tscal, tzero) != 0) {
+            break;
+        }
+        if (table_name != NULL) {
+            found = fits_equal(header.extname, table_name);
+        }
+        else {
+            found = (hdu == table_index);
+        }
+        if (found == 0) {
+            if (fseek(fp, fits_data_size(&header), SEEK_CUR) != 0) break;
+        }
+    }
+
+    if ((found == 0) || (strcmp(header.xtension, "BINTABLE") != 0) ||
+        (header.naxis != 2)) {
+        free(ttype);
+        free(tform);
+        fclose(fp);
+        return -3;
+    }
+
+    /* locate the columns */
+    for (c = 0; c < TABLE_COLUMNS; c++) {
+        field_index[c] = layout->index[c];
+        field_offset[c] = -1;
+        field_type[c] = 0;
+        if ((field_index[c] < 0) || (layout->name[c] == NULL)) continue;
+        for (i = 0; i < header.tfields; i++) {
+            if (fits_equal(ttype[i], layout->name[c])) field_index[c] = i;
+        }
+    }
+    offset = 0;
+    for (i = 0; i < header.tfields; i++) {
+        width = fits_column_width(tform[i], &type);
+        if (width < 0) break;
+        for (c = 0; c < TABLE_COLUMNS; c++) {
+            if (i != field_index[c]) continue;
+            field_offset[c] = offset;
+            field_type[c] = type;
+        }
+        offset += width;
+    }
+    free(ttype);
+    free(tform);
+    for (c = 0; c < TABLE_COLUMNS; c++) {
+        if ((field_index[c] >= 0) && (field_offset[c] < 0)) failed = 1;
+    }
+    if ((failed != 0) || (offset > header.naxes[0])) {
+        fclose(fp);
+        return -4;
+    }
+
+    /* read the whole table in one go */
+    rows = header.naxes[1];
+    if (rows > INT_MAX) rows = INT_MAX;
+    data = (unsigned char*)malloc(rows * header.naxes[0]);
+    values = (double*)malloc(rows * TABLE_COLUMNS * sizeof(double));
+    timestamp = (double*)arena_alloc(mem, rows * sizeof(double));
+    for (c = 0; c < TABLE_COLUMNS; c++) {
+        columns[c] = NULL;
+        if ((c == TABLE_COLUMN_TIME) || (c == TABLE_COLUMN_FLAG) ||
+            (field_index[c] < 0)) {
+            continue;
+        }
+        columns[c] = (float*)arena_alloc(mem, rows * sizeof(float));
+        if (columns[c] == NULL) failed = 1;
+    }
+    if ((data == NULL) || (values == NULL) ||
+        (timestamp == NULL) || (failed != 0) ||
+        ((rows > 0) &&
+         (fread(data, rows * header.naxes[0], 1, fp) != 1))) {
+        free(data);
+        free(values);
+        fclose(fp);
+        return -5;
+    }
+    fclose(fp);
+
+    for (c = 0; c < TABLE_COLUMNS; c++) {
+        if (field_index[c] < 0) continue;
+        if (fits_read_column(data, rows, header.naxes[0], field_offset[c],
+                             field_type[c], tscal[field_index[c]],
+                             tzero[field_index[c]], &values[c*rows]) != 0) {
+            free(data);
+            free(values);
+            return -6;
+        }
+    }
+
+    /* rows with null times or fluxes, or with any flag, are skipped */
+    series_length = 0;
+    for (row = 0; row < rows; row++) {
+        if (!isfinite(values[TABLE_COLUMN_TIME*rows + row]) ||
+            !isfinite(values[TABLE_COLUMN_FLUX*rows + row])) {
+            continue;
+        }
+        if ((field_index[TABLE_COLUMN_RAW_FLUX] >= 0) &&
+            !isfinite(values[TABLE_COLUMN_RAW_FLUX*rows + row])) {
+            continue;
+        }
+        if ((field_index[TABLE_COLUMN_FLAG] >= 0) &&
+            (values[TABLE_COLUMN_FLAG*rows + row] != 0)) {
+            continue;
+        }
+        timestamp[series_length] = values[TABLE_COLUMN_TIME*rows + row];
+        for (c = 0; c < TABLE_COLUMNS; c++) {
+            if (columns[c] == NULL) continue;
+            columns[c][series_length] = (float)values[c*rows + row];
+        }
+        series_length++;
+    }
+
+    free(data);
+    free(values);
+    result->length = series_length;
+    result->timestamp = timestamp;
+    result->series = columns[TABLE_COLUMN_FLUX];
+    result->error = columns[TABLE_COLUMN_ERROR];
+    result->raw_series = columns[TABLE_COLUMN_RAW_FLUX];
+    result->raw_error = columns[TABLE_COLUMN_RAW_ERROR];
+    return series_length;
+}
@@ -0,0 +1,383 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "waspscan.h"
+
+/* maximum percentage of the light curve which may be missing */
+#define MISSING_THRESHOLD   4
+
+/* greatest number of fixed point ticks per day, as a power of two */
+#define FOLD_MAX_TICK_SHIFT 24
+
+/**
+ * @brief Returns the time of the earliest sample, which is used as
+ *        the zero point of orbital phase
+ * @param timestamp Array of imaging times in seconds
+ * @param series_length The length of the data series
+ * @returns Earliest time in seconds
+ */
+double fold_time_origin(double timestamp[], int series_length)
+{
+    double origin = 0;
+
+    for (int i = 0; i < series_length; i++) {
+        if ((i == 0) || (timestamp[i] < origin)) {
+            origin = timestamp[i];
+        }
+    }
+    return origin;
+}
+
+/**
+ * @brief Clips the samples of a context which are outliers for a
+ *        detection method, so that they're excluded from the folded
+ *        light curve. Bounds are set from the median and the robust
+ *        standard deviation, which a few wild samples don't widen.
+ *        The heuristic excludes samples further than DETECT_CLIP_SIGMA
+ *        from the median. A box fitted by BLS needs every sample within
+ *        the transit, so only samples far above the median are
+ *        excluded. Weights and binned scatter given to
+ *        fold_context_weight are kept for the samples within bounds.
+ * @param fold The context
+ * @param method DETECT_METHOD_HEURISTIC or DETECT_METHOD_BLS
+ */
+void fold_context_clip(fold_context * fold, int method)
+{
+    /* the median absolute deviation is zero if most samples are equal */
+    float scatter = (fold->scatter > 0) ? fold->scatter : fold->variance;
+    float min_value = fold->median - DETECT_CLIP_SIGMA*scatter;
+    float max_value = fold->median + DETECT_CLIP_SIGMA*scatter;
+    int i, clip_below = 1;
+
+    if (method == DETECT_METHOD_BLS) {
+        clip_below = 0;
+        max_value = fold->median + BLS_CLIP_SIGMA*scatter;
+    }
+    fold->clip_method = method;
+    fold->squares = 0;
+    for (i = 0; i < fold->length; i++) {
+        fold->inlier[i] = 0;
+        if ((clip_below && (fold->series[i] < min_value)) ||
+            (fold->series[i] > max_value)) continue;
+        fold->inlier[i] = (fold->weight != NULL) ? fold->weight[i] : 1;
+        if (fold->bin_squares != NULL) fold->squares += fold->bin_squares[i];
+    }
+}
+
+/**
+ * @brief Calculates the values within a time series which don't
+ *        depend upon the orbital period, so that they only need
+ *        to be calculated once for a star rather than once for
+ *        every trial period.
+ *        Sample times are stored as 32 bit fixed point offsets from
+ *        the earliest sample, with as many ticks per day as will fit
+ *        the whole baseline, so that folding needs only an integer
+ *        multiply rather than a floating point modulus
+ * @param fold The context to be initialised
+ * @param timestamp Array of imaging times in seconds
+ * @param series Array containing magnitudes
+ * @param series_length The length of the data series
+ * @returns zero on success
+ */
+int fold_context_init(fold_context * fold,
+                      double timestamp[],
+                      float series[], int series_length)
+{
+    int i;
+    double days, max_days = 0, ticks_per_day;
+
+    fold->length = series_length;
+    fold->series = series;
+    fold->ticks_shared = 0;
+    fold->ticks = (uint32_t*)malloc(series_length*sizeof(uint32_t));
+    fold->inlier = (float*)malloc(series_length*sizeof(float));
+    if ((fold->ticks == NULL) || (fold->inlier == NULL)) {
+        fold_context_free(fold);
+        return -1;
+    }
+    fold->weight = NULL;
+    fold->bin_squares = NULL;
+    fold->mean = detect_mean(series, series_length);
+    fold->variance = detect_variance(series, series_length, fold->mean);
+    if (detect_scatter(series, series_length,
+                       &fold->median, &fold->scatter) != 0) {
+        fold_context_free(fold);
+        return -1;
+    }
+    fold_context_clip(fold, DETECT_METHOD_HEURISTIC);
+
+    fold->origin_days =
+        fold_time_origin(timestamp, series_length) / (60.0*60.0*24.0);
+    for (i = 0; i < series_length; i++) {
+        days = timestamp[i] / (60.0*60.0*24.0) - fold->origin_days;
+        if (days > max_days) max_days = days;
+    }
+    fold->baseline_days = max_days;
+
+    /* the finest resolution at which the baseline fits into 32 bits */
+    fold->tick_shift = FOLD_MAX_TICK_SHIFT;
+    while ((fold->tick_shift > 0) &&
+           (ldexp(max_days, fold->tick_shift) + 0.5 >= 4294967296.0)) {
+        fold->tick_shift--;
+    }
+    ticks_per_day = ldexp(1.0, fold->tick_shift);
+
+    for (i = 0; i < series_length; i++) {
+        days = timestamp[i] / (60.0*60.0*24.0) - fold->origin_days;
+        fold->ticks[i] = (uint32_t)(days * ticks_per_day + 0.5);
+    }
+
+    fold->squares = 0;
+    fold->tile_periods = FOLD_TILE_PERIODS;
+    fold->tile_samples = FOLD_TILE_SAMPLES;
+    fold->statistics = NULL;
+    fold->checkpoint = NULL;
+    fold->companion = NULL;
+    fold->results = NULL;
+    fold->no_of_results = 0;
+
+    /* choose the fold kernel before any parallel search begins */
+    fold_kernel_select(-1);
+    return 0;
+}
+
+/**
+ * @brief Creates the context of a second series with the same sample
+ *        times as another, such as the flux of a star before and after
+ *        correction. The ticks are shared, and the new context becomes
+ *        the companion of the other, so that a search folds both series
+ *        together and finds the phase of each sample only once.
+ * @param fold Context of the first series
+ * @param companion The context to be initialised, which should be freed
+ *        before the first
+ * @param series Array containing magnitudes, in the same order as those
+ *        of the first series
+ * @returns zero on success
+ */
+int fold_context_companion(fold_context * fold, fold_context * companion,
+                           float series[])
+{
+    *companion = *fold;
+    companion->ticks_shared = 1;
+    companion->series = series;
+    companion->weight = NULL;
+    companion->bin_squares = NULL;
+    companion->squares = 0;
+    companion->statistics = NULL;
+    companion->checkpoint = NULL;
+    companion->companion = NULL;
+    companion->results = NULL;
+    companion->no_of_results = 0;
+    companion->inlier = (float*)malloc(fold->length*sizeof(float));
+    if (companion->inlier == NULL) {
+        fold_context_free(companion);
+        return -1;
+    }
+    companion->mean = detect_mean(series, fold->length);
+    companion->variance =
+        detect_variance(series, fold->length, companion->mean);
+    if (detect_scatter(series, fold->length,
+                       &companion->median, &companion->scatter) != 0) {
+        fold_context_free(companion);
+        return -1;
+    }
+    fold_context_clip(companion, fold->clip_method);
+    fold->companion = companion;
+    return 0;
+}
+
+/**
+ * @brief Frees memory allocated by fold_context_init or
+ *        fold_context_companion
+ * @param fold The context to be freed
+ */
+void fold_context_free(fold_context * fold)
+{
+    if (fold->ticks_shared == 0) free(fold->ticks);
+    free(fold->inlier);
+    fold->ticks = NULL;
+    fold->inlier = NULL;
+    fold->companion = NULL;
+    fold->length = 0;
+}
+
+/**
+ * @brief Returns the inverse variance weight of each sample from its
+ *        error, for use with fold_context_weight or prebin_series.
+ *        The weights are scaled so that their mean is one, and so
+ *        still count samples. Samples without a usable error are
+ *        given the mean weight.
+ * @param error Array containing the error of each magnitude
+ * @param series_length The length of the data series
+ * @param weight Returned weight of each sample
+ */
+void fold_error_weights(float error[], int series_length, float weight[])
+{
+    double total = 0;
+    int i, valid = 0;
+
+    for (i = 0; i < series_length; i++) {
+        if ((error[i] > 0) && isfinite(error[i])) {
+            total += 1.0 / ((double)error[i]*error[i]);
+            valid++;
+        }
+    }
+    for (i = 0; i < series_length; i++) {
+        weight[i] = 1;
+        if ((valid > 0) && (error[i] > 0) && isfinite(error[i])) {
+            weight[i] =
+                (float)(valid / (total*(double)error[i]*error[i]));
+        }
+    }
+}
+
+/**
+ * @brief Weights each sample of a series, either by the inverse
+ *        variance of its error or, for a series whose samples were
+ *        averaged within bins, see prebin_series, so that every bin
+ *        counts as the samples within it. The mean and standard
+ *        deviation become weighted ones. For bins the median and
+ *        robust standard deviation are also found again, from the
+ *        weighted bins and the scatter within them, so that they
+ *        describe the original samples. The samples are then clipped
+ *        again, since the bin means scatter less than the samples and
+ *        would otherwise narrow the bounds and clip more of a transit.
+ * @param fold Context created from the samples or bins
+ * @param weight Weight of each sample, or the total weight of the
+ *        samples within each bin, which should stay allocated while
+ *        the context is used
+ * @param squares Weighted sum of squared deviations of the samples
+ *        within each bin from their mean, or NULL if not binned
+ */
+void fold_context_weight(fold_context * fold, float weight[],
+                         float squares[])
+{
+    double total_weight = 0, sum = 0, variance = 0, within = 0;
+    float * series = fold->series, median, scatter;
+    int i;
+
+    for (i = 0; i < fold->length; i++) {
+        total_weight += weight[i];
+        sum += weight[i]*series[i];
+    }
+    if (total_weight <= 0) return;
+    fold->mean = (float)(sum / total_weight);
+    for (i = 0; i < fold->length; i++) {
+        variance += weight[i]*(series[i] - fold->mean)*
+            (series[i] - fold->mean);
+        if (squares != NULL) variance += squares[i];
+    }
+    fold->variance = (float)sqrt(variance / total_weight);
+
+    if ((squares != NULL) &&
+        (detect_weighted_scatter(series, weight, fold->length,
+                                 &median, &scatter) == 0)) {
+        for (i = 0; i < fold->length; i++) {
+            within += squares[i];
+        }
+        fold->median = median;
+        fold->scatter =
+            (float)sqrt((double)scatter*scatter + within / total_weight);
+    }
+
+    fold->weight = weight;
+    fold->bin_squares = squares;
+    fold_context_clip(fold, fold->clip_method);
+}
+
+/**
+ * @brief Returns an array containing a light curve from the moments of
+ *        samples folded at some orbital period.
+ *        The moments give both the density of all samples within each
+ *        bucket and the mean of the samples which were within bounds
+ *        when the context was created.
+ *        Excluding outliers from the curve avoids distraction.
+ * @param moments Moments of each bucket, from fold_bin or fold_bin_tile
+ * @param curve Returned light curve Array
+ * @param density Density of samples
+ * @param curve_length The number of buckets within the curve
+ * @return zero on success
+ */
+int fold_moments_curve(fold_moments * moments,
+                       float curve[], float density[], int curve_length)
+{
+    float max_samples = 0;
+    int i;
+
+    for (i = 0; i < curve_length; i++) {
+        if (moments->count[i] > max_samples) {
+            max_samples = moments->count[i];
+        }
+    }
+    /* normalise */
+    for (i = 0; i < curve_length; i++) {
+        density[i] = moments->count[i] / max_samples;
+    }
+
+    if (missing_data(density, curve_length)*100/curve_length >
+        MISSING_THRESHOLD)
+        return -1;
+
+    for (i = 0; i < curve_length; i++) {
+        curve[i] = moments->sum[i];
+        if (curve[i] > 0) {
+            curve[i] /= moments->inliers[i];
+        }
+    }
+
+    /* fill any holes */
+    for (i = 0; i < curve_length; i++) {
+        if (curve[i] == 0) {
+            if (i > 0) {
+                curve[i] = curve[i-1];
+            }
+            else {
+                curve[i] = curve[curve_length-1];
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns an array containing a light curve for the given
+ *        orbital period, using precalculated series values.
+ *        The samples are folded once, see fold_moments_curve.
+ * @param fold Precalculated values for the series
+ * @param period_days The expected orbital period
+ * @param curve Returned light curve Array
+ * @param density Density of samples
+ * @param curve_length The number of buckets within the curve
+ * @return zero on success
+ */
+int fold_light_curve(fold_context * fold,
+                     float period_days,
+                     float curve[], float density[], int curve_length)
+{
+    fold_moments moments;
+    float * workspace =
+        (float*)malloc(fold_bin_workspace(fold, curve_length) *
+                       sizeof(float));
+
+    if (workspace == NULL) return -2;
+    fold_bin(fold, period_days, curve_length, &moments, workspace);
+    free(workspace);
+    return fold_moments_curve(&moments, curve, density, curve_length);
+
+}
@@ -0,0 +1,608 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Kernels which fold samples by orbital phase and accumulate the
+   moments of each light curve bucket in a single pass.
+   Phase is fixed point: sample times are 32 bit ticks and the
+   reciprocal of the period is a 64 bit multiplier scaled such that
+   the upper half of the lower 64 bits of their product is the
+   fraction of an orbit, so the whole number of orbits simply
+   overflows away. Every kernel calculates the bucket index with the
+   same integer operations, so the counts within each bucket are
+   identical and the sums differ only in the order of the additions.
+   A companion series with the same sample times is folded in the same
+   pass, with its moments next to those of the first series within each
+   bucket, so that the phase of each sample is only calculated once. */
+
+#include "waspscan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FOLD_X86
+#include <immintrin.h>
+#endif
+
+/* moments accumulated for each bucket: number of samples, number of
+   unclipped samples, sum of unclipped magnitudes and sum of squared
+   unclipped deviations from the mean */
+#define FOLD_MOMENTS    4
+
+/* maximum number of private histograms used by a kernel */
+#define FOLD_MAX_LANES  16
+
+static const char * fold_kernel_names[] = {
+    "scalar", "sse4.2", "avx2", "avx512"
+};
+
+static fold_accumulate_function fold_accumulate_selected = NULL;
+
+/* number of private histograms used by the selected kernel */
+static int fold_lanes_selected = 1;
+
+/**
+ * @brief Returns the fixed point multiplier which converts sample
+ *        ticks into phase for an orbital period
+ * @param fold Precalculated values for the series
+ * @param period_days Orbital period in days
+ * @returns 2^64 divided by the period in ticks
+ */
+static uint64_t fold_bin_multiplier(fold_context * fold, double period_days)
+{
+    double multiplier = ldexp(1.0, 64 - fold->tick_shift) / period_days;
+
+    /* periods shorter than one tick can't be folded */
+    if (multiplier >= 18446744073709551615.0) return UINT64_MAX;
+    return (uint64_t)(multiplier + 0.5);
+}
+
+/**
+ * @brief Returns the light curve bucket for a sample
+ * @param ticks Time of the sample since the origin in ticks
+ * @param multiplier Fixed point reciprocal of the period in ticks
+ * @param curve_length The number of buckets within the curve
+ * @returns Bucket index
+ */
+static inline int fold_bin_index(uint32_t ticks, uint64_t multiplier,
+                                 int curve_length)
+{
+    uint32_t phase = (uint32_t)(((uint64_t)ticks * multiplier) >> 32);
+
+    return (int)(((uint64_t)phase * (uint32_t)curve_length) >> 32);
+}
+
+/**
+ * @brief Adds a sample to the moments of a bucket
+ * @param bucket Moments of the bucket
+ * @param value Magnitude of the sample
+ * @param inlier Weight of the sample, which is 1 unless it was clipped
+ *        or averaged from several samples
+ * @param mean Mean magnitude of the series
+ */
+static inline void fold_bin_add(float bucket[], float value, float inlier,
+                                float mean)
+{
+    float deviation = value - mean;
+
+    bucket[0] += 1;
+    bucket[1] += inlier;
+    bucket[2] += value * inlier;
+    bucket[3] += deviation * deviation * inlier;
+}
+
+/**
+ * @brief Adds the private histograms of each lane together
+ * @param lanes Moments for each lane and bucket
+ * @param no_of_lanes Number of lanes
+ * @param curve_length The number of buckets within the curve
+ * @param columns Number of series whose moments are within each bucket
+ * @param column Index of the series whose moments are returned
+ * @param moments Returned moments of each bucket
+ */
+static void fold_bin_merge(float lanes[], int no_of_lanes,
+                           int curve_length, int columns, int column,
+                           fold_moments * moments)
+{
+    int i, lane, stride = columns*FOLD_MOMENTS;
+    float * bucket;
+
+    lanes += column*FOLD_MOMENTS;
+    for (i = 0; i < curve_length; i++) {
+        bucket = &lanes[i*stride];
+        moments->count[i] = bucket[0];
+        moments->inliers[i] = bucket[1];
+        moments->sum[i] = bucket[2];
+        moments->sum_squares[i] = bucket[3];
+        for (lane = 1; lane < no_of_lanes; lane++) {
+            bucket = &lanes[(lane*curve_length + i)*stride];
+            moments->count[i] += bucket[0];
+            moments->inliers[i] += bucket[1];
+            moments->sum[i] += bucket[2];
+            moments->sum_squares[i] += bucket[3];
+        }
+    }
+}
+
+/**
+ * @brief Folds a range of samples by orbital phase, adding them to
+ *        the moments of each light curve bucket.
+ *        This is the reference implementation for the other kernels.
+ * @param fold Precalculated values for the series
+ * @param multiplier Fixed point reciprocal of the period in ticks
+ * @param curve_length The number of buckets within the curve
+ * @param columns 2 to also fold the companion of the series, otherwise 1
+ * @param start Index of the first sample
+ * @param end Index after the last sample
+ * @param lanes Moments of each bucket for each lane
+ */
+static void fold_accumulate_scalar(fold_context * fold, uint64_t multiplier,
+                                   int curve_length, int columns,
+                                   int start, int end, float lanes[])
+{
+    fold_context * companion = fold->companion;
+    int i, index, stride = columns*FOLD_MOMENTS;
+
+    for (i = start; i < end; i++) {
+        index = fold_bin_index(fold->ticks[i], multiplier, curve_length);
+        fold_bin_add(&lanes[index*stride], fold->series[i],
+                     fold->inlier[i], fold->mean);
+        if (columns > 1) {
+            fold_bin_add(&lanes[index*stride + FOLD_MOMENTS],
+                         companion->series[i], companion->inlier[i],
+                         companion->mean);
+        }
+    }
+}
+
+#ifdef FOLD_X86
+
+/**
+ * @brief Returns the upper 32 bits of the products of unsigned 32 bit
+ *        values, as used to convert ticks into phase and phase into
+ *        bucket indexes
+ * @param a Values to be multiplied
+ * @param b Value to multiply by, in every element
+ * @returns Upper halves of the products
+ */
+__attribute__((target("sse4.2")))
+static inline __m128i fold_mulhi_sse42(__m128i a, __m128i b)
+{
+    __m128i even = _mm_srli_epi64(_mm_mul_epu32(a, b), 32);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), b);
+
+    return _mm_blend_epi16(even, odd, 0xcc);
+}
+
+/**
+ * @brief Returns the bucket indexes of four samples
+ * @param ticks Times of the samples since the origin in ticks
+ * @param multiplier_low Lower half of the fixed point multiplier
+ * @param multiplier_high Upper half of the fixed point multiplier
+ * @param buckets The number of buckets within the curve
+ * @returns Bucket indexes
+ */
+__attribute__((target("sse4.2")))
+static inline __m128i fold_index_sse42(__m128i ticks,
+                                       __m128i multiplier_low,
+                                       __m128i multiplier_high,
+                                       __m128i buckets)
+{
+    __m128i phase = _mm_add_epi32(fold_mulhi_sse42(ticks, multiplier_low),
+                                  _mm_mullo_epi32(ticks, multiplier_high));
+
+    return fold_mulhi_sse42(phase, buckets);
+}
+
+/**
+ * @brief SSE4.2 version of fold_accumulate_scalar, calculating bucket
+ *        indexes for eight samples at a time into two lanes
+ */
+__attribute__((target("sse4.2")))
+static void fold_accumulate_sse42(fold_context * fold, uint64_t multiplier,
+                                  int curve_length, int columns,
+                                  int start, int end, float lanes[])
+{
+    const uint32_t * ticks = fold->ticks;
+    const float * series = fold->series;
+    const float * inlier = fold->inlier;
+    fold_context * companion = fold->companion;
+    int stride = columns*FOLD_MOMENTS;
+    __m128i multiplier_low = _mm_set1_epi32((int)(uint32_t)multiplier);
+    __m128i multiplier_high = _mm_set1_epi32((int)(multiplier >> 32));
+    __m128i buckets = _mm_set1_epi32(curve_length);
+    __m128i i0, i1;
+    int index[8];
+    int i, k;
+
+    for (i = start; i + 8 <= end; i += 8) {
+        i0 = fold_index_sse42(_mm_loadu_si128((__m128i*)&ticks[i]),
+                              multiplier_low, multiplier_high, buckets);
+        i1 = fold_index_sse42(_mm_loadu_si128((__m128i*)&ticks[i+4]),
+                              multiplier_low, multiplier_high, buckets);
+        _mm_storeu_si128((__m128i*)&index[0], i0);
+        _mm_storeu_si128((__m128i*)&index[4], i1);
+
+        /* each lane has its own histogram, so that neighbouring
+           samples in the same bucket don't wait for each other */
+        for (k = 0; k < 8; k++) {
+            fold_bin_add(&lanes[((k & 1)*curve_length + index[k])*stride],
+                         series[i+k], inlier[i+k], fold->mean);
+        }
+        if (columns > 1) {
+            for (k = 0; k < 8; k++) {
+                fold_bin_add(&lanes[((k & 1)*curve_length + index[k]) *
+                                    stride + FOLD_MOMENTS],
+                             companion->series[i+k], companion->inlier[i+k],
+                             companion->mean);
+            }
+        }
+    }
+    fold_accumulate_scalar(fold, multiplier, curve_length, columns,
+                           i, end, lanes);
+}
+
+/**
+ * @brief AVX2 version of fold_mulhi_sse42
+ */
+__attribute__((target("avx2")))
+static inline __m256i fold_mulhi_avx2(__m256i a, __m256i b)
+{
+    __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(a, b), 32);
+    __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b);
+
+    return _mm256_blend_epi32(even, odd, 0xaa);
+}
+
+/**
+ * @brief AVX2 version of fold_index_sse42, for eight samples
+ */
+__attribute__((target("avx2")))
+static inline __m256i fold_index_avx2(__m256i ticks,
+                                      __m256i multiplier_low,
+                                      __m256i multiplier_high,
+                                      __m256i buckets)
+{
+    __m256i phase =
+        _mm256_add_epi32(fold_mulhi_avx2(ticks, multiplier_low),
+                         _mm256_mullo_epi32(ticks, multiplier_high));
+
+    return fold_mulhi_avx2(phase, buckets);
+}
+
+/**
+ * @brief AVX2 version of fold_accumulate_scalar, calculating bucket
+ *        indexes for eight samples at a time into four lanes
+ */
+__attribute__((target("avx2")))
+static void fold_accumulate_avx2(fold_context * fold, uint64_t multiplier,
+                                 int curve_length, int columns,
+                                 int start, int end, float lanes[])
+{
+    const uint32_t * ticks = fold->ticks;
+    const float * series = fold->series;
+    const float * inlier = fold->inlier;
+    fold_context * companion = fold->companion;
+    int stride = columns*FOLD_MOMENTS;
+    __m256i multiplier_low = _mm256_set1_epi32((int)(uint32_t)multiplier);
+    __m256i multiplier_high = _mm256_set1_epi32((int)(multiplier >> 32));
+    __m256i buckets = _mm256_set1_epi32(curve_length);
+    int index[8];
+    int i, k;
+
+    for (i = start; i + 8 <= end; i += 8) {
+        _mm256_storeu_si256((__m256i*)index,
+                            fold_index_avx2(
+                                _mm256_loadu_si256((__m256i*)&ticks[i]),
+                                multiplier_low, multiplier_high, buckets));
+
+        for (k = 0; k < 8; k++) {
+            fold_bin_add(&lanes[((k & 3)*curve_length + index[k])*stride],
+                         series[i+k], inlier[i+k], fold->mean);
+        }
+        if (columns > 1) {
+            for (k = 0; k < 8; k++) {
+                fold_bin_add(&lanes[((k & 3)*curve_length + index[k]) *
+                                    stride + FOLD_MOMENTS],
+                             companion->series[i+k], companion->inlier[i+k],
+                             companion->mean);
+            }
+        }
+    }
+    fold_accumulate_scalar(fold, multiplier, curve_length, columns,
+                           i, end, lanes);
+}
+
+/**
+ * @brief AVX-512 version of fold_mulhi_sse42
+ */
+__attribute__((target("avx512f")))
+static inline __m512i fold_mulhi_avx512(__m512i a, __m512i b)
+{
+    __m512i even = _mm512_srli_epi64(_mm512_mul_epu32(a, b), 32);
+    __m512i odd = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), b);
+
+    return _mm512_mask_blend_epi32(0xaaaa, even, odd);
+}
+
+/**
+ * @brief Adds sixteen samples to the moments of their buckets, as
+ *        fold_bin_add does for one
+ * @param lanes Moments of the series within the first bucket
+ * @param index Offsets of the moments of each bucket from the first
+ * @param value Magnitudes of the samples
+ * @param weight Weights of the samples
+ * @param mean Mean magnitude of the series
+ */
+__attribute__((target("avx512f")))
+static inline void fold_add_avx512(float lanes[], __m512i index,
+                                   __m512 value, __m512 weight, __m512 mean)
+{
+    __m512 deviation = _mm512_sub_ps(value, mean);
+    __m512 m;
+
+    m = _mm512_i32gather_ps(index, &lanes[0], 4);
+    _mm512_i32scatter_ps(&lanes[0], index,
+                         _mm512_add_ps(m, _mm512_set1_ps(1.0f)), 4);
+    m = _mm512_i32gather_ps(index, &lanes[1], 4);
+    _mm512_i32scatter_ps(&lanes[1], index, _mm512_add_ps(m, weight), 4);
+    m = _mm512_i32gather_ps(index, &lanes[2], 4);
+    m = _mm512_add_ps(m, _mm512_mul_ps(value, weight));
+    _mm512_i32scatter_ps(&lanes[2], index, m, 4);
+    m = _mm512_i32gather_ps(index, &lanes[3], 4);
+    m = _mm512_add_ps(m, _mm512_mul_ps(_mm512_mul_ps(deviation, deviation),
+                                       weight));
+    _mm512_i32scatter_ps(&lanes[3], index, m, 4);
+}
+
+/**
+ * @brief AVX-512 version of fold_accumulate_scalar, calculating bucket
+ *        indexes for sixteen samples at a time. Each of the sixteen
+ *        lanes has its own histogram, so the gathers and scatters
+ *        never have conflicting indexes.
+ */
+__attribute__((target("avx512f")))
+static void fold_accumulate_avx512(fold_context * fold, uint64_t multiplier,
+                                   int curve_length, int columns,
+                                   int start, int end, float lanes[])
+{
+    const uint32_t * ticks = fold->ticks;
+    const float * series = fold->series;
+    const float * inlier = fold->inlier;
+    fold_context * companion = fold->companion;
+    __m512i multiplier_low = _mm512_set1_epi32((int)(uint32_t)multiplier);
+    __m512i multiplier_high = _mm512_set1_epi32((int)(multiplier >> 32));
+    __m512i buckets = _mm512_set1_epi32(curve_length);
+    __m512i lane_offset =
+        _mm512_mullo_epi32(_mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8,
+                                            7, 6, 5, 4, 3, 2, 1, 0),
+                           _mm512_set1_epi32(curve_length));
+    /* FOLD_MOMENTS floats for each series within a bucket */
+    __m128i stride_shift = _mm_cvtsi32_si128((columns > 1) ? 3 : 2);
+    __m512 mean = _mm512_set1_ps(fold->mean);
+    __m512 companion_mean =
+        _mm512_set1_ps((columns > 1) ? companion->mean : 0);
+    __m512i t, phase, index;
+    int i;
+
+    for (i = start; i + 16 <= end; i += 16) {
+        t = _mm512_loadu_si512(&ticks[i]);
+        phase = _mm512_add_epi32(fold_mulhi_avx512(t, multiplier_low),
+                                 _mm512_mullo_epi32(t, multiplier_high));
+        index = fold_mulhi_avx512(phase, buckets);
+        index = _mm512_add_epi32(index, lane_offset);
+        index = _mm512_sll_epi32(index, stride_shift);
+
+        fold_add_avx512(lanes, index, _mm512_loadu_ps(&series[i]),
+                        _mm512_loadu_ps(&inlier[i]), mean);
+        if (columns > 1) {
+            fold_add_avx512(&lanes[FOLD_MOMENTS], index,
+                            _mm512_loadu_ps(&companion->series[i]),
+                            _mm512_loadu_ps(&companion->inlier[i]),
+                            companion_mean);
+        }
+    }
+    fold_accumulate_scalar(fold, multiplier, curve_length, columns,
+                           i, end, lanes);
+}
+
+#endif
+
+/**
+ * @brief Returns the most capable kernel which this CPU supports
+ * @returns FOLD_KERNEL_SCALAR, FOLD_KERNEL_SSE42, FOLD_KERNEL_AVX2
+ *          or FOLD_KERNEL_AVX512
+ */
+static int fold_kernel_supported()
+{
+#ifdef FOLD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return FOLD_KERNEL_AVX512;
+    if (__builtin_cpu_supports("avx2")) return FOLD_KERNEL_AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return FOLD_KERNEL_SSE42;
+#endif
+    return FOLD_KERNEL_SCALAR;
+}
+
+/**
+ * @brief Selects the kernel used by fold_bin. This should be called
+ *        before any parallel search begins.
+ * @param kernel The kernel, or negative to select the most capable one.
+ *        If the CPU doesn't support the kernel then the most capable
+ *        one which it does support is used.
+ * @returns The selected kernel
+ */
+int fold_kernel_select(int kernel)
+{
+    int supported = fold_kernel_supported();
+
+    if ((kernel < 0) || (kernel > supported)) kernel = supported;
+
+    fold_accumulate_selected = fold_accumulate_scalar;
+    fold_lanes_selected = 1;
+#ifdef FOLD_X86
+    switch(kernel) {
+    case FOLD_KERNEL_SSE42: {
+        fold_accumulate_selected = fold_accumulate_sse42;
+        fold_lanes_selected = 2;
+        break;
+    }
+    case FOLD_KERNEL_AVX2: {
+        fold_accumulate_selected = fold_accumulate_avx2;
+        fold_lanes_selected = 4;
+        break;
+    }
+    case FOLD_KERNEL_AVX512: {
+        fold_accumulate_selected = fold_accumulate_avx512;
+        fold_lanes_selected = FOLD_MAX_LANES;
+        break;
+    }
+    }
+#endif
+    return kernel;
+}
+
+/**
+ * @brief Returns the name of a kernel
+ * @param kernel The kernel
+ * @returns Name of the kernel
+ */
+const char * fold_kernel_name(int kernel)
+{
+    if ((kernel < FOLD_KERNEL_SCALAR) || (kernel > FOLD_KERNEL_AVX512)) {
+        return "unknown";
+    }
+    return fold_kernel_names[kernel];
+}
+
+/**
+ * @brief Folds samples by orbital phase with the scalar kernel,
+ *        accumulating the moments of each light curve bucket.
+ *        This is the reference for checking the other kernels.
+ * @param fold Precalculated values for the series
+ * @param period_days Orbital period in days
+ * @param curve_length The number of buckets within the curve
+ * @param moments Returned moments of each bucket
+ */
+void fold_bin_scalar(fold_context * fold, double period_days,
+                     int curve_length, fold_moments * moments)
+{
+    float lanes[FOLD_MAX_CURVE_LENGTH*FOLD_MOMENTS];
+
+    memset(lanes, 0, curve_length*FOLD_MOMENTS*sizeof(float));
+    fold_accumulate_scalar(fold, fold_bin_multiplier(fold, period_days),
+                           curve_length, 1, 0, fold->length, lanes);
+    fold_bin_merge(lanes, 1, curve_length, 1, 0, moments);
+}
+
+/**
+ * @brief Folds samples by orbital phase using the selected kernel,
+ *        accumulating the moments of each light curve bucket.
+ *        Any companion of the series isn't folded.
+ * @param fold Precalculated values for the series
+ * @param period_days Orbital period in days
+ * @param curve_length The number of buckets within the curve,
+ *        up to FOLD_MAX_CURVE_LENGTH
+ * @param moments Returned moments of each bucket
+ * @param workspace Array of fold_bin_workspace floats, which holds the
+ *        moments of each vector lane. Each thread needs its own.
+ */
+void fold_bin(fold_context * fold, double period_days,
+              int curve_length, fold_moments * moments,
+              float workspace[])
+{
+    if (fold_accumulate_selected == NULL) fold_kernel_select(-1);
+
+    memset(workspace, 0,
+           fold_lanes_selected*curve_length*FOLD_MOMENTS*sizeof(float));
+    fold_accumulate_selected(fold, fold_bin_multiplier(fold, period_days),
+                             curve_length, 1, 0, fold->length, workspace);
+    fold_bin_merge(workspace, fold_lanes_selected, curve_length, 1, 0,
+                   moments);
+}
+
+/**
+ * @brief Returns the size of the workspace needed by fold_bin or
+ *        fold_bin_tile
+ * @param fold Precalculated values for the series
+ * @param curve_length The number of buckets within the curve
+ * @returns Number of floats
+ */
+int fold_bin_workspace(fold_context * fold, int curve_length)
+{
+    int columns = (fold->companion != NULL) ? 2 : 1;
+    int tile_periods = (fold->tile_periods > 1) ? fold->tile_periods : 1;
+
+    if (fold_accumulate_selected == NULL) fold_kernel_select(-1);
+    return tile_periods*fold_lanes_selected*curve_length*
+        columns*FOLD_MOMENTS;
+}
+
+/**
+ * @brief Folds samples by orbital phase for a tile of several periods.
+ *        Samples are swept in chunks small enough to stay in cache,
+ *        and each chunk is folded for every period in the tile before
+ *        moving on, so that the samples are read from memory once per
+ *        tile rather than once per period.
+ *        Any companion of the series is folded in the same pass.
+ * @param fold Precalculated values for the series
+ * @param period_days Orbital periods in days
+ * @param no_of_periods The number of periods, up to fold->tile_periods
+ * @param curve_length The number of buckets within the curve,
+ *        up to FOLD_MAX_CURVE_LENGTH
+ * @param moments Returned moments of each bucket for each period,
+ *        followed by those of the companion if there is one
+ * @param workspace Array of fold_bin_workspace floats
+ */
+void fold_bin_tile(fold_context * fold, float period_days[],
+                   int no_of_periods, int curve_length,
+                   fold_moments moments[], float workspace[])
+{
+    uint64_t multiplier[FOLD_MAX_TILE_PERIODS];
+    int lane_size, p, c, start, end, chunk = fold->tile_samples;
+    int columns = (fold->companion != NULL) ? 2 : 1;
+
+    if (fold_accumulate_selected == NULL) fold_kernel_select(-1);
+    if (no_of_periods > fold->tile_periods) no_of_periods = fold->tile_periods;
+    if (chunk <= 0) chunk = fold->length;
+    /* whole vectors in each chunk keep the lanes the same as when the
+       samples are folded in one pass */
+    chunk = (chunk + FOLD_MAX_LANES - 1) / FOLD_MAX_LANES * FOLD_MAX_LANES;
+
+    lane_size = fold_lanes_selected*curve_length*columns*FOLD_MOMENTS;
+    memset(workspace, 0, no_of_periods*lane_size*sizeof(float));
+    for (p = 0; p < no_of_periods; p++) {
+        multiplier[p] = fold_bin_multiplier(fold, period_days[p]);
+    }
+
+    for (start = 0; start < fold->length; start += chunk) {
+        end = start + chunk;
+        if (end > fold->length) end = fold->length;
+        for (p = 0; p < no_of_periods; p++) {
+            fold_accumulate_selected(fold, multiplier[p], curve_length,
+                                     columns, start, end,
+                                     &workspace[p*lane_size]);
+        }
+    }
+
+    for (c = 0; c < columns; c++) {
+        for (p = 0; p < no_of_periods; p++) {
+            fold_bin_merge(&workspace[p*lane_size], fold_lanes_selected,
+                           curve_length, columns, c,
+                           &moments[c*no_of_periods + p]);
+        }
+    }
+}
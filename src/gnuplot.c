@@ -16,13 +16,43 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <unistd.h>
 #include "waspscan.h"
 
 #define LIGHT_CURVE_LENGTH 256
 
-/* temporary files used to create plots */
-char * plot_script_filename = "/tmp/SuperWASP.plot";
-char * plot_data_filename = "/tmp/SuperWASP.dat";
+/**
+* @brief Returns the names of the temporary files used to create plots.
+*        These include the process ID so that concurrent runs don't
+*        overwrite each other's plots.
+* @param plot_script_filename Returned filename for the plot script
+* @param plot_data_filename Returned filename for the data to be plotted
+*/
+static void gnuplot_temp_filenames(char * plot_script_filename,
+                                   char * plot_data_filename)
+{
+    sprintf(plot_script_filename,"/tmp/SuperWASP_%d.plot",(int)getpid());
+    sprintf(plot_data_filename,"/tmp/SuperWASP_%d.dat",(int)getpid());
+}
+
+/**
+* @brief Runs gnuplot on a script and then removes the temporary files
+* @param plot_script_filename Filename for the plot script
+* @param plot_data_filename Filename for the data to be plotted
+* @returns result of the call to system()
+*/
+static int gnuplot_run(char * plot_script_filename,
+                       char * plot_data_filename)
+{
+    char commandstr[256];
+    int retval;
+
+    sprintf(commandstr,"gnuplot %s", plot_script_filename);
+    retval = system(commandstr);
+    unlink(plot_script_filename);
+    unlink(plot_data_filename);
+    return retval;
+}
 
 /**
 * @brief creates a gnuplot script
@@ -148,6 +178,47 @@ int gnuplot_save_data(float timestamp[], float series[],
     return 0;
 }
 
+/**
+* @brief Saves a time series to file
+* @param timestamp Array containing times for each entry
+* @param series Array containing values for each entry
+* @param series_length Length of the Array
+* @param plot_data_filename Filename to save as
+* @returns 0 on success
+*/
+static int gnuplot_save_times(double timestamp[], float series[],
+                              int series_length,
+                              char * plot_data_filename)
+{
+    FILE * fp = fopen(plot_data_filename,"w");
+    if (!fp) return -1;
+    for (int i = 0; i < series_length; i++) {
+        fprintf(fp,"%.8f %.8f\n", timestamp[i], series[i]);
+    }
+    fclose(fp);
+    return 0;
+}
+
+/**
+* @brief Returns the earliest and latest times within a time series
+* @param timestamp Array containing times
+* @param series_length Length of the array
+* @param time_min Returned earliest time
+* @param time_max Returned latest time
+*/
+static void gnuplot_time_range(double timestamp[], int series_length,
+                               double * time_min, double * time_max)
+{
+    for (int i = 0; i < series_length; i++) {
+        if ((i == 0) || (timestamp[i] < *time_min)) {
+            *time_min = timestamp[i];
+        }
+        if ((i == 0) || (timestamp[i] > *time_max)) {
+            *time_max = timestamp[i];
+        }
+    }
+}
+
 /**
 * @brief Returns the min and max values within a data series
 * @param series Array containing values
@@ -189,7 +260,7 @@ void gnuplot_get_range(float series[], int series_length,
 * @returns result of the call to system()
 */
 int gnuplot_distribution(char * title,
-                         float timestamp[],
+                         double timestamp[],
                          float series[], int series_length,
                          char * image_filename,
                          int image_width, int image_height,
@@ -201,19 +272,21 @@ int gnuplot_distribution(char * title,
     float mean, variance;
     float range_min=0;
     float range_max=0;
-    float time_min=0;
-    float time_max=0;
-    char commandstr[256];
+    double time_min=0;
+    double time_max=0;
+    char plot_script_filename[64];
+    char plot_data_filename[64];
 
     sprintf(subtitle,"%s","");
+    gnuplot_temp_filenames(plot_script_filename, plot_data_filename);
 
-    if (gnuplot_save_data(timestamp, series, series_length,
-                          (char*)plot_data_filename) != 0) {
+    if (gnuplot_save_times(timestamp, series, series_length,
+                          plot_data_filename) != 0) {
         return -1;
     }
 
-    gnuplot_get_range(timestamp, series_length,
-                      &time_min, &time_max);
+    gnuplot_time_range(timestamp, series_length,
+                       &time_min, &time_max);
     if (time_max == time_min) {
         return -2;
     }
@@ -223,8 +296,8 @@ int gnuplot_distribution(char * title,
     range_min = mean - variance*4;
     range_max = mean + variance*4;
 
-    if (gnuplot_create_script((char*)plot_script_filename,
-                              (char*)plot_data_filename,
+    if (gnuplot_create_script(plot_script_filename,
+                              plot_data_filename,
                               title, subtitle,
                               subtitle_indent_horizontal,
                               subtitle_indent_vertical,
@@ -237,8 +310,7 @@ int gnuplot_distribution(char * title,
         return -4;
     }
 
-    sprintf(commandstr,"gnuplot %s", plot_script_filename);
-    return system(commandstr);
+    return gnuplot_run(plot_script_filename, plot_data_filename);
 }
 
 /**
@@ -258,7 +330,7 @@ int gnuplot_distribution(char * title,
 * @returns result of the call to system()
 */
 int gnuplot_light_curve(char * title,
-                        float timestamp[],
+                        double timestamp[],
                         float series[], int series_length,
                         char * image_filename,
                         int image_width, int image_height,
@@ -272,15 +344,17 @@ int gnuplot_light_curve(char * title,
     float mean, variance;
     float range_min=0;
     float range_max=0;
-    float time_min=0;
-    float time_max=0;
-    char commandstr[LIGHT_CURVE_LENGTH];
+    double time_min=0;
+    double time_max=0;
+    char plot_script_filename[64];
+    char plot_data_filename[64];
     float curve[LIGHT_CURVE_LENGTH];
     float density[LIGHT_CURVE_LENGTH];
     float phase[LIGHT_CURVE_LENGTH];
     int i, offset;
 
     sprintf(subtitle,"Orbital Period %.5f days",period_days);
+    gnuplot_temp_filenames(plot_script_filename, plot_data_filename);
 
     for (i = 0; i < LIGHT_CURVE_LENGTH; i++) {
         phase[i] = (i*360.0f/LIGHT_CURVE_LENGTH)-180.0f;
@@ -293,12 +367,12 @@ int gnuplot_light_curve(char * title,
     adjust_curve(curve, LIGHT_CURVE_LENGTH, offset);
 
     if (gnuplot_save_data(phase, curve, LIGHT_CURVE_LENGTH,
-                          (char*)plot_data_filename) != 0) {
+                          plot_data_filename) != 0) {
         return -1;
     }
 
-    gnuplot_get_range(timestamp, series_length,
-                      &time_min, &time_max);
+    gnuplot_time_range(timestamp, series_length,
+                       &time_min, &time_max);
     if (time_max == time_min) {
         return -2;
     }
@@ -308,8 +382,8 @@ int gnuplot_light_curve(char * title,
     range_min = mean - (variance*8*vertical_scale);
     range_max = mean + (variance*8*vertical_scale);
 
-    if (gnuplot_create_script((char*)plot_script_filename,
-                              (char*)plot_data_filename,
+    if (gnuplot_create_script(plot_script_filename,
+                              plot_data_filename,
                               title, subtitle,
                               subtitle_indent_horizontal,
                               subtitle_indent_vertical,
@@ -322,8 +396,7 @@ int gnuplot_light_curve(char * title,
         return -4;
     }
 
-    sprintf(commandstr,"gnuplot %s", plot_script_filename);
-    return system(commandstr);
+    return gnuplot_run(plot_script_filename, plot_data_filename);
 }
 
 /**
@@ -343,7 +416,7 @@ int gnuplot_light_curve(char * title,
 * @returns result of the call to system()
 */
 int gnuplot_light_curve_distribution(char * title,
-                                     float timestamp[],
+                                     double timestamp[],
                                      float series[], int series_length,
                                      char * image_filename,
                                      int image_width, int image_height,
@@ -357,34 +430,43 @@ int gnuplot_light_curve_distribution(char * title,
     float mean, variance, adjust;
     float range_min=0;
     float range_max=0;
-    float time_min=0;
-    float time_max=0;
-    char commandstr[256];
-    float timestamp_curve[MAX_SERIES_LENGTH];
+    double time_min=0;
+    double time_max=0;
+    char plot_script_filename[64];
+    char plot_data_filename[64];
+    float * timestamp_curve;
+    double origin;
     int i, offset;
     float curve[LIGHT_CURVE_LENGTH];
     float density[LIGHT_CURVE_LENGTH];
 
     sprintf(subtitle,"Orbital Period %.5f days",period_days);
+    gnuplot_temp_filenames(plot_script_filename, plot_data_filename);
 
     light_curve(timestamp, series, series_length,
                 period_days, curve, density, LIGHT_CURVE_LENGTH);
     offset = detect_phase_offset(curve, LIGHT_CURVE_LENGTH);
     adjust = (period_days/2) - (offset*period_days/LIGHT_CURVE_LENGTH);
 
+    timestamp_curve = (float*)malloc(series_length*sizeof(float));
+    if (timestamp_curve == NULL) return -1;
+
+    origin = fold_time_origin(timestamp, series_length);
     for (i = 0; i < series_length; i++) {
         timestamp_curve[i] =
-            (fmod((timestamp[i]/(60*60*24))+adjust,period_days) * 360 /
-             period_days) - 180.0f;
+            (fmod(((timestamp[i]-origin)/(60*60*24))+adjust,period_days) *
+             360 / period_days) - 180.0f;
     }
 
     if (gnuplot_save_data(timestamp_curve, series, series_length,
-                          (char*)plot_data_filename) != 0) {
+                          plot_data_filename) != 0) {
+        free(timestamp_curve);
         return -1;
     }
+    free(timestamp_curve);
 
-    gnuplot_get_range(timestamp, series_length,
-                      &time_min, &time_max);
+    gnuplot_time_range(timestamp, series_length,
+                       &time_min, &time_max);
     if (time_max == time_min) {
         return -2;
     }
@@ -394,8 +476,8 @@ int gnuplot_light_curve_distribution(char * title,
     range_min = mean - variance*3*vertical_scale;
     range_max = mean + variance*3*vertical_scale;
 
-    if (gnuplot_create_script((char*)plot_script_filename,
-                              (char*)plot_data_filename,
+    if (gnuplot_create_script(plot_script_filename,
+                              plot_data_filename,
                               title, subtitle,
                               subtitle_indent_horizontal,
                               subtitle_indent_vertical,
@@ -408,6 +490,5 @@ int gnuplot_light_curve_distribution(char * title,
         return -4;
     }
 
-    sprintf(commandstr,"gnuplot %s", plot_script_filename);
-    return system(commandstr);
+    return gnuplot_run(plot_script_filename, plot_data_filename);
 }
@@ -0,0 +1,116 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "waspscan.h"
+
+/**
+ * @brief Creates a grid of orbital periods with a fixed increment
+ * @param min_period_days The minimum orbital period in days
+ * @param max_period_days The maximum orbital period in days
+ * @param increment_days The time increment used within the min/max range
+ * @param periods Returned array of orbital periods, which should be freed
+ * @returns The number of orbital periods within the grid
+ */
+int period_grid_uniform(float min_period_days, float max_period_days,
+                        float increment_days, float ** periods)
+{
+    int i;
+    int steps = (int)((max_period_days - min_period_days)/increment_days);
+
+    *periods = NULL;
+    if (steps <= 0) return 0;
+
+    *periods = (float*)malloc(steps*sizeof(float));
+    if (*periods == NULL) return -1;
+
+    for (i = 0; i < steps; i++) {
+        (*periods)[i] = min_period_days + (i*increment_days);
+    }
+    return steps;
+}
+
+/**
+ * @brief Returns the frequency increment for which the phase of a
+ *        sample drifts by no more than a fraction of one light curve
+ *        bucket across the whole observation baseline
+ * @param fold Precalculated values for the series being searched
+ * @param curve_length The number of buckets within the light curve
+ * @param oversample Number of grid steps per bucket of phase drift
+ * @returns Frequency increment in cycles per day, or zero if the
+ *          series has no baseline
+ */
+double period_grid_frequency_increment(fold_context * fold,
+                                       int curve_length, float oversample)
+{
+    double baseline_days = fold->baseline_days;
+
+    if ((fold->length < 2) || (oversample <= 0)) return 0;
+    if (baseline_days <= 0) return 0;
+
+    /* the phase change across the baseline between adjacent
+       frequencies is freq_increment * baseline cycles */
+    return 1.0 / (baseline_days * curve_length * oversample);
+}
+
+/**
+ * @brief Creates a grid of orbital periods which is uniform in
+ *        frequency. The frequency step is chosen such that across
+ *        the whole observation baseline the phase of a sample
+ *        drifts by no more than a fraction of one light curve bucket
+ *        between adjacent periods. Long periods need far fewer
+ *        steps than short ones.
+ * @param fold Precalculated values for the series being searched
+ * @param min_period_days The minimum orbital period in days
+ * @param max_period_days The maximum orbital period in days
+ * @param curve_length The number of buckets within the light curve
+ * @param oversample Number of grid steps per bucket of phase drift
+ * @param periods Returned array of orbital periods, which should be freed
+ * @returns The number of orbital periods within the grid
+ */
+int period_grid_adaptive(fold_context * fold,
+                         float min_period_days, float max_period_days,
+                         int curve_length, float oversample,
+                         float ** periods)
+{
+    int i, steps;
+    double min_freq, max_freq, freq_increment;
+
+    *periods = NULL;
+    if ((min_period_days <= 0) ||
+        (max_period_days <= min_period_days)) {
+        return 0;
+    }
+
+    freq_increment =
+        period_grid_frequency_increment(fold, curve_length, oversample);
+    if (freq_increment <= 0) return 0;
+
+    min_freq = 1.0 / max_period_days;
+    max_freq = 1.0 / min_period_days;
+    steps = (int)((max_freq - min_freq) / freq_increment) + 1;
+
+    *periods = (float*)malloc(steps*sizeof(float));
+    if (*periods == NULL) return -1;
+
+    /* descending frequency gives ascending period */
+    for (i = 0; i < steps; i++) {
+        (*periods)[i] = (float)(1.0 / (max_freq - (i*freq_increment)));
+    }
+    return steps;
+}
@@ -30,69 +30,402 @@
 #define HJD          9  /* Date */
 #define MAG2         10
 
+/* maximum number of fields which can be extracted in one pass */
+#define LOGFILE_MAX_FIELDS 16
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "waspscan.h"
 
+/* powers of ten used when parsing numbers */
+static const double logfile_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/**
+ * @brief Returns non-zero for characters which separate fields
+ * @param c The character
+ * @returns non-zero if this is white space
+ */
+static int logfile_space(char c)
+{
+    return ((c == ' ') || (c == '\t') || (c == '\r'));
+}
+
+/**
+ * @brief Parses a decimal number such as "-123.456e-7".
+ *        This avoids the locale handling and copying needed
+ *        for atof, at the cost of possibly differing from it
+ *        in the last bit of precision.
+ * @param str Start of the number
+ * @param end End of the number
+ * @returns The value, or NAN if this isn't a number (eg. "null")
+ */
+static double logfile_parse_number(const char * str, const char * end)
+{
+    double value = 0;
+    int negative = 0, exponent = 0, exponent_sign = 1;
+    int digits = 0, e = 0;
+    unsigned long long mantissa = 0;
+
+    if ((str < end) && ((*str == '-') || (*str == '+'))) {
+        negative = (*str == '-');
+        str++;
+    }
+
+    /* up to 19 significant digits are accumulated as an integer */
+    while ((str < end) && (*str >= '0') && (*str <= '9')) {
+        if (digits < 19) {
+            mantissa = mantissa*10 + (*str - '0');
+            if (mantissa > 0) digits++;
+        }
+        else {
+            exponent++;
+        }
+        str++;
+        e = 1;
+    }
+    if ((str < end) && (*str == '.')) {
+        str++;
+        while ((str < end) && (*str >= '0') && (*str <= '9')) {
+            if (digits < 19) {
+                mantissa = mantissa*10 + (*str - '0');
+                if (mantissa > 0) digits++;
+                exponent--;
+            }
+            str++;
+            e = 1;
+        }
+    }
+    if (e == 0) return NAN;
+
+    if ((str < end) && ((*str == 'e') || (*str == 'E'))) {
+        str++;
+        e = 0;
+        if ((str < end) && ((*str == '-') || (*str == '+'))) {
+            if (*str == '-') exponent_sign = -1;
+            str++;
+        }
+        while ((str < end) && (*str >= '0') && (*str <= '9')) {
+            e = e*10 + (*str - '0');
+            if (e > 9999) e = 9999;
+            str++;
+        }
+        exponent += e*exponent_sign;
+    }
+    if (str != end) return NAN;
+
+    value = (double)mantissa;
+    if ((exponent >= 0) && (exponent <= 22)) {
+        value *= logfile_pow10[exponent];
+    }
+    else if ((exponent < 0) && (exponent >= -22)) {
+        value /= logfile_pow10[-exponent];
+    }
+    else {
+        value *= pow(10.0, exponent);
+    }
+    return negative ? -value : value;
+}
+
+/**
+ * @brief Returns non-zero if a field name within a header matches,
+ *        ignoring case
+ * @param str Start of the name within the header
+ * @param len Length of the name within the header
+ * @param name The name to compare against
+ * @returns non-zero if the names match
+ */
+static int logfile_name_matches(const char * str, int len, char * name)
+{
+    int i;
+
+    if ((int)strlen(name) != len) return 0;
+    for (i = 0; i < len; i++) {
+        char a = str[i], b = name[i];
+        if ((a >= 'a') && (a <= 'z')) a -= 'a' - 'A';
+        if ((b >= 'a') && (b <= 'z')) b -= 'a' - 'A';
+        if (a != b) return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Maps field names to field indexes using a header line.
+ *        Both "| TMID FLUX2 ..." and "|TMID|FLUX2|...|" styles of
+ *        header are understood.
+ * @param line Start of the header line
+ * @param end End of the header line
+ * @param no_of_fields The number of fields to be extracted
+ * @param field_name Names of the fields, or NULL entries
+ * @param field_index Updated indexes of the fields
+ */
+static void logfile_header(const char * line, const char * end,
+                           int no_of_fields, char * field_name[],
+                           int field_index[])
+{
+    int index = 0, f;
+    const char * start;
+
+    while (line < end) {
+        while ((line < end) && ((*line == '|') || logfile_space(*line))) {
+            line++;
+        }
+        if (line >= end) break;
+        start = line;
+        while ((line < end) && (*line != '|') && !logfile_space(*line)) {
+            line++;
+        }
+        for (f = 0; f < no_of_fields; f++) {
+            if ((field_name[f] != NULL) &&
+                logfile_name_matches(start, (int)(line - start),
+                                     field_name[f])) {
+                field_index[f] = index;
+            }
+        }
+        index++;
+    }
+}
+
+/**
+ * @brief Loads a number of fields from a log file in a single pass.
+ *        The file is memory mapped and only the requested fields are
+ *        parsed. Rows for which any required field is not a number,
+ *        or which are flagged, are skipped, while optional fields which
+ *        are not numbers are returned as NaN.
+ * @param filename Log filename
+ * @param no_of_fields The number of fields to be extracted
+ * @param field_name Names of the fields, which if present within the
+ *        header take priority over field_index. Entries may be NULL.
+ * @param field_index Indexes of the fields within each row
+ * @param field_values Returned arrays of values for each field,
+ *        allocated from the arena
+ * @param optional Non-zero for each field which may be null, or NULL
+ *        if every field is required
+ * @param flag_field Index within the fields of a bitmask, where rows
+ *        with any bit set are skipped, or negative if there is none
+ * @param mem Arena from which the arrays are allocated
+ * @returns The number of data points loaded, or negative on error
+ */
+int logfile_load_fields(char * filename,
+                        int no_of_fields, char * field_name[],
+                        int field_index[], double * field_values[],
+                        int optional[], int flag_field, arena * mem)
+{
+    int fd, f, index, last_index, header_found = 0;
+    int series_length = 0, max_series_length = 1;
+    struct stat st;
+    char * data;
+    const char * line, * end, * line_end, * str, * start;
+    int index_of_field[LOGFILE_MAX_FIELDS];
+    double value[LOGFILE_MAX_FIELDS] = {0};
+
+    if ((no_of_fields < 1) || (no_of_fields > LOGFILE_MAX_FIELDS)) {
+        return -2;
+    }
+    for (f = 0; f < no_of_fields; f++) {
+        index_of_field[f] = field_index[f];
+    }
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    if ((fstat(fd, &st) != 0) || (st.st_size == 0)) {
+        close(fd);
+        return 0;
+    }
+    data = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    line = data;
+    end = data + st.st_size;
+
+    /* there can be no more rows than lines */
+    for (str = data; (str = memchr(str, '\n', end - str)) != NULL; str++) {
+        max_series_length++;
+    }
+    for (f = 0; f < no_of_fields; f++) {
+        field_values[f] =
+            (double*)arena_alloc(mem, max_series_length*sizeof(double));
+        if (field_values[f] == NULL) {
+            munmap(data, st.st_size);
+            return -3;
+        }
+    }
+
+    while ((line < end) && (series_length < max_series_length)) {
+        line_end = (const char*)memchr(line, '\n', end - line);
+        if (line_end == NULL) line_end = end;
+
+        if (*line == '\\') {
+            line = line_end + 1;
+            continue;
+        }
+        if (*line == '|') {
+            /* only the first header line contains field names */
+            if (header_found == 0) {
+                logfile_header(line, line_end, no_of_fields,
+                               field_name, index_of_field);
+                header_found = 1;
+            }
+            line = line_end + 1;
+            continue;
+        }
+
+        last_index = 0;
+        for (f = 0; f < no_of_fields; f++) {
+            if (index_of_field[f] > last_index) {
+                last_index = index_of_field[f];
+            }
+        }
+
+        /* walk through the fields, parsing only those needed */
+        for (f = 0; f < no_of_fields; f++) {
+            value[f] = NAN;
+        }
+        index = 0;
+        str = line;
+        while ((str < line_end) && (index <= last_index)) {
+            while ((str < line_end) && logfile_space(*str)) str++;
+            if (str >= line_end) break;
+            start = str;
+            while ((str < line_end) && !logfile_space(*str)) str++;
+
+            for (f = 0; f < no_of_fields; f++) {
+                if (index_of_field[f] == index) {
+                    value[f] = logfile_parse_number(start, str);
+                    if (isnan(value[f]) &&
+                        ((optional == NULL) || (optional[f] == 0))) break;
+                }
+            }
+            if (f < no_of_fields) break;
+            index++;
+        }
+
+        /* required fields may also be missing from the end of the row */
+        for (f = 0; f < no_of_fields; f++) {
+            if (isnan(value[f]) &&
+                ((optional == NULL) || (optional[f] == 0))) break;
+        }
+        if ((f == no_of_fields) &&
+            ((flag_field < 0) || (value[flag_field] == 0))) {
+            for (f = 0; f < no_of_fields; f++) {
+                field_values[f][series_length] = value[f];
+            }
+            series_length++;
+        }
+        line = line_end + 1;
+    }
+
+    munmap(data, st.st_size);
+    return series_length;
+}
+
 /**
  * @brief Loads a WASP log file containing times and magnitudes
  *        for a given star
  * @param filename Log filename
  * @param timestamp Returned array containing the time of each data point
  * @param series Returned array containing magnitudes
- * @param max_series_length The maximum number of data points to be returned
+ * @param mem Arena from which the arrays are allocated
+ * @param time_field_name Name of the column which contains the time,
+ *        or NULL to use the index
+ * @param flux_field_name Name of the column which contains the photon
+ *        flux, or NULL to use the index
  * @param time_field_index Index of the table column which contains the time
  * @param flux_field_index Index of the table column which contains the
  *        photon flux
  * @returns The number of data points loaded
  */
-int logfile_load(char * filename, float timestamp[],
-                 float series[], int max_series_length,
-				 int time_field_index, int flux_field_index)
+int logfile_load(char * filename, double ** timestamp,
+                 float ** series, arena * mem,
+                 char * time_field_name, char * flux_field_name,
+                 int time_field_index, int flux_field_index)
 {
-    FILE * fp;
-    char linestr[512], valuestr[512];
-    char * retval = NULL;
-    int i,ctr=0,field_index;
-    int series_length=0;
-
-    fp = fopen(filename,"r");
-    if (!fp) return -1;
-
-    while (!feof(fp)) {
-        retval = fgets(linestr,511,fp);
-        if (retval != NULL) {
-            if (strlen(linestr) < 1) continue;
-            if ((linestr[0]=='\\') ||
-                (linestr[0]=='|')) {
-                continue;
-            }
-            field_index = 0;
-            ctr=0;
-            for (i = 0; i < strlen(linestr); i++) {
-                if (!((linestr[i]==' ') || (linestr[i]=='\t'))) {
-                    valuestr[ctr++] = linestr[i];
-                }
-                else {
-                    if (ctr > 0) {
-                        valuestr[ctr]=0;
-                        if (field_index == time_field_index) {
-                            timestamp[series_length] = atof(valuestr);
-                        }
-                        if (field_index == flux_field_index) {
-                            series[series_length++] = atof(valuestr);
-                            if (series_length >= max_series_length) {
-                                fclose(fp);
-                                return(series_length);
-                            }
-                            break;
-                        }
-                        ctr = 0;
-                        field_index++;
-                    }
-                }
-            }
-        }
+    char * field_name[2];
+    int field_index[2];
+    double * field_values[2];
+    int i, series_length;
+
+    field_name[0] = time_field_name;
+    field_name[1] = flux_field_name;
+    field_index[0] = time_field_index;
+    field_index[1] = flux_field_index;
+
+    series_length = logfile_load_fields(filename, 2, field_name, field_index,
+                                        field_values, NULL, -1, mem);
+    if (series_length <= 0) return series_length;
+
+    /* magnitudes are narrowed in place */
+    *timestamp = field_values[0];
+    *series = (float*)field_values[1];
+    for (i = 0; i < series_length; i++) {
+        (*series)[i] = (float)field_values[1][i];
     }
+    return series_length;
+}
+
+/**
+ * @brief Loads the columns of a light curve from a log file in a
+ *        single pass, dropping any flagged samples and any without a
+ *        time, flux or raw flux. A missing error is returned as NaN,
+ *        as it is from a fits table.
+ * @param filename Log filename
+ * @param layout Names and indexes of the columns to be loaded, which
+ *        must include the time and the flux
+ * @param mem Arena from which the arrays are allocated
+ * @param result Returned columns
+ * @returns The number of data points loaded, or negative on error
+ */
+int logfile_load_columns(char * filename, table_layout * layout,
+                         arena * mem, series_columns * result)
+{
+    char * field_name[TABLE_COLUMNS];
+    int field_index[TABLE_COLUMNS], column[TABLE_COLUMNS];
+    int optional[TABLE_COLUMNS];
+    double * field_values[TABLE_COLUMNS];
+    float * values[TABLE_COLUMNS];
+    int c, f, i, series_length, no_of_fields = 0, flag_field = -1;
 
-    fclose(fp);
+    memset(result, 0, sizeof(series_columns));
+    if ((layout->index[TABLE_COLUMN_TIME] < 0) ||
+        (layout->index[TABLE_COLUMN_FLUX] < 0)) {
+        return -2;
+    }
+    for (c = 0; c < TABLE_COLUMNS; c++) {
+        if (layout->index[c] < 0) continue;
+        if (c == TABLE_COLUMN_FLAG) flag_field = no_of_fields;
+        field_name[no_of_fields] = layout->name[c];
+        field_index[no_of_fields] = layout->index[c];
+        optional[no_of_fields] = (c == TABLE_COLUMN_ERROR) ||
+            (c == TABLE_COLUMN_RAW_ERROR);
+        column[no_of_fields++] = c;
+    }
+
+    series_length = logfile_load_fields(filename, no_of_fields, field_name,
+                                        field_index, field_values,
+                                        optional, flag_field, mem);
+    if (series_length <= 0) return series_length;
+
+    /* the time comes first, and the other columns are narrowed
+       in place */
+    memset(values, 0, sizeof(values));
+    for (f = 1; f < no_of_fields; f++) {
+        if (column[f] == TABLE_COLUMN_FLAG) continue;
+        values[column[f]] = (float*)field_values[f];
+        for (i = 0; i < series_length; i++) {
+            values[column[f]][i] = (float)field_values[f][i];
+        }
+    }
+    result->length = series_length;
+    result->timestamp = field_values[0];
+    result->series = values[TABLE_COLUMN_FLUX];
+    result->error = values[TABLE_COLUMN_ERROR];
+    result->raw_series = values[TABLE_COLUMN_RAW_FLUX];
+    result->raw_error = values[TABLE_COLUMN_RAW_ERROR];
     return series_length;
 }
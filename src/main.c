@@ -23,35 +23,62 @@ void show_help()
 {
     printf("WASPscan: Detection of exoplanet transits\n\n");
     printf(" -f  --filename              Log filename\n");
+    printf(" -b  --batch                 Directory or manifest of log files to search\n");
+    printf("     --checkpoint            File where a long search is saved and resumed\n");
+    printf("     --checkpoint-interval   Seconds between saves of the search\n");
+    printf("     --daemon                Download script listing the stars to search\n");
+    printf("     --workdir               Working directory of the daemon\n");
+    printf("     --fetchers              Concurrent downloads of the daemon\n");
+    printf("     --ahead                 Stars downloaded ahead of the search\n");
+    printf("     --mirror                Local directory used in place of downloading\n");
+    printf("     --cursor                File containing the next line of the script\n");
+    printf("     --start                 Start of the script to search, in percent\n");
+    printf("     --end                   End of the script to search, in percent\n");
+    printf("     --claims                Directory where daemons share the script\n");
+    printf("     --node                  Name of this daemon within the claims\n");
+    printf("     --claim-size            Lines of the script claimed at once\n");
+    printf("     --lease                 Seconds before an abandoned claim is taken\n");
     printf(" -p  --period                Known orbital period in days\n");
     printf(" -m  --minsamples            Minimum number of data samples\n");
     printf(" -0  --min                   Minimum orbital period in days\n");
     printf(" -1  --max                   Maximum orbital period in days\n");
     printf(" -t  --type                  Table type: 0=WASP 1=K2\n");
+    printf("     --cache                 Cache the loaded table as a binary sidecar file\n");
+    printf("     --weights               Weight samples by the inverse variance of their errors\n");
+    printf("     --raw-flux              Also search the flux before correction\n");
+    printf("     --keep-flagged          Keep samples which have a non-zero flag\n");
+    printf(" -l  --list                  Name or index of the table within a fits file\n");
+    printf(" -i  --increment             Fixed search increment in days\n");
+    printf(" -o  --oversample            Period grid steps per bucket of phase drift\n");
+    printf("     --hierarchical          Coarse to fine period search\n");
+    printf("     --candidates            Peaks kept by each search stage\n");
     printf("     --vscale                Vertical scaling factor\n");
+    printf("     --plotter               Plot with native (default) or gnuplot\n");
+    printf("     --method                Score periods with heuristic (default), bls or ls\n");
+    printf("     --ls-prescreen          Skip periods dominated by variability or aliases\n");
+    printf("     --prescreen             Skip stars without a plausible transit\n");
+    printf("     --prescreen-threshold   Signal to noise needed to pass the pre-screen\n");
+    printf("     --prebin                Average samples within short time bins before searching\n");
+    printf("     --prebin-fraction       Length of the bins as a fraction of a light curve bucket\n");
+    printf("     --top                   Number of distinct candidate periods to report\n");
+    printf("     --tile-periods          Periods folded together by each thread\n");
+    printf("     --tile-samples          Samples folded for each period in turn, 0=all\n");
+    printf("     --stats                 Report the time of each stage as json\n");
+    printf("     --output                Report results as text (default), json or csv\n");
+    printf("     --no-plot               Search only, without plotting the light curve\n");
     printf(" -h  --help                  Show help\n");
     printf(" -v  --version               Show version number\n");
 }
 
 int main(int argc, char* argv[])
 {
-    int i, series_length;
-    float timestamp[MAX_SERIES_LENGTH];
-    float series[MAX_SERIES_LENGTH];
-    int endpoints[MAX_SERIES_LENGTH];
-    int no_of_sections;
+    int i, status;
     char log_filename[256];
-    char name[256], title[256];
+    char batch_path[256];
     float orbital_period_days;
-    int minimum_data_samples = 1000;
-    float minimum_period_days = 0;
-    float maximum_period_days = 0;
-    float known_period_days = 0;
-    char light_curve_filename[256];
-    char light_curve_distribution_filename[256];
-    int table_type = TABLE_TYPE_WASP;
-    int time_field_index=0, flux_field_index=3;
-    float vertical_scale = 1.0f;
+    scan_parameters params;
+    daemon_parameters daemon;
+    scan_series star;
 
     /* if no options given then show help */
     if (argc <= 1) {
@@ -61,6 +88,10 @@ int main(int argc, char* argv[])
 
     /* no filename specified */
     log_filename[0]=0;
+    batch_path[0]=0;
+
+    scan_parameters_init(&params);
+    daemon_parameters_init(&daemon);
 
     /* parse the options */
     for (i = 1; i < argc; i++) {
@@ -72,19 +103,115 @@ int main(int argc, char* argv[])
                 sprintf(log_filename,"%s",argv[i]);
             }
         }
+        /* search many log files */
+        if ((strcmp(argv[i],"-b")==0) ||
+            (strcmp(argv[i],"--batch")==0)) {
+            i++;
+            if (i < argc) {
+                sprintf(batch_path,"%s",argv[i]);
+            }
+        }
+        /* save the search from time to time so that it can be resumed */
+        if (strcmp(argv[i],"--checkpoint")==0) {
+            i++;
+            if (i < argc) {
+                snprintf(params.checkpoint,sizeof(params.checkpoint),
+                         "%s",argv[i]);
+            }
+        }
+        if (strcmp(argv[i],"--checkpoint-interval")==0) {
+            i++;
+            if (i < argc) {
+                params.checkpoint_seconds = atof(argv[i]);
+            }
+        }
+        /* search the stars listed in a download script */
+        if (strcmp(argv[i],"--daemon")==0) {
+            i++;
+            if (i < argc) {
+                snprintf(daemon.log,sizeof(daemon.log),"%s",argv[i]);
+            }
+        }
+        if (strcmp(argv[i],"--workdir")==0) {
+            i++;
+            if (i < argc) {
+                snprintf(daemon.working_dir,sizeof(daemon.working_dir),
+                         "%s",argv[i]);
+            }
+        }
+        if (strcmp(argv[i],"--fetchers")==0) {
+            i++;
+            if (i < argc) {
+                daemon.fetchers = atoi(argv[i]);
+            }
+        }
+        if (strcmp(argv[i],"--ahead")==0) {
+            i++;
+            if (i < argc) {
+                daemon.ahead = atoi(argv[i]);
+            }
+        }
+        if (strcmp(argv[i],"--mirror")==0) {
+            i++;
+            if (i < argc) {
+                snprintf(daemon.mirror,sizeof(daemon.mirror),"%s",argv[i]);
+            }
+        }
+        if (strcmp(argv[i],"--cursor")==0) {
+            i++;
+            if (i < argc) {
+                snprintf(daemon.cursor,sizeof(daemon.cursor),"%s",argv[i]);
+            }
+        }
+        if (strcmp(argv[i],"--start")==0) {
+            i++;
+            if (i < argc) {
+                daemon.start_percent = atof(argv[i]);
+            }
+        }
+        if (strcmp(argv[i],"--end")==0) {
+            i++;
+            if (i < argc) {
+                daemon.end_percent = atof(argv[i]);
+            }
+        }
+        if (strcmp(argv[i],"--claims")==0) {
+            i++;
+            if (i < argc) {
+                snprintf(daemon.claims,sizeof(daemon.claims),"%s",argv[i]);
+            }
+        }
+        if (strcmp(argv[i],"--node")==0) {
+            i++;
+            if (i < argc) {
+                snprintf(daemon.node,sizeof(daemon.node),"%s",argv[i]);
+            }
+        }
+        if (strcmp(argv[i],"--claim-size")==0) {
+            i++;
+            if (i < argc) {
+                daemon.claim_size = atoi(argv[i]);
+            }
+        }
+        if (strcmp(argv[i],"--lease")==0) {
+            i++;
+            if (i < argc) {
+                daemon.lease_seconds = atof(argv[i]);
+            }
+        }
         /* Minimum data samples */
         if ((strcmp(argv[i],"-m")==0) ||
             (strcmp(argv[i],"--minsamples")==0)) {
             i++;
             if (i < argc) {
-                minimum_data_samples = atoi(argv[i]);
+                params.minimum_data_samples = atoi(argv[i]);
             }
         }
         /* Minimum orbital period */
         if (strcmp(argv[i],"--vscale")==0) {
             i++;
             if (i < argc) {
-                vertical_scale = atof(argv[i]);
+                params.vertical_scale = atof(argv[i]);
             }
         }
         /* Minimum orbital period */
@@ -92,7 +219,7 @@ int main(int argc, char* argv[])
             (strcmp(argv[i],"--min")==0)) {
             i++;
             if (i < argc) {
-                minimum_period_days = atof(argv[i]);
+                params.minimum_period_days = atof(argv[i]);
             }
         }
         /* Maximum orbital period */
@@ -100,7 +227,34 @@ int main(int argc, char* argv[])
             (strcmp(argv[i],"--max")==0)) {
             i++;
             if (i < argc) {
-                maximum_period_days = atof(argv[i]);
+                params.maximum_period_days = atof(argv[i]);
+            }
+        }
+        /* Fixed increment between trial orbital periods */
+        if ((strcmp(argv[i],"-i")==0) ||
+            (strcmp(argv[i],"--increment")==0)) {
+            i++;
+            if (i < argc) {
+                params.increment_days = atof(argv[i]);
+            }
+        }
+        /* Oversampling of the adaptive period grid */
+        if ((strcmp(argv[i],"-o")==0) ||
+            (strcmp(argv[i],"--oversample")==0)) {
+            i++;
+            if (i < argc) {
+                params.oversample = atof(argv[i]);
+            }
+        }
+        /* Coarse to fine search */
+        if (strcmp(argv[i],"--hierarchical")==0) {
+            params.hierarchical = 1;
+        }
+        /* Number of peaks kept at each stage of the search */
+        if (strcmp(argv[i],"--candidates")==0) {
+            i++;
+            if (i < argc) {
+                params.max_candidates = atoi(argv[i]);
             }
         }
         /* Known orbital period */
@@ -108,7 +262,7 @@ int main(int argc, char* argv[])
             (strcmp(argv[i],"--period")==0)) {
             i++;
             if (i < argc) {
-                known_period_days = atof(argv[i]);
+                params.known_period_days = atof(argv[i]);
             }
         }
         /* table type */
@@ -118,11 +272,156 @@ int main(int argc, char* argv[])
             if (i < argc) {
                 if ((strcmp(argv[i],"wasp")==0) ||
                     (strcmp(argv[i],"WASP")==0)) {
-                    table_type = TABLE_TYPE_WASP;
+                    params.table_type = TABLE_TYPE_WASP;
                 }
                 if ((strcmp(argv[i],"k2")==0) ||
                     (strcmp(argv[i],"K2")==0)) {
-                    table_type = TABLE_TYPE_K2;
+                    params.table_type = TABLE_TYPE_K2;
+                }
+            }
+        }
+        /* program used to draw plots */
+        if (strcmp(argv[i],"--plotter")==0) {
+            i++;
+            if (i < argc) {
+                if (strcmp(argv[i],"gnuplot")==0) {
+                    params.plotter = PLOTTER_GNUPLOT;
+                }
+                else if (strcmp(argv[i],"native")==0) {
+                    params.plotter = PLOTTER_NATIVE;
+                }
+                else {
+                    printf("Unknown plotter %s\n", argv[i]);
+                    return -1;
+                }
+            }
+        }
+        /* method used to score trial periods */
+        if (strcmp(argv[i],"--method")==0) {
+            i++;
+            if (i < argc) {
+                if (strcmp(argv[i],"bls")==0) {
+                    params.method = DETECT_METHOD_BLS;
+                }
+                else if (strcmp(argv[i],"ls")==0) {
+                    params.method = DETECT_METHOD_LS;
+                }
+                else if (strcmp(argv[i],"heuristic")==0) {
+                    params.method = DETECT_METHOD_HEURISTIC;
+                }
+                else {
+                    printf("Unknown method %s\n", argv[i]);
+                    return -1;
+                }
+            }
+        }
+        /* number of distinct candidate periods reported */
+        if (strcmp(argv[i],"--top")==0) {
+            i++;
+            if (i < argc) {
+                params.max_results = atoi(argv[i]);
+            }
+        }
+        /* time spent on each stage and outcomes of trial periods */
+        if (strcmp(argv[i],"--stats")==0) {
+            i++;
+            if (i < argc) {
+                if (strcmp(argv[i],"json")==0) {
+                    params.stats = SCAN_STATS_JSON;
+                }
+                else {
+                    printf("Unknown statistics format %s\n", argv[i]);
+                    return -1;
+                }
+            }
+        }
+        /* machine readable results */
+        if (strcmp(argv[i],"--output")==0) {
+            i++;
+            if (i < argc) {
+                if (strcmp(argv[i],"json")==0) {
+                    params.output = SCAN_OUTPUT_JSON;
+                }
+                else if (strcmp(argv[i],"csv")==0) {
+                    params.output = SCAN_OUTPUT_CSV;
+                }
+                else if (strcmp(argv[i],"text")==0) {
+                    params.output = SCAN_OUTPUT_TEXT;
+                }
+                else {
+                    printf("Unknown output format %s\n", argv[i]);
+                    return -1;
+                }
+            }
+        }
+        /* don't plot, leaving that to a later run with a known period */
+        if (strcmp(argv[i],"--no-plot")==0) {
+            params.plot = 0;
+        }
+        /* periods folded together while their samples are in cache */
+        if (strcmp(argv[i],"--tile-periods")==0) {
+            i++;
+            if (i < argc) {
+                params.tile_periods = atoi(argv[i]);
+            }
+        }
+        if (strcmp(argv[i],"--tile-samples")==0) {
+            i++;
+            if (i < argc) {
+                params.tile_samples = atoi(argv[i]);
+            }
+        }
+        /* don't search periods dominated by variability or aliases */
+        if (strcmp(argv[i],"--ls-prescreen")==0) {
+            params.ls_prescreen = 1;
+        }
+        /* don't search stars without a plausible transit */
+        if (strcmp(argv[i],"--prescreen")==0) {
+            params.prescreen = 1;
+        }
+        if (strcmp(argv[i],"--prescreen-threshold")==0) {
+            i++;
+            if (i < argc) {
+                params.prescreen = 1;
+                params.prescreen_threshold = atof(argv[i]);
+            }
+        }
+        /* fold fewer, averaged samples */
+        if (strcmp(argv[i],"--prebin")==0) {
+            params.prebin = 1;
+        }
+        if (strcmp(argv[i],"--prebin-fraction")==0) {
+            i++;
+            if (i < argc) {
+                params.prebin = 1;
+                params.prebin_fraction = atof(argv[i]);
+            }
+        }
+        /* binary cache of the loaded table */
+        if (strcmp(argv[i],"--cache")==0) {
+            params.use_cache = 1;
+        }
+        /* columns loaded from the table */
+        if (strcmp(argv[i],"--weights")==0) {
+            params.weighted = 1;
+        }
+        if (strcmp(argv[i],"--raw-flux")==0) {
+            params.raw_flux = 1;
+        }
+        if (strcmp(argv[i],"--keep-flagged")==0) {
+            params.keep_flagged = 1;
+        }
+        /* table within a fits file */
+        if ((strcmp(argv[i],"-l")==0) ||
+            (strcmp(argv[i],"--list")==0)) {
+            i++;
+            if (i < argc) {
+                if ((argv[i][0] >= '0') && (argv[i][0] <= '9')) {
+                    params.table_index = atoi(argv[i]);
+                }
+                else {
+                    snprintf(params.table_name, sizeof(params.table_name),
+                         "%s", argv[i]);
                 }
             }
         }
@@ -140,98 +439,62 @@ int main(int argc, char* argv[])
         }
     }
 
-    if (log_filename[0]==0) {
+    if ((log_filename[0]==0) && (batch_path[0]==0) && (daemon.log[0]==0)) {
         printf("No log file specified\n");
         return -1;
     }
 
-    if (known_period_days == 0) {
-        if (maximum_period_days == 0) {
+    if (params.known_period_days == 0) {
+        if (params.maximum_period_days == 0) {
             printf("No maximum orbital period specified\n");
             return -2;
         }
 
-        if (maximum_period_days <= minimum_period_days) {
+        if (params.maximum_period_days <= params.minimum_period_days) {
             printf("Maximum orbital period must be greater ");
             printf("than the minimum orbital period\n");
             return -3;
         }
     }
 
-    /* get the name of the scan from the log filename */
-    scan_name(log_filename, name);
-
-    /* change the table columns based upon the format type */
-    switch(table_type) {
-    case TABLE_TYPE_WASP: {
-        time_field_index=0;
-        flux_field_index=3;
-        break;
-    }
-    case TABLE_TYPE_K2: {
-        time_field_index=0;
-        flux_field_index=2;
-        break;
+    scan_report_header(&params);
+    if (batch_path[0] != 0) {
+        return batch_run(&params, batch_path);
     }
+    if (daemon.log[0] != 0) {
+        return daemon_run(&params, &daemon);
     }
 
     /* read the data */
-    series_length = logfile_load(log_filename,
-                                 timestamp,
-                                 series,
-                                 MAX_SERIES_LENGTH,
-                                 time_field_index, flux_field_index);
-    if (series_length < minimum_data_samples) {
-        printf("Number of data samples too small: %d\n", series_length);
+    memset(&star, 0, sizeof(scan_series));
+    if (scan_load(&params, log_filename, &star) <
+        params.minimum_data_samples) {
+        if (params.output == SCAN_OUTPUT_TEXT) {
+            printf("Number of data samples too small: %d\n", star.length);
+        }
+        scan_report(&params, &star, 1);
+        scan_stats_report(&params, &star);
+        scan_series_free(&star);
         return 1;
     }
-    printf("%d values loaded\n", series_length);
-
-    no_of_sections = detect_endpoints(timestamp, series_length,
-                                      endpoints);
-    if (no_of_sections == 0) {
-        printf("No sections detected in the time series\n");
-        return 2;
+    if (params.output == SCAN_OUTPUT_TEXT) {
+        printf("%d values loaded\n", star.length);
     }
 
-    /*orbital_period_days = 1.3382282f;*/
-
-    if (known_period_days == 0) {
-        orbital_period_days =
-            detect_orbital_period(timestamp,
-                                  series, series_length,
-                                  minimum_period_days,
-                                  maximum_period_days,
-                                  SEARCH_INCREMENT_DAYS);
-        if (orbital_period_days == 0) {
-            printf("No transits detected\n");
-            return -5;
-        }
-        printf("orbital_period_days %.6f\n",orbital_period_days);
-    }
-    else {
-        orbital_period_days = known_period_days;
+    status = scan_search(&params, &star, &orbital_period_days);
+    if (status != 0) {
+        scan_report(&params, &star, status);
+        scan_stats_report(&params, &star);
+        scan_series_free(&star);
+        return status;
     }
 
-    sprintf(light_curve_filename,"%s.png",name);
-    sprintf(light_curve_distribution_filename,"%s_distr.png",name);
-    sprintf(title,"SuperWASP Light Curve for %s",name);
-    gnuplot_light_curve_distribution(title,
-                                     timestamp, series, series_length,
-                                     light_curve_distribution_filename,
-                                     1024, 640,
-                                     0.44,0.93,
-                                     "TAMUZ corrected processed flux (micro Vega)",
-                                     orbital_period_days,
-                                     vertical_scale);
-    gnuplot_light_curve(title,
-                        timestamp, series, series_length,
-                        light_curve_filename,
-                        1024, 640,
-                        0.44,0.93,
-                        "TAMUZ corrected processed flux (micro Vega)",
-                        orbital_period_days,
-                        vertical_scale);
+    if (params.plot != 0) {
+        scan_plot(&params, &star, orbital_period_days);
+    }
+    scan_report(&params, &star, status);
+    scan_stats_report(&params, &star);
 
+    scan_series_free(&star);
     return 0;
 }
@@ -0,0 +1,299 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Lomb-Scargle periodogram using the method of Press & Rybicki (1989).
+   Samples are extirpolated onto a regular grid, so that the sums of
+   sines and cosines at every frequency come from a handful of FFTs
+   rather than a pass over the samples per frequency. */
+
+#include "waspscan.h"
+
+/* number of grid points which each sample is extirpolated onto */
+#define PERIODOGRAM_EXTIRPOLATION 4
+
+/**
+ * @brief Adds a value to a regular grid at a fractional position,
+ *        spread over the nearest grid points with Lagrange weights
+ * @param value The value to be added
+ * @param grid The grid, which wraps around
+ * @param grid_length The number of points within the grid
+ * @param position Fractional position within the grid
+ */
+static void periodogram_spread(float value, float grid[], int grid_length,
+                               double position)
+{
+    int i, j, first, index = (int)position;
+    double weight;
+
+    if (position == (double)index) {
+        grid[index % grid_length] += value;
+        return;
+    }
+
+    first = (int)floor(position - (PERIODOGRAM_EXTIRPOLATION*0.5) + 1);
+    for (i = 0; i < PERIODOGRAM_EXTIRPOLATION; i++) {
+        weight = 1;
+        for (j = 0; j < PERIODOGRAM_EXTIRPOLATION; j++) {
+            if (j != i) {
+                weight *= (position - (first + j)) / (double)(i - j);
+            }
+        }
+        index = ((first + i) % grid_length + grid_length) % grid_length;
+        grid[index] += (float)(value*weight);
+    }
+}
+
+/**
+ * @brief Marks frequencies close to those where the light curve is
+ *        dominated by a single sinusoid, or where the sampling has
+ *        a strong alias
+ * @param pg The periodogram
+ * @param oversample Number of frequencies per resolution element
+ * @param baseline_days Time between the first and last samples
+ */
+static void periodogram_mark(periodogram * pg, float oversample,
+                             double baseline_days)
+{
+    int i, j, width = (int)ceil(oversample);
+    int first_alias = (int)ceil(2.0 / (baseline_days*pg->freq_increment));
+    float fraction;
+
+    memset(pg->masked, 0, pg->length);
+    for (i = 1; i < pg->length; i++) {
+        /* fraction of the variance explained by a sinusoid */
+        fraction = pg->power[i]*2 / pg->samples;
+        if ((fraction < PERIODOGRAM_VARIABILITY) &&
+            ((i < first_alias) || (pg->window[i] < PERIODOGRAM_ALIAS))) {
+            continue;
+        }
+        for (j = i - width; j <= i + width; j++) {
+            if ((j >= 0) && (j < pg->length)) pg->masked[j] = 1;
+        }
+    }
+}
+
+/**
+ * @brief Calculates the Lomb-Scargle periodogram of a light curve
+ *        from zero frequency up to that of the shortest period
+ * @param pg The periodogram to be calculated
+ * @param timestamp Array of imaging times in seconds
+ * @param series Array containing magnitudes
+ * @param series_length The length of the data series
+ * @param min_period_days The shortest orbital period of interest
+ * @param oversample Number of frequencies per resolution element,
+ *        which is the reciprocal of the baseline
+ * @returns zero on success
+ */
+int periodogram_init(periodogram * pg,
+                     double timestamp[], float series[], int series_length,
+                     float min_period_days, float oversample)
+{
+    double origin, days, baseline_days = 0, scale;
+    double mean = 0, variance = 0;
+    double hypotenuse, cos2, sin2, cos_weight, sin_weight, denominator;
+    double cos_sum, sin_sum, cos_term, sin_term;
+    float * data, * once, * twice, * spectrum, * spectrum2;
+    int i, grid_length = 64;
+
+    memset(pg, 0, sizeof(periodogram));
+    if ((series_length < 2) || (min_period_days <= 0) || (oversample <= 0)) {
+        return -1;
+    }
+
+    origin = fold_time_origin(timestamp, series_length);
+    for (i = 0; i < series_length; i++) {
+        days = (timestamp[i] - origin) / (60.0*60.0*24.0);
+        if (days > baseline_days) baseline_days = days;
+        mean += series[i];
+    }
+    if (baseline_days <= 0) return -1;
+    mean /= series_length;
+    for (i = 0; i < series_length; i++) {
+        variance += (series[i] - mean)*(series[i] - mean);
+    }
+    variance /= (series_length - 1);
+    if (variance <= 0) return -1;
+
+    pg->samples = series_length;
+    pg->freq_increment = 1.0 / (baseline_days*oversample);
+    pg->length = (int)(1.0 / (min_period_days*pg->freq_increment)) + 2;
+
+    /* twice the highest frequency must be below the nyquist
+       frequency of the grid, with room for the extirpolation */
+    while (grid_length < pg->length*PERIODOGRAM_EXTIRPOLATION*4) {
+        grid_length <<= 1;
+    }
+
+    data = (float*)calloc(grid_length, sizeof(float));
+    once = (float*)calloc(grid_length, sizeof(float));
+    twice = (float*)calloc(grid_length, sizeof(float));
+    spectrum = (float*)malloc(grid_length*2*sizeof(float));
+    spectrum2 = (float*)malloc(grid_length*2*sizeof(float));
+    pg->power = (float*)calloc(pg->length, sizeof(float));
+    pg->window = (float*)calloc(pg->length, sizeof(float));
+    pg->masked = (unsigned char*)calloc(pg->length, sizeof(unsigned char));
+    if ((data == NULL) || (once == NULL) || (twice == NULL) ||
+        (spectrum == NULL) || (spectrum2 == NULL) ||
+        (pg->power == NULL) || (pg->window == NULL) ||
+        (pg->masked == NULL)) {
+        free(data);
+        free(once);
+        free(twice);
+        free(spectrum);
+        free(spectrum2);
+        periodogram_free(pg);
+        return -2;
+    }
+
+    /* one turn of the grid is one cycle at the frequency increment */
+    scale = grid_length*pg->freq_increment;
+    for (i = 0; i < series_length; i++) {
+        days = (timestamp[i] - origin) / (60.0*60.0*24.0);
+        periodogram_spread((float)(series[i] - mean), data, grid_length,
+                           fmod(days*scale, grid_length));
+        periodogram_spread(1, once, grid_length,
+                           fmod(days*scale, grid_length));
+        periodogram_spread(1, twice, grid_length,
+                           fmod(2*days*scale, grid_length));
+    }
+
+    /* the forward transform gives sums of cosines and negated sines */
+    fft1D(data, grid_length, spectrum);
+    fft1D(twice, grid_length, spectrum2);
+    for (i = 1; i < pg->length; i++) {
+        cos2 = spectrum2[i*2];
+        sin2 = -spectrum2[i*2+1];
+        hypotenuse = sqrt(cos2*cos2 + sin2*sin2);
+        if (hypotenuse <= 0) continue;
+
+        /* rotate by the time offset which makes the sine and
+           cosine terms orthogonal */
+        cos_weight = sqrt(0.5 + (0.5*cos2/hypotenuse));
+        sin_weight = sqrt(0.5 - (0.5*cos2/hypotenuse));
+        if (sin2 < 0) sin_weight = -sin_weight;
+        denominator = (0.5*series_length) + (0.5*hypotenuse);
+
+        cos_sum = spectrum[i*2];
+        sin_sum = -spectrum[i*2+1];
+        cos_term = cos_weight*cos_sum + sin_weight*sin_sum;
+        sin_term = cos_weight*sin_sum - sin_weight*cos_sum;
+        pg->power[i] =
+            (float)(((cos_term*cos_term/denominator) +
+                     (sin_term*sin_term/(series_length - denominator))) /
+                    (2*variance));
+    }
+
+    fft1D(once, grid_length, spectrum);
+    for (i = 1; i < pg->length; i++) {
+        pg->window[i] =
+            (spectrum[i*2]*spectrum[i*2] +
+             spectrum[i*2+1]*spectrum[i*2+1]) /
+            ((float)series_length*series_length);
+    }
+
+    periodogram_mark(pg, oversample, baseline_days);
+
+    free(data);
+    free(once);
+    free(twice);
+    free(spectrum);
+    free(spectrum2);
+    return 0;
+}
+
+/**
+ * @brief Frees memory allocated by periodogram_init
+ * @param pg The periodogram to be freed
+ */
+void periodogram_free(periodogram * pg)
+{
+    free(pg->power);
+    free(pg->window);
+    free(pg->masked);
+    pg->power = NULL;
+    pg->window = NULL;
+    pg->masked = NULL;
+    pg->length = 0;
+}
+
+/**
+ * @brief Returns the period with the most Lomb-Scargle power
+ * @param pg The periodogram
+ * @param min_period_days The minimum orbital period in days
+ * @param max_period_days The maximum orbital period in days
+ * @param power Returned normalised power of the period
+ * @returns The period in days, or zero if there is none in range
+ */
+float periodogram_best_period(periodogram * pg,
+                              float min_period_days, float max_period_days,
+                              float * power)
+{
+    int i, best = 0;
+    int first = (int)ceil(1.0 / (max_period_days*pg->freq_increment));
+    int last = (int)(1.0 / (min_period_days*pg->freq_increment));
+
+    *power = 0;
+    if (first < 1) first = 1;
+    if (last >= pg->length) last = pg->length - 1;
+    for (i = first; i <= last; i++) {
+        if (pg->power[i] > *power) {
+            *power = pg->power[i];
+            best = i;
+        }
+    }
+    if (best == 0) return 0;
+    return (float)(1.0 / (best*pg->freq_increment));
+}
+
+/**
+ * @brief Returns whether a frequency is dominated by variability
+ *        of the star or by aliasing of the sampling
+ * @param pg The periodogram, or NULL if nothing is masked
+ * @param freq Frequency in cycles per day
+ * @returns Non-zero if the frequency should not be searched
+ */
+int periodogram_masked(periodogram * pg, double freq)
+{
+    int i;
+
+    if (pg == NULL) return 0;
+    i = (int)(freq / pg->freq_increment + 0.5);
+    if ((i < 0) || (i >= pg->length)) return 0;
+    return pg->masked[i];
+}
+
+/**
+ * @brief Removes masked orbital periods from a search grid
+ * @param pg The periodogram
+ * @param periods Grid of orbital periods, which is compacted in place
+ * @param no_of_periods The number of orbital periods within the grid
+ * @returns The number of orbital periods remaining
+ */
+int periodogram_mask_periods(periodogram * pg,
+                             float periods[], int no_of_periods)
+{
+    int i, remaining = 0;
+
+    for (i = 0; i < no_of_periods; i++) {
+        if (!periodogram_masked(pg, 1.0 / periods[i])) {
+            periods[remaining++] = periods[i];
+        }
+    }
+    return remaining;
+}
@@ -0,0 +1,513 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "waspscan.h"
+
+#define LIGHT_CURVE_LENGTH 256
+
+/* palette indexes */
+#define PLOT_BACKGROUND 0
+#define PLOT_FOREGROUND 1
+#define PLOT_GRID       2
+#define PLOT_DATA       3
+
+/* size of each character within the font */
+#define PLOT_FONT_WIDTH  5
+#define PLOT_FONT_HEIGHT 7
+
+static unsigned char plot_palette[4][3] = {
+    {255, 255, 255}, {0, 0, 0}, {160, 160, 160}, {148, 0, 211}
+};
+
+/* 5x7 font for characters 32-126. Each byte is a column of
+   the character, with the least significant bit at the top */
+static const unsigned char plot_font[95][PLOT_FONT_WIDTH] = {
+    {0x00,0x00,0x00,0x00,0x00}, {0x00,0x00,0x5f,0x00,0x00},
+    {0x00,0x07,0x00,0x07,0x00}, {0x14,0x7f,0x14,0x7f,0x14},
+    {0x24,0x2a,0x7f,0x2a,0x12}, {0x23,0x13,0x08,0x64,0x62},
+    {0x36,0x49,0x55,0x22,0x50}, {0x00,0x05,0x03,0x00,0x00},
+    {0x00,0x1c,0x22,0x41,0x00}, {0x00,0x41,0x22,0x1c,0x00},
+    {0x08,0x2a,0x1c,0x2a,0x08}, {0x08,0x08,0x3e,0x08,0x08},
+    {0x00,0x50,0x30,0x00,0x00}, {0x08,0x08,0x08,0x08,0x08},
+    {0x00,0x60,0x60,0x00,0x00}, {0x20,0x10,0x08,0x04,0x02},
+    {0x3e,0x51,0x49,0x45,0x3e}, {0x00,0x42,0x7f,0x40,0x00},
+    {0x42,0x61,0x51,0x49,0x46}, {0x21,0x41,0x45,0x4b,0x31},
+    {0x18,0x14,0x12,0x7f,0x10}, {0x27,0x45,0x45,0x45,0x39},
+    {0x3c,0x4a,0x49,0x49,0x30}, {0x01,0x71,0x09,0x05,0x03},
+    {0x36,0x49,0x49,0x49,0x36}, {0x06,0x49,0x49,0x29,0x1e},
+    {0x00,0x36,0x36,0x00,0x00}, {0x00,0x56,0x36,0x00,0x00},
+    {0x08,0x14,0x22,0x41,0x00}, {0x14,0x14,0x14,0x14,0x14},
+    {0x00,0x41,0x22,0x14,0x08}, {0x02,0x01,0x51,0x09,0x06},
+    {0x32,0x49,0x79,0x41,0x3e}, {0x7e,0x11,0x11,0x11,0x7e},
+    {0x7f,0x49,0x49,0x49,0x36}, {0x3e,0x41,0x41,0x41,0x22},
+    {0x7f,0x41,0x41,0x22,0x1c}, {0x7f,0x49,0x49,0x49,0x41},
+    {0x7f,0x09,0x09,0x01,0x01}, {0x3e,0x41,0x41,0x51,0x32},
+    {0x7f,0x08,0x08,0x08,0x7f}, {0x00,0x41,0x7f,0x41,0x00},
+    {0x20,0x40,0x41,0x3f,0x01}, {0x7f,0x08,0x14,0x22,0x41},
+    {0x7f,0x40,0x40,0x40,0x40}, {0x7f,0x02,0x04,0x02,0x7f},
+    {0x7f,0x04,0x08,0x10,0x7f}, {0x3e,0x41,0x41,0x41,0x3e},
+    {0x7f,0x09,0x09,0x09,0x06}, {0x3e,0x41,0x51,0x21,0x5e},
+    {0x7f,0x09,0x19,0x29,0x46}, {0x46,0x49,0x49,0x49,0x31},
+    {0x01,0x01,0x7f,0x01,0x01}, {0x3f,0x40,0x40,0x40,0x3f},
+    {0x1f,0x20,0x40,0x20,0x1f}, {0x7f,0x20,0x18,0x20,0x7f},
+    {0x63,0x14,0x08,0x14,0x63}, {0x03,0x04,0x78,0x04,0x03},
+    {0x61,0x51,0x49,0x45,0x43}, {0x00,0x7f,0x41,0x41,0x00},
+    {0x02,0x04,0x08,0x10,0x20}, {0x00,0x41,0x41,0x7f,0x00},
+    {0x04,0x02,0x01,0x02,0x04}, {0x40,0x40,0x40,0x40,0x40},
+    {0x00,0x01,0x02,0x04,0x00}, {0x20,0x54,0x54,0x54,0x78},
+    {0x7f,0x48,0x44,0x44,0x38}, {0x38,0x44,0x44,0x44,0x20},
+    {0x38,0x44,0x44,0x48,0x7f}, {0x38,0x54,0x54,0x54,0x18},
+    {0x08,0x7e,0x09,0x01,0x02}, {0x0c,0x52,0x52,0x52,0x3e},
+    {0x7f,0x08,0x04,0x04,0x78}, {0x00,0x44,0x7d,0x40,0x00},
+    {0x20,0x40,0x44,0x3d,0x00}, {0x7f,0x10,0x28,0x44,0x00},
+    {0x00,0x41,0x7f,0x40,0x00}, {0x7c,0x04,0x18,0x04,0x78},
+    {0x7c,0x08,0x04,0x04,0x78}, {0x38,0x44,0x44,0x44,0x38},
+    {0x7c,0x14,0x14,0x14,0x08}, {0x08,0x14,0x14,0x18,0x7c},
+    {0x7c,0x08,0x04,0x04,0x08}, {0x48,0x54,0x54,0x54,0x20},
+    {0x04,0x3f,0x44,0x40,0x20}, {0x3c,0x40,0x40,0x20,0x7c},
+    {0x1c,0x20,0x40,0x20,0x1c}, {0x3c,0x40,0x30,0x40,0x3c},
+    {0x44,0x28,0x10,0x28,0x44}, {0x0c,0x50,0x50,0x50,0x3c},
+    {0x44,0x64,0x54,0x4c,0x44}, {0x00,0x08,0x36,0x41,0x00},
+    {0x00,0x00,0x7f,0x00,0x00}, {0x00,0x41,0x36,0x08,0x00},
+    {0x08,0x04,0x08,0x10,0x08}
+};
+
+/* an image being drawn, with one palette index per pixel */
+typedef struct {
+    int width, height;
+    unsigned char * pixels;
+    int clip_left, clip_top, clip_right, clip_bottom;
+    int scale;                /* font magnification */
+} plot_canvas;
+
+/**
+ * @brief Sets a pixel, if it is within the clipping rectangle
+ * @param canvas The image
+ * @param x X coordinate
+ * @param y Y coordinate
+ * @param colour Palette index
+ */
+static void plot_pixel(plot_canvas * canvas, int x, int y, int colour)
+{
+    if ((x < canvas->clip_left) || (x > canvas->clip_right) ||
+        (y < canvas->clip_top) || (y > canvas->clip_bottom)) {
+        return;
+    }
+    canvas->pixels[y*canvas->width + x] = (unsigned char)colour;
+}
+
+/**
+ * @brief Draws a line
+ * @param canvas The image
+ * @param x0 Start X coordinate
+ * @param y0 Start Y coordinate
+ * @param x1 End X coordinate
+ * @param y1 End Y coordinate
+ * @param colour Palette index
+ * @param dotted If non-zero only every third pixel is drawn
+ */
+static void plot_line(plot_canvas * canvas,
+                      int x0, int y0, int x1, int y1,
+                      int colour, int dotted)
+{
+    int dx = abs(x1 - x0), dy = -abs(y1 - y0);
+    int sx = (x0 < x1) ? 1 : -1, sy = (y0 < y1) ? 1 : -1;
+    int error = dx + dy, e2, step = 0;
+
+    while (1) {
+        if ((dotted == 0) || (step % 3 == 0)) {
+            plot_pixel(canvas, x0, y0, colour);
+        }
+        if ((x0 == x1) && (y0 == y1)) break;
+        e2 = 2*error;
+        if (e2 >= dy) {
+            error += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx) {
+            error += dx;
+            y0 += sy;
+        }
+        step++;
+    }
+}
+
+/**
+ * @brief Returns the width of some text in pixels
+ * @param canvas The image
+ * @param text The text
+ * @returns Width in pixels
+ */
+static int plot_text_width(plot_canvas * canvas, char * text)
+{
+    int len = strlen(text);
+
+    if (len == 0) return 0;
+    return ((len * (PLOT_FONT_WIDTH + 1)) - 1) * canvas->scale;
+}
+
+/**
+ * @brief Draws text
+ * @param canvas The image
+ * @param x X coordinate of the top left of the text, or the bottom
+ *        left if the text is vertical
+ * @param y Y coordinate of the top left of the text, or the bottom
+ *        left if the text is vertical
+ * @param text The text
+ * @param colour Palette index
+ * @param vertical If non-zero the text reads upwards
+ */
+static void plot_text(plot_canvas * canvas, int x, int y,
+                      char * text, int colour, int vertical)
+{
+    int i, col, row, px, py, sx, sy, c, s = canvas->scale;
+    int advance = 0;
+
+    for (i = 0; text[i] != 0; i++, advance += (PLOT_FONT_WIDTH + 1)*s) {
+        c = (unsigned char)text[i];
+        if ((c < 32) || (c > 126)) c = '?';
+        for (col = 0; col < PLOT_FONT_WIDTH; col++) {
+            for (row = 0; row < PLOT_FONT_HEIGHT; row++) {
+                if (((plot_font[c - 32][col] >> row) & 1) == 0) continue;
+                for (sy = 0; sy < s; sy++) {
+                    for (sx = 0; sx < s; sx++) {
+                        if (vertical == 0) {
+                            px = x + advance + col*s + sx;
+                            py = y + row*s + sy;
+                        }
+                        else {
+                            px = x + row*s + sy;
+                            py = y - advance - col*s - sx;
+                        }
+                        plot_pixel(canvas, px, py, colour);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Returns a round number spacing between axis ticks
+ * @param range Range of values along the axis
+ * @param max_ticks The maximum number of ticks
+ * @returns Spacing between ticks
+ */
+static double plot_tick_step(double range, int max_ticks)
+{
+    double step, magnitude, f;
+
+    if (max_ticks < 1) max_ticks = 1;
+    step = range / max_ticks;
+    magnitude = pow(10.0, floor(log10(step)));
+    f = step / magnitude;
+    if (f <= 1) f = 1;
+    else if (f <= 2) f = 2;
+    else if (f <= 5) f = 5;
+    else f = 10;
+    return f * magnitude;
+}
+
+/**
+ * @brief Draws a graph and saves it as a png image. This has the same
+ *        layout as the gnuplot script created by gnuplot_create_script.
+ * @param title Title of the plot
+ * @param subtitle Subtitle of the plot
+ * @param subtitle_indent_horizontal X coordinate of the subtitle (0.0-1.0)
+ * @param subtitle_indent_vertical Y coordinate of the subtitle (0.0-1.0)
+ * @param x Horizontal values
+ * @param y Vertical values
+ * @param length Number of values
+ * @param min_x The minimum horizontal value
+ * @param max_x The maximum horizontal value
+ * @param min_y The minimum vertical value
+ * @param max_y The maximum vertical value
+ * @param x_label Label for the horizontal axis
+ * @param y_label Label for the vertical axis
+ * @param image_filename Filename to save the plot as
+ * @param image_width Width of the image to be saved
+ * @param image_height Height of the image to be saved
+ * @param plot_points Whether to plot individual samples rather than lines
+ * @returns zero on success
+ */
+static int plot_graph(char * title, char * subtitle,
+                      float subtitle_indent_horizontal,
+                      float subtitle_indent_vertical,
+                      float x[], float y[], int length,
+                      float min_x, float max_x,
+                      float min_y, float max_y,
+                      char * x_label, char * y_label,
+                      char * image_filename,
+                      int image_width, int image_height,
+                      int plot_points)
+{
+    plot_canvas canvas;
+    int left, right, top, bottom, char_width, char_height;
+    int i, px, py, prev_x = 0, prev_y = 0, prev_valid = 0, retval;
+    double step, v;
+    char label[32];
+
+    if ((image_width < 64) || (image_height < 64) ||
+        (max_x <= min_x) || (max_y <= min_y)) {
+        return -1;
+    }
+
+    canvas.width = image_width;
+    canvas.height = image_height;
+    canvas.pixels = (unsigned char*)malloc(image_width*image_height);
+    if (canvas.pixels == NULL) return -2;
+    memset(canvas.pixels, PLOT_BACKGROUND, image_width*image_height);
+    canvas.clip_left = 0;
+    canvas.clip_top = 0;
+    canvas.clip_right = image_width - 1;
+    canvas.clip_bottom = image_height - 1;
+    canvas.scale = (image_height >= 400) ? 2 : 1;
+    char_width = (PLOT_FONT_WIDTH + 1) * canvas.scale;
+    char_height = (PLOT_FONT_HEIGHT + 1) * canvas.scale;
+
+    /* the plot area, leaving room for titles and labels */
+    left = char_height*2 + char_width*9;
+    right = image_width - 1 - char_width*2;
+    top = char_height*4;
+    bottom = image_height - 1 - char_height*4;
+
+    plot_text(&canvas,
+              (image_width - plot_text_width(&canvas, title))/2,
+              char_height, title, PLOT_FOREGROUND, 0);
+    if (strlen(subtitle) > 0) {
+        plot_text(&canvas,
+                  (int)(subtitle_indent_horizontal*image_width),
+                  (int)((1.0f - subtitle_indent_vertical)*image_height) -
+                  (char_height/2),
+                  subtitle, PLOT_FOREGROUND, 0);
+    }
+    plot_text(&canvas,
+              left + (right - left - plot_text_width(&canvas, x_label))/2,
+              bottom + char_height*2 + char_height/2,
+              x_label, PLOT_FOREGROUND, 0);
+    plot_text(&canvas, char_height/2,
+              top + (bottom - top + plot_text_width(&canvas, y_label))/2,
+              y_label, PLOT_FOREGROUND, 1);
+
+    /* horizontal axis grid, ticks and labels */
+    step = plot_tick_step(max_x - min_x, (right - left)/(char_width*10));
+    for (v = ceil(min_x/step)*step; v <= max_x + step*0.0001; v += step) {
+        if (fabs(v) < step*0.0001) v = 0;
+        px = left + (int)((v - min_x)*(right - left)/(max_x - min_x) + 0.5);
+        plot_line(&canvas, px, top, px, bottom, PLOT_GRID, 1);
+        plot_line(&canvas, px, bottom, px, bottom - char_width,
+                  PLOT_FOREGROUND, 0);
+        plot_line(&canvas, px, top, px, top + char_width,
+                  PLOT_FOREGROUND, 0);
+        sprintf(label, "%g", v);
+        plot_text(&canvas, px - plot_text_width(&canvas, label)/2,
+                  bottom + char_height/2, label, PLOT_FOREGROUND, 0);
+    }
+
+    /* vertical axis grid, ticks and labels */
+    step = plot_tick_step(max_y - min_y, (bottom - top)/(char_height*3));
+    for (v = ceil(min_y/step)*step; v <= max_y + step*0.0001; v += step) {
+        if (fabs(v) < step*0.0001) v = 0;
+        py = bottom - (int)((v - min_y)*(bottom - top)/(max_y - min_y) + 0.5);
+        plot_line(&canvas, left, py, right, py, PLOT_GRID, 1);
+        plot_line(&canvas, left, py, left + char_width, py,
+                  PLOT_FOREGROUND, 0);
+        plot_line(&canvas, right, py, right - char_width, py,
+                  PLOT_FOREGROUND, 0);
+        sprintf(label, "%g", v);
+        plot_text(&canvas,
+                  left - char_width/2 - plot_text_width(&canvas, label),
+                  py - char_height/2, label, PLOT_FOREGROUND, 0);
+    }
+
+    /* the data is clipped to the plot area */
+    canvas.clip_left = left;
+    canvas.clip_top = top;
+    canvas.clip_right = right;
+    canvas.clip_bottom = bottom;
+    for (i = 0; i < length; i++) {
+        if (isnan(x[i]) || isnan(y[i])) {
+            prev_valid = 0;
+            continue;
+        }
+        px = left + (int)((x[i] - min_x)*(right - left)/(max_x - min_x));
+        py = bottom - (int)((y[i] - min_y)*(bottom - top)/(max_y - min_y));
+        /* avoid overflow when drawing lines to distant points */
+        if (px < -image_width) px = -image_width;
+        if (px > image_width*2) px = image_width*2;
+        if (py < -image_height) py = -image_height;
+        if (py > image_height*2) py = image_height*2;
+        if (plot_points != 0) {
+            plot_line(&canvas, px - 2, py, px + 2, py, PLOT_DATA, 0);
+            plot_line(&canvas, px, py - 2, px, py + 2, PLOT_DATA, 0);
+        }
+        else if (prev_valid != 0) {
+            plot_line(&canvas, prev_x, prev_y, px, py, PLOT_DATA, 0);
+        }
+        prev_x = px;
+        prev_y = py;
+        prev_valid = 1;
+    }
+
+    /* border */
+    canvas.clip_left = 0;
+    canvas.clip_top = 0;
+    canvas.clip_right = image_width - 1;
+    canvas.clip_bottom = image_height - 1;
+    plot_line(&canvas, left, top, right, top, PLOT_FOREGROUND, 0);
+    plot_line(&canvas, left, bottom, right, bottom, PLOT_FOREGROUND, 0);
+    plot_line(&canvas, left, top, left, bottom, PLOT_FOREGROUND, 0);
+    plot_line(&canvas, right, top, right, bottom, PLOT_FOREGROUND, 0);
+
+    retval = png_write(image_filename, canvas.pixels,
+                       image_width, image_height, plot_palette, 4);
+    free(canvas.pixels);
+    return retval;
+}
+
+/**
+* @brief Plots a light curve
+* @param title Title for the plot
+* @param timestamp Array containing times for each entry
+* @param series Array containing values for each entry
+* @param series_length Length of the Array
+* @param image_filename Filename for the image to save as
+* @param image_width Width of the image to be saved
+* @param image_height Height of the image to be saved
+* @param subtitle_indent_horizontal X coordinate of the subtitle (0.0-1.0)
+* @param subtitle_indent_vertical Y coordinate of the subtitle (0.0-1.0)
+* @param axis_label Label for the vertical axis
+* @param period_days Orbital period in days
+* @param vertical_scale Vertical scaling factor
+* @returns zero on success
+*/
+int plot_light_curve(char * title,
+                     double timestamp[],
+                     float series[], int series_length,
+                     char * image_filename,
+                     int image_width, int image_height,
+                     float subtitle_indent_horizontal,
+                     float subtitle_indent_vertical,
+                     char * axis_label,
+                     float period_days,
+                     float vertical_scale)
+{
+    char subtitle[256];
+    float mean, variance;
+    float curve[LIGHT_CURVE_LENGTH];
+    float density[LIGHT_CURVE_LENGTH];
+    float phase[LIGHT_CURVE_LENGTH];
+    int i, offset;
+
+    if (series_length < 2) return -2;
+
+    sprintf(subtitle,"Orbital Period %.5f days",period_days);
+
+    for (i = 0; i < LIGHT_CURVE_LENGTH; i++) {
+        phase[i] = (i*360.0f/LIGHT_CURVE_LENGTH)-180.0f;
+    }
+
+    light_curve(timestamp, series, series_length,
+                period_days, curve, density, LIGHT_CURVE_LENGTH);
+
+    offset = detect_phase_offset(curve, LIGHT_CURVE_LENGTH);
+    adjust_curve(curve, LIGHT_CURVE_LENGTH, offset);
+
+    mean = detect_mean(curve, LIGHT_CURVE_LENGTH);
+    variance = detect_variance(curve, LIGHT_CURVE_LENGTH, mean);
+
+    return plot_graph(title, subtitle,
+                      subtitle_indent_horizontal,
+                      subtitle_indent_vertical,
+                      phase, curve, LIGHT_CURVE_LENGTH,
+                      -180, 180,
+                      mean - (variance*8*vertical_scale),
+                      mean + (variance*8*vertical_scale),
+                      "Phase", axis_label,
+                      image_filename, image_width, image_height, 0);
+}
+
+/**
+* @brief Plots a light curve as a distribution of samples
+* @param title Title for the plot
+* @param timestamp Array containing times for each entry
+* @param series Array containing values for each entry
+* @param series_length Length of the Array
+* @param image_filename Filename for the image to save as
+* @param image_width Width of the image to be saved
+* @param image_height Height of the image to be saved
+* @param subtitle_indent_horizontal X coordinate of the subtitle (0.0-1.0)
+* @param subtitle_indent_vertical Y coordinate of the subtitle (0.0-1.0)
+* @param axis_label Label for the vertical axis
+* @param period_days Orbital period in days
+* @param vertical_scale Vertical scaling factor
+* @returns zero on success
+*/
+int plot_light_curve_distribution(char * title,
+                                  double timestamp[],
+                                  float series[], int series_length,
+                                  char * image_filename,
+                                  int image_width, int image_height,
+                                  float subtitle_indent_horizontal,
+                                  float subtitle_indent_vertical,
+                                  char * axis_label,
+                                  float period_days,
+                                  float vertical_scale)
+{
+    char subtitle[256];
+    float mean, variance, adjust;
+    float * timestamp_curve;
+    double origin;
+    float curve[LIGHT_CURVE_LENGTH];
+    float density[LIGHT_CURVE_LENGTH];
+    int i, offset, retval;
+
+    if (series_length < 2) return -2;
+
+    sprintf(subtitle,"Orbital Period %.5f days",period_days);
+
+    light_curve(timestamp, series, series_length,
+                period_days, curve, density, LIGHT_CURVE_LENGTH);
+    offset = detect_phase_offset(curve, LIGHT_CURVE_LENGTH);
+    adjust = (period_days/2) - (offset*period_days/LIGHT_CURVE_LENGTH);
+
+    timestamp_curve = (float*)malloc(series_length*sizeof(float));
+    if (timestamp_curve == NULL) return -1;
+    origin = fold_time_origin(timestamp, series_length);
+    for (i = 0; i < series_length; i++) {
+        timestamp_curve[i] =
+            (fmod(((timestamp[i]-origin)/(60*60*24))+adjust,period_days) *
+             360 / period_days) - 180.0f;
+    }
+
+    mean = detect_mean(series, series_length);
+    variance = detect_variance(series, series_length, mean);
+
+    retval = plot_graph(title, subtitle,
+                        subtitle_indent_horizontal,
+                        subtitle_indent_vertical,
+                        timestamp_curve, series, series_length,
+                        -180, 180,
+                        mean - variance*3*vertical_scale,
+                        mean + variance*3*vertical_scale,
+                        "Phase", axis_label,
+                        image_filename, image_width, image_height, 1);
+    free(timestamp_curve);
+    return retval;
+}
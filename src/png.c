@@ -0,0 +1,322 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include "waspscan.h"
+
+/* buffer used to write a deflate bit stream */
+typedef struct {
+    unsigned char * data;
+    size_t length;
+    size_t max_length;
+    uint32_t bits;
+    int no_of_bits;
+} png_bits;
+
+/* base values and extra bits for deflate length codes 257-285 */
+static const int png_length_base[] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const int png_length_extra[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+/**
+ * @brief Returns the CRC32 of a block of data, as used by png chunks
+ * @param crc Initial value, or the result of a previous call
+ * @param data The data
+ * @param length Length of the data in bytes
+ * @returns Updated CRC value
+ */
+static uint32_t png_crc(uint32_t crc, const unsigned char * data,
+                        size_t length)
+{
+    static uint32_t table[256];
+    static int table_created = 0;
+    uint32_t c;
+    size_t i;
+    int k;
+
+    if (table_created == 0) {
+        for (i = 0; i < 256; i++) {
+            c = (uint32_t)i;
+            for (k = 0; k < 8; k++) {
+                c = (c & 1) ? (0xedb88320UL ^ (c >> 1)) : (c >> 1);
+            }
+            table[i] = c;
+        }
+        table_created = 1;
+    }
+
+    crc = ~crc;
+    for (i = 0; i < length; i++) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Appends bits to a deflate stream, least significant bit first
+ * @param b The bit stream
+ * @param value The bits
+ * @param no_of_bits The number of bits
+ */
+static void png_write_bits(png_bits * b, uint32_t value, int no_of_bits)
+{
+    b->bits |= value << b->no_of_bits;
+    b->no_of_bits += no_of_bits;
+    while (b->no_of_bits >= 8) {
+        if (b->length < b->max_length) {
+            b->data[b->length++] = (unsigned char)(b->bits & 0xff);
+        }
+        b->bits >>= 8;
+        b->no_of_bits -= 8;
+    }
+}
+
+/**
+ * @brief Appends a huffman code, which is stored most significant
+ *        bit first
+ * @param b The bit stream
+ * @param code The huffman code
+ * @param no_of_bits Length of the code
+ */
+static void png_write_code(png_bits * b, uint32_t code, int no_of_bits)
+{
+    uint32_t reversed = 0;
+    int i;
+
+    for (i = 0; i < no_of_bits; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    png_write_bits(b, reversed, no_of_bits);
+}
+
+/**
+ * @brief Appends a literal or length symbol using the fixed
+ *        huffman codes of deflate
+ * @param b The bit stream
+ * @param symbol The symbol, in the range 0-287
+ */
+static void png_write_symbol(png_bits * b, int symbol)
+{
+    if (symbol < 144) {
+        png_write_code(b, 0x30 + symbol, 8);
+    }
+    else if (symbol < 256) {
+        png_write_code(b, 0x190 + (symbol - 144), 9);
+    }
+    else if (symbol < 280) {
+        png_write_code(b, symbol - 256, 7);
+    }
+    else {
+        png_write_code(b, 0xc0 + (symbol - 280), 8);
+    }
+}
+
+/**
+ * @brief Appends a repeat of the previous byte with the given length
+ * @param b The bit stream
+ * @param length Number of bytes repeated, in the range 3-258
+ */
+static void png_write_repeat(png_bits * b, int length)
+{
+    int i = 28;
+
+    while (png_length_base[i] > length) i--;
+    png_write_symbol(b, 257 + i);
+    if (png_length_extra[i] > 0) {
+        png_write_bits(b, length - png_length_base[i], png_length_extra[i]);
+    }
+    /* distance code 0, which is a distance of one byte */
+    png_write_code(b, 0, 5);
+}
+
+/**
+ * @brief Compresses data into a zlib stream. Plots mostly consist of
+ *        long runs of the same colour, so runs are encoded as matches
+ *        at a distance of one byte using the fixed huffman codes.
+ * @param data Data to be compressed
+ * @param length Length of the data
+ * @param compressed Returned compressed data, which should be freed
+ * @returns Length of the compressed data, or zero on failure
+ */
+static size_t png_deflate(unsigned char * data, size_t length,
+                          unsigned char ** compressed)
+{
+    png_bits b;
+    size_t i, run;
+    uint32_t s1 = 1, s2 = 0;
+
+    memset(&b, 0, sizeof(png_bits));
+    /* worst case is 9 bits per byte */
+    b.max_length = 16 + length + (length / 7);
+    b.data = (unsigned char*)malloc(b.max_length);
+    if (b.data == NULL) return 0;
+
+    /* zlib header: deflate with a 32K window and no dictionary */
+    b.data[b.length++] = 0x78;
+    b.data[b.length++] = 0x01;
+
+    /* a single final block using fixed huffman codes */
+    png_write_bits(&b, 1, 1);
+    png_write_bits(&b, 1, 2);
+
+    i = 0;
+    while (i < length) {
+        run = 0;
+        if (i > 0) {
+            while ((i + run < length) && (run < 258) &&
+                   (data[i + run] == data[i - 1])) {
+                run++;
+            }
+        }
+        if (run >= 3) {
+            png_write_repeat(&b, (int)run);
+            i += run;
+        }
+        else {
+            png_write_symbol(&b, data[i]);
+            i++;
+        }
+    }
+    png_write_symbol(&b, 256);
+    /* pad to a byte boundary */
+    png_write_bits(&b, 0, (8 - b.no_of_bits) & 7);
+
+    /* adler32 checksum of the uncompressed data */
+    for (i = 0; i < length; i++) {
+        s1 = (s1 + data[i]) % 65521;
+        s2 = (s2 + s1) % 65521;
+    }
+    png_write_bits(&b, (s2 >> 8) & 0xff, 8);
+    png_write_bits(&b, s2 & 0xff, 8);
+    png_write_bits(&b, (s1 >> 8) & 0xff, 8);
+    png_write_bits(&b, s1 & 0xff, 8);
+
+    if (b.length >= b.max_length) {
+        free(b.data);
+        return 0;
+    }
+    *compressed = b.data;
+    return b.length;
+}
+
+/**
+ * @brief Writes a png chunk
+ * @param fp File to write to
+ * @param type Four character chunk type
+ * @param data Chunk data
+ * @param length Length of the chunk data
+ * @returns zero on success
+ */
+static int png_write_chunk(FILE * fp, char * type,
+                           unsigned char * data, size_t length)
+{
+    unsigned char header[8];
+    unsigned char footer[4];
+    uint32_t crc;
+
+    header[0] = (length >> 24) & 0xff;
+    header[1] = (length >> 16) & 0xff;
+    header[2] = (length >> 8) & 0xff;
+    header[3] = length & 0xff;
+    memcpy(&header[4], type, 4);
+    crc = png_crc(0, &header[4], 4);
+    crc = png_crc(crc, data, length);
+    footer[0] = (crc >> 24) & 0xff;
+    footer[1] = (crc >> 16) & 0xff;
+    footer[2] = (crc >> 8) & 0xff;
+    footer[3] = crc & 0xff;
+
+    if (fwrite(header, 8, 1, fp) != 1) return -1;
+    if ((length > 0) && (fwrite(data, length, 1, fp) != 1)) return -1;
+    if (fwrite(footer, 4, 1, fp) != 1) return -1;
+    return 0;
+}
+
+/**
+ * @brief Saves an image with one byte per pixel as an indexed
+ *        colour png file
+ * @param filename Filename to save as
+ * @param pixels Palette index for each pixel
+ * @param width Width of the image
+ * @param height Height of the image
+ * @param palette Red, green and blue values for each palette index
+ * @param palette_size Number of entries within the palette
+ * @returns zero on success
+ */
+int png_write(char * filename, unsigned char * pixels,
+              int width, int height,
+              unsigned char palette[][3], int palette_size)
+{
+    static const unsigned char signature[8] = {
+        137, 80, 78, 71, 13, 10, 26, 10
+    };
+    unsigned char ihdr[13];
+    unsigned char * raw, * compressed = NULL;
+    size_t raw_length, compressed_length;
+    FILE * fp;
+    int y, retval = 0;
+
+    /* each row begins with a filter type of zero */
+    raw_length = (size_t)(width + 1) * height;
+    raw = (unsigned char*)malloc(raw_length);
+    if (raw == NULL) return -1;
+    for (y = 0; y < height; y++) {
+        raw[y*(width+1)] = 0;
+        memcpy(&raw[y*(width+1) + 1], &pixels[y*width], width);
+    }
+    compressed_length = png_deflate(raw, raw_length, &compressed);
+    free(raw);
+    if (compressed_length == 0) return -2;
+
+    ihdr[0] = (width >> 24) & 0xff;
+    ihdr[1] = (width >> 16) & 0xff;
+    ihdr[2] = (width >> 8) & 0xff;
+    ihdr[3] = width & 0xff;
+    ihdr[4] = (height >> 24) & 0xff;
+    ihdr[5] = (height >> 16) & 0xff;
+    ihdr[6] = (height >> 8) & 0xff;
+    ihdr[7] = height & 0xff;
+    ihdr[8] = 8;   /* bit depth */
+    ihdr[9] = 3;   /* indexed colour */
+    ihdr[10] = 0;  /* deflate */
+    ihdr[11] = 0;  /* adaptive filtering */
+    ihdr[12] = 0;  /* no interlace */
+
+    fp = fopen(filename, "wb");
+    if (!fp) {
+        free(compressed);
+        return -3;
+    }
+    if ((fwrite(signature, 8, 1, fp) != 1) ||
+        (png_write_chunk(fp, "IHDR", ihdr, 13) != 0) ||
+        (png_write_chunk(fp, "PLTE", (unsigned char*)palette,
+                         palette_size*3) != 0) ||
+        (png_write_chunk(fp, "IDAT", compressed, compressed_length) != 0) ||
+        (png_write_chunk(fp, "IEND", NULL, 0) != 0)) {
+        retval = -4;
+    }
+    if (fclose(fp) != 0) retval = -4;
+    free(compressed);
+    return retval;
+}
@@ -0,0 +1,122 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Averaging of samples within short time bins before the period
+   search. A bin which is much shorter than one bucket of the folded
+   light curve at the shortest period searched falls within the same
+   bucket as its samples at almost every trial period, so folding the
+   bins in place of the samples gives nearly the same light curves for
+   a fraction of the work. Each bin keeps the number of samples which
+   it holds, which weights it within the fold, and the scatter of those
+   samples about their mean, which the fold would otherwise lose.
+   Weighted samples give the weighted mean of each bin, and the bin
+   then carries their total weight. The time of a bin is always the
+   unweighted mean, so that the flux before and after correction,
+   whose errors differ, are binned at the same times. */
+
+#include "waspscan.h"
+
+/**
+ * @brief Returns the last sample which may share a bin with a sample,
+ *        so that bins never span the gap between two sections
+ * @param endpoints Start and end indexes of each section, ending with -1
+ * @param section Index of the section to check first, which is returned
+ *        updated
+ * @param index The first sample of the bin
+ * @param series_length The length of the data series
+ * @returns Index of the last sample which may be within the bin
+ */
+static int prebin_section_end(int endpoints[], int * section, int index,
+                              int series_length)
+{
+    while ((endpoints[*section*2] >= 0) &&
+           (endpoints[*section*2 + 1] < index)) {
+        (*section)++;
+    }
+    if (endpoints[*section*2] < 0) return series_length - 1;
+    /* between sections */
+    if (index < endpoints[*section*2]) return endpoints[*section*2] - 1;
+    return endpoints[*section*2 + 1];
+}
+
+/**
+ * @brief Averages the samples of a light curve within short time bins
+ * @param timestamp Array of imaging times in seconds, in order
+ * @param series Array containing magnitudes
+ * @param weight Array containing the weight of each sample, or NULL
+ *        for equal weights
+ * @param series_length The length of the data series
+ * @param endpoints Sections of the series from detect_endpoints
+ * @param bin_seconds The length of each bin
+ * @param memory Arena from which the bins are allocated
+ * @param result Returned bins
+ * @returns The number of bins, or negative on failure
+ */
+int prebin_series(double timestamp[], float series[], float weight[],
+                  int series_length, int endpoints[], double bin_seconds,
+                  arena * memory, prebinned_series * result)
+{
+    double time_sum, value_sum, weight_sum, mean, squares, w;
+    int i, j, start, last, section = 0;
+
+    memset(result, 0, sizeof(prebinned_series));
+    result->timestamp =
+        (double*)arena_alloc(memory, series_length*sizeof(double));
+    result->series = (float*)arena_alloc(memory, series_length*sizeof(float));
+    result->weight = (float*)arena_alloc(memory, series_length*sizeof(float));
+    result->squares =
+        (float*)arena_alloc(memory, series_length*sizeof(float));
+    if ((result->timestamp == NULL) || (result->series == NULL) ||
+        (result->weight == NULL) || (result->squares == NULL)) {
+        return -1;
+    }
+
+    for (start = 0; start < series_length; start = i) {
+        last = prebin_section_end(endpoints, &section, start,
+                                  series_length);
+        time_sum = value_sum = weight_sum = 0;
+        for (i = start; (i <= last) &&
+                 (timestamp[i] < timestamp[start] + bin_seconds); i++) {
+            w = (weight != NULL) ? weight[i] : 1;
+            time_sum += timestamp[i];
+            value_sum += w*series[i];
+            weight_sum += w;
+        }
+        if (i == start) {
+            w = (weight != NULL) ? weight[i] : 1;
+            time_sum = timestamp[i];
+            value_sum = w*series[i];
+            weight_sum = w;
+            i++;
+        }
+
+        mean = (weight_sum > 0) ? value_sum / weight_sum : series[start];
+        squares = 0;
+        for (j = start; j < i; j++) {
+            w = (weight != NULL) ? weight[j] : 1;
+            squares += w*(series[j] - mean)*(series[j] - mean);
+        }
+        result->timestamp[result->length] = time_sum / (i - start);
+        result->series[result->length] = (float)mean;
+        result->weight[result->length] = (float)weight_sum;
+        result->squares[result->length] = (float)squares;
+        result->length++;
+    }
+    return result->length;
+}
@@ -0,0 +1,197 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Cheap tests which reject stars with no plausible transit before the
+   full period search. A transit which can be folded must appear as at
+   least two separate dips in the light curve, which are found from the
+   average over a short window compared with a robust estimate of the
+   scatter. Stars with enough dips are then searched with box least
+   squares on a coarse and sparse grid of periods. */
+
+#include "waspscan.h"
+
+/**
+ * @brief Counts the separate times at which the light curve dips.
+ *        Each sample is clipped to a few standard deviations, so that
+ *        a single bad exposure can't make a dip, and then averaged with
+ *        its neighbours in time. A dip is where the average is below
+ *        the median by more than its expected noise would explain.
+ * @param timestamp Array of imaging times in seconds, in order
+ * @param series Array containing magnitudes
+ * @param series_length The length of the data series
+ * @param result Median and scatter, with the returned number of
+ *        outliers and dips
+ */
+static void prescreen_dips(double timestamp[], float series[],
+                           int series_length, prescreen_result * result)
+{
+    double half_window = PRESCREEN_WINDOW_HOURS*60.0*60.0*0.5;
+    double sum = 0, last_dip = 0, significance;
+    float low = result->median - (PRESCREEN_CLIP*result->scatter);
+    float high = result->median + (PRESCREEN_CLIP*result->scatter);
+    int i, start = 0, end = 0, dipping = 0;
+
+    result->outliers = 0;
+    result->dips = 0;
+    for (i = 0; i < series_length; i++) {
+        if (series[i] < result->median -
+            (PRESCREEN_DIP_SIGMA*result->scatter)) {
+            result->outliers++;
+        }
+
+        /* window of samples around this one */
+        while ((end < series_length) &&
+               (timestamp[end] <= timestamp[i] + half_window)) {
+            sum += ((series[end] < low) ? low :
+                    ((series[end] > high) ? high : series[end])) -
+                result->median;
+            end++;
+        }
+        while (timestamp[start] < timestamp[i] - half_window) {
+            sum -= ((series[start] < low) ? low :
+                    ((series[start] > high) ? high : series[start])) -
+                result->median;
+            start++;
+        }
+
+        /* the mean of n samples has 1/sqrt(n) of the noise */
+        significance = -sum / (end - start) *
+            sqrt((double)(end - start)) / result->scatter;
+        if (significance < PRESCREEN_DIP_SIGMA) continue;
+
+        /* dips separated by more than the window are different events */
+        if ((dipping == 0) ||
+            (timestamp[i] - last_dip > half_window*2)) {
+            result->dips++;
+        }
+        dipping = 1;
+        last_dip = timestamp[i];
+    }
+}
+
+/**
+ * @brief Searches a coarse and sparse grid of periods with box least
+ *        squares, returning the period with the best signal to noise
+ * @param timestamp Array of imaging times in seconds
+ * @param series Array containing magnitudes
+ * @param series_length The length of the data series
+ * @param min_period_days The minimum orbital period in days
+ * @param max_period_days The maximum orbital period in days
+ * @param result Returned number of periods, best period and its signal
+ *        to noise
+ * @returns zero on success
+ */
+static int prescreen_search(double timestamp[], float series[],
+                            int series_length,
+                            float min_period_days, float max_period_days,
+                            prescreen_result * result)
+{
+    fold_context fold;
+    float * periods = NULL;
+    int no_of_periods, failed = 0;
+
+    if (fold_context_init(&fold, timestamp, series, series_length) != 0) {
+        return -1;
+    }
+    fold_context_clip(&fold, DETECT_METHOD_BLS);
+    no_of_periods = period_grid_adaptive(&fold,
+                                         min_period_days, max_period_days,
+                                         HIERARCHICAL_CURVE_LENGTH,
+                                         PRESCREEN_OVERSAMPLE, &periods);
+    if (no_of_periods < 0) {
+        fold_context_free(&fold);
+        return -1;
+    }
+    result->periods = no_of_periods;
+
+#pragma omp parallel
+    {
+        transit_candidate candidate;
+        float best_snr = 0, best_period_days = 0;
+        int i;
+        float * workspace =
+            (float*)malloc(fold_bin_workspace(&fold,
+                                              HIERARCHICAL_CURVE_LENGTH) *
+                           sizeof(float));
+
+#pragma omp for
+        for (i = 0; i < no_of_periods; i++) {
+            if (workspace == NULL) continue;
+            if ((bls_period_response(&fold, periods[i],
+                                     HIERARCHICAL_CURVE_LENGTH,
+                                     &candidate, workspace) > 0) &&
+                (candidate.snr > best_snr)) {
+                best_snr = candidate.snr;
+                best_period_days = periods[i];
+            }
+        }
+
+#pragma omp critical
+        {
+            if (workspace == NULL) failed = 1;
+            if (best_snr > result->snr) {
+                result->snr = best_snr;
+                result->period_days = best_period_days;
+            }
+        }
+        free(workspace);
+    }
+
+    free(periods);
+    fold_context_free(&fold);
+    if (failed != 0) return -1;
+    return 0;
+}
+
+/**
+ * @brief Decides whether a star could plausibly contain a transit
+ *        which is worth a full search
+ * @param timestamp Array of imaging times in seconds, in order
+ * @param series Array containing magnitudes
+ * @param series_length The length of the data series
+ * @param min_period_days The minimum orbital period in days
+ * @param max_period_days The maximum orbital period in days
+ * @param threshold Signal to noise which the coarse search must reach
+ * @param result Returned measurements of the star
+ * @returns 1 if the star should be searched, zero if not, or negative
+ *          on failure
+ */
+int prescreen_star(double timestamp[], float series[], int series_length,
+                   float min_period_days, float max_period_days,
+                   float threshold, prescreen_result * result)
+{
+    memset(result, 0, sizeof(prescreen_result));
+    if (series_length < 2) return 0;
+
+    if (detect_scatter(series, series_length,
+                       &result->median, &result->scatter) != 0) {
+        return -1;
+    }
+    if (result->scatter <= 0) return 0;
+
+    /* a transit must be seen at least twice to have a period */
+    prescreen_dips(timestamp, series, series_length, result);
+    if (result->dips < PRESCREEN_MIN_DIPS) return 0;
+
+    if (prescreen_search(timestamp, series, series_length,
+                         min_period_days, max_period_days, result) != 0) {
+        return -1;
+    }
+    return (result->snr >= threshold) ? 1 : 0;
+}
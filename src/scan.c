@@ -0,0 +1,1031 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <time.h>
+#include <sys/resource.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "waspscan.h"
+
+/**
+ * @brief Reads the clocks at the start or end of a stage
+ * @param whole_process Non-zero to read the processor time of every
+ *        thread, or zero for only the calling thread. Stages which run
+ *        on one thread use their own time, so that a star loaded
+ *        alongside a search isn't charged for the search.
+ * @param wall Returned wall clock time in seconds
+ * @param cpu Returned processor time in seconds
+ */
+static void scan_clock(int whole_process, double * wall, double * cpu)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    *wall = t.tv_sec + (t.tv_nsec*1.0e-9);
+    clock_gettime(whole_process ? CLOCK_PROCESS_CPUTIME_ID :
+                  CLOCK_THREAD_CPUTIME_ID, &t);
+    *cpu = t.tv_sec + (t.tv_nsec*1.0e-9);
+}
+
+/**
+ * @brief Adds the time since the start of a stage to its statistics
+ * @param stats Statistics of the star
+ * @param stage SCAN_STAGE_LOAD, _ENDPOINTS, _PREBIN, _PRESCREEN,
+ *        _SEARCH or _PLOT
+ * @param whole_process As given to scan_clock at the start
+ * @param wall Wall clock time at the start
+ * @param cpu Processor time at the start
+ */
+static void scan_stage_end(scan_stats * stats, int stage,
+                           int whole_process, double wall, double cpu)
+{
+    double wall_now, cpu_now;
+
+    scan_clock(whole_process, &wall_now, &cpu_now);
+    stats->wall_seconds[stage] += wall_now - wall;
+    stats->cpu_seconds[stage] += cpu_now - cpu;
+}
+
+/**
+ * @brief Sets default values for scan parameters
+ * @param params The parameters to be initialised
+ */
+void scan_parameters_init(scan_parameters * params)
+{
+    memset(params, 0, sizeof(scan_parameters));
+    params->minimum_data_samples = 1000;
+    params->table_type = TABLE_TYPE_WASP;
+    params->table_index = -1;
+    params->vertical_scale = 1.0f;
+    params->oversample = GRID_OVERSAMPLE;
+    params->max_candidates = HIERARCHICAL_CANDIDATES;
+    params->max_results = 1;
+    params->tile_periods = FOLD_TILE_PERIODS;
+    params->tile_samples = FOLD_TILE_SAMPLES;
+    params->plot = 1;
+    params->prescreen_threshold = PRESCREEN_THRESHOLD;
+    params->prebin_fraction = PREBIN_FRACTION;
+    params->checkpoint_seconds = CHECKPOINT_SECONDS;
+}
+
+/**
+ * @brief Returns the names and indexes of the table columns to be
+ *        loaded, based upon the table type. Errors are only loaded
+ *        if samples are to be weighted, and the flux before TAMUZ
+ *        correction only if it's to be searched.
+ * @param params Scan parameters
+ * @param layout Returned names and indexes of the columns
+ * @param table_name Returned name of the table within a fits file,
+ *        or NULL to select the table by index
+ * @param table_index Returned index of the table within a fits file
+ */
+static void scan_fields(scan_parameters * params, table_layout * layout,
+                        char ** table_name, int * table_index)
+{
+    int c;
+
+    for (c = 0; c < TABLE_COLUMNS; c++) {
+        layout->name[c] = NULL;
+        layout->index[c] = -1;
+    }
+    layout->index[TABLE_COLUMN_TIME] = 0;
+    layout->index[TABLE_COLUMN_FLUX] = 3;
+    *table_name = (params->table_name[0] != 0) ? params->table_name : NULL;
+    *table_index = params->table_index;
+
+    /* change the table columns based upon the format type */
+    switch(params->table_type) {
+    case TABLE_TYPE_WASP: {
+        layout->name[TABLE_COLUMN_TIME] = "TMID";
+        layout->name[TABLE_COLUMN_FLUX] = "TAMFLUX2";
+        if (params->weighted != 0) {
+            layout->index[TABLE_COLUMN_ERROR] = 4;
+            layout->name[TABLE_COLUMN_ERROR] = "TAMFLUX2_ERR";
+        }
+        if (params->raw_flux != 0) {
+            layout->index[TABLE_COLUMN_RAW_FLUX] = 1;
+            layout->name[TABLE_COLUMN_RAW_FLUX] = "FLUX2";
+            if (params->weighted != 0) {
+                layout->index[TABLE_COLUMN_RAW_ERROR] = 2;
+                layout->name[TABLE_COLUMN_RAW_ERROR] = "FLUX2_ERR";
+            }
+        }
+        if (params->keep_flagged == 0) {
+            layout->index[TABLE_COLUMN_FLAG] = 8;
+            layout->name[TABLE_COLUMN_FLAG] = "FLAG";
+        }
+        if ((*table_name == NULL) && (*table_index < 0)) {
+            *table_name = "PHOTOMETRY";
+        }
+        break;
+    }
+    case TABLE_TYPE_K2: {
+        layout->index[TABLE_COLUMN_FLUX] = 2;
+        if ((*table_name == NULL) && (*table_index < 0)) {
+            *table_index = 1;
+        }
+        break;
+    }
+    }
+}
+
+/**
+ * @brief Loads the columns of a log file, then saves them as a cache
+ *        so that subsequent runs don't need to parse the text again
+ * @param filename Log filename
+ * @param columns Description of the columns, used to validate the cache
+ * @param layout Names and indexes of the columns
+ * @param mem Arena from which the arrays are allocated
+ * @param loaded Returned columns
+ * @returns The number of data points loaded
+ */
+static int load_and_cache(char * filename, char * columns,
+                          table_layout * layout, arena * mem,
+                          series_columns * loaded)
+{
+    int series_length;
+
+    series_length = logfile_load_columns(filename, layout, mem, loaded);
+    if (series_length <= 0) return series_length;
+
+    if (cache_save(filename, columns, loaded) != 0) {
+        printf("Unable to save cache for %s\n", filename);
+    }
+    return series_length;
+}
+
+/**
+ * @brief Loads the light curve for a star from a fits file, a table
+ *        or a cache of a table. Buffers are allocated from the arena
+ *        of the star, which is reused if the star was loaded before.
+ * @param params Scan parameters
+ * @param filename Log filename
+ * @param star Returned light curve, which should be all zeros if it
+ *        hasn't been loaded before
+ * @returns The number of data points loaded, or negative on error
+ */
+static int scan_load_series(scan_parameters * params, char * filename,
+                            scan_series * star)
+{
+    table_layout layout;
+    series_columns loaded;
+    int c, table_index;
+    char * table_name;
+    char columns[64];
+    arena memory = star->memory;
+
+    cache_close(&star->cache);
+    arena_reset(&memory);
+    memset(star, 0, sizeof(scan_series));
+    star->memory = memory;
+    snprintf(star->filename, sizeof(star->filename), "%s", filename);
+
+    /* get the name of the scan from the log filename */
+    scan_name(star->filename, star->name);
+
+    scan_fields(params, &layout, &table_name, &table_index);
+    sprintf(columns, "%d", params->table_type);
+    for (c = 0; c < TABLE_COLUMNS; c++) {
+        sprintf(&columns[strlen(columns)], " %d", layout.index[c]);
+    }
+
+    /* read the data */
+    memset(&loaded, 0, sizeof(series_columns));
+    if ((params->use_cache != 0) && (fits_is_fits(filename) == 0) &&
+        (cache_open(filename, columns, &star->cache) == 0)) {
+        loaded = star->cache.columns;
+    }
+    else if (fits_is_fits(filename)) {
+        loaded.length = fits_load(filename, table_name, table_index,
+                                  &layout, &star->memory, &loaded);
+    }
+    else if (params->use_cache != 0) {
+        load_and_cache(filename, columns, &layout, &star->memory, &loaded);
+    }
+    else {
+        loaded.length = logfile_load_columns(filename, &layout,
+                                             &star->memory, &loaded);
+    }
+    star->length = loaded.length;
+    if (star->length < 0) return star->length;
+
+    star->timestamp = loaded.timestamp;
+    star->series = loaded.series;
+    star->error = loaded.error;
+    star->raw_series = loaded.raw_series;
+    star->raw_error = loaded.raw_error;
+    return star->length;
+}
+
+/**
+ * @brief Loads the light curve for a star, timing how long it takes.
+ *        See scan_load_series.
+ * @param params Scan parameters
+ * @param filename Log filename
+ * @param star Returned light curve, which should be all zeros if it
+ *        hasn't been loaded before
+ * @returns The number of data points loaded, or negative on error
+ */
+int scan_load(scan_parameters * params, char * filename,
+              scan_series * star)
+{
+    double wall, cpu;
+
+    scan_clock(0, &wall, &cpu);
+    scan_load_series(params, filename, star);
+    scan_stage_end(&star->stats, SCAN_STAGE_LOAD, 0, wall, cpu);
+    return star->length;
+}
+
+/**
+ * @brief Releases a light curve loaded with scan_load, but keeps its
+ *        memory so that the next star loaded into it can reuse it
+ * @param star The light curve
+ */
+void scan_series_release(scan_series * star)
+{
+    cache_close(&star->cache);
+    arena_reset(&star->memory);
+    star->timestamp = NULL;
+    star->series = NULL;
+    star->error = NULL;
+    star->raw_series = NULL;
+    star->raw_error = NULL;
+    star->weight = NULL;
+    star->raw_weight = NULL;
+    star->length = 0;
+    star->results = NULL;
+    star->no_of_results = 0;
+    star->raw_results = NULL;
+    star->no_of_raw_results = 0;
+    memset(&star->prescreen, 0, sizeof(prescreen_result));
+    memset(&star->binned, 0, sizeof(prebinned_series));
+    memset(&star->raw_binned, 0, sizeof(prebinned_series));
+}
+
+/**
+ * @brief Frees memory used by a light curve loaded with scan_load
+ * @param star The light curve
+ */
+void scan_series_free(scan_series * star)
+{
+    scan_series_release(star);
+    arena_free(&star->memory);
+}
+
+/**
+ * @brief Sets the result of a search which only finds a period
+ * @param star The light curve
+ * @param period_days The orbital period
+ * @param score Response of the method to the period
+ * @returns zero on success
+ */
+static int scan_result(scan_series * star, float period_days, float score)
+{
+    star->results =
+        (transit_candidate*)arena_alloc(&star->memory,
+                                        sizeof(transit_candidate));
+    if (star->results == NULL) return -1;
+    memset(star->results, 0, sizeof(transit_candidate));
+    star->results[0].period_days = period_days;
+    star->results[0].score = score;
+    star->no_of_results = 1;
+    return 0;
+}
+
+/**
+ * @brief Searches the light curve of a star for the period with the
+ *        most Lomb-Scargle power
+ * @param params Scan parameters
+ * @param star The light curve
+ * @param orbital_period_days Returned period
+ * @returns zero if a period was found, -4 on failure or -5 if no
+ *          period was found
+ */
+static int scan_search_periodogram(scan_parameters * params,
+                                   scan_series * star,
+                                   float * orbital_period_days)
+{
+    periodogram pg;
+    float power;
+    int text = (params->output == SCAN_OUTPUT_TEXT);
+
+    if (periodogram_init(&pg, star->timestamp, star->series, star->length,
+                         params->minimum_period_days,
+                         PERIODOGRAM_OVERSAMPLE*params->oversample) != 0) {
+        printf("Unable to calculate the periodogram\n");
+        return -4;
+    }
+    if (text) printf("%d frequencies\n", pg.length);
+    *orbital_period_days =
+        periodogram_best_period(&pg, params->minimum_period_days,
+                                params->maximum_period_days, &power);
+    periodogram_free(&pg);
+
+    if (*orbital_period_days == 0) {
+        if (text) printf("No periods detected\n");
+        return -5;
+    }
+    if (scan_result(star, *orbital_period_days, power) != 0) return -4;
+    if (text) {
+        printf("orbital_period_days %.6f\n", *orbital_period_days);
+        printf("power %.4f\n", power);
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints the orbital period and any other candidates found
+ * @param params Scan parameters
+ * @param prefix Prefix of each name, which distinguishes the series
+ * @param results The candidates found
+ * @param no_of_results The number of candidates
+ */
+static void scan_print_results(scan_parameters * params, char * prefix,
+                               transit_candidate results[],
+                               int no_of_results)
+{
+    int i;
+
+    printf("%sorbital_period_days %.6f\n", prefix, results[0].period_days);
+    if (params->method == DETECT_METHOD_BLS) {
+        printf("%sdepth %.6f\n", prefix, results[0].depth);
+        printf("%sduration_days %.6f\n", prefix, results[0].duration_days);
+        printf("%sepoch_days %.6f\n", prefix, results[0].epoch_days);
+        printf("%ssnr %.2f\n", prefix, results[0].snr);
+    }
+    if (params->max_results > 1) {
+        for (i = 0; i < no_of_results; i++) {
+            printf("%scandidate %d period_days %.6f score %g aliases %d\n",
+                   prefix, i+1, results[i].period_days, results[i].score,
+                   results[i].aliases);
+        }
+    }
+}
+
+/**
+ * @brief Searches the light curve of a star for the orbital period.
+ *        The flux before correction, if loaded, is folded alongside
+ *        the corrected flux within the same passes.
+ * @param params Scan parameters
+ * @param star The light curve
+ * @param orbital_period_days Returned orbital period, or zero
+ * @returns zero if a transit was found, -4 on failure or -5 if no
+ *          transit was found
+ */
+static int scan_search_periods(scan_parameters * params, scan_series * star,
+                               float * orbital_period_days)
+{
+    fold_context fold, raw;
+    search_checkpoint checkpoint;
+    transit_candidate * results, * raw_results;
+    periodogram pg;
+    periodogram * mask = NULL;
+    prebinned_series * binned = &star->binned;
+    prebinned_series * raw_binned = &star->raw_binned;
+    float * periods = NULL;
+    float * raw_series = star->raw_series;
+    int i, no_of_periods, evaluated, no_of_results = 0;
+    int max_results = (params->max_results > 0) ? params->max_results : 1;
+    int text = (params->output == SCAN_OUTPUT_TEXT);
+
+    if (params->method == DETECT_METHOD_LS) {
+        return scan_search_periodogram(params, star, orbital_period_days);
+    }
+
+    /* frequencies dominated by variability or aliases aren't searched */
+    if (params->ls_prescreen != 0) {
+        if (periodogram_init(&pg, star->timestamp, star->series,
+                             star->length, params->minimum_period_days,
+                             PERIODOGRAM_OVERSAMPLE*params->oversample) != 0) {
+            printf("Unable to calculate the periodogram\n");
+            return -4;
+        }
+        mask = &pg;
+    }
+
+    results =
+        (transit_candidate*)arena_alloc(&star->memory,
+                                        max_results*sizeof(transit_candidate));
+    if ((results == NULL) ||
+        ((binned->length == 0) &&
+         (fold_context_init(&fold, star->timestamp, star->series,
+                            star->length) != 0)) ||
+        ((binned->length > 0) &&
+         (fold_context_init(&fold, binned->timestamp, binned->series,
+                            binned->length) != 0))) {
+        printf("Unable to allocate memory for the search\n");
+        if (mask != NULL) periodogram_free(mask);
+        return -4;
+    }
+    if (binned->length > 0) {
+        fold_context_weight(&fold, binned->weight, binned->squares);
+    }
+    else if (star->weight != NULL) {
+        fold_context_weight(&fold, star->weight, NULL);
+    }
+    fold.tile_periods = params->tile_periods;
+    fold.tile_samples = params->tile_samples;
+    fold.statistics = &star->stats.search;
+
+    /* the raw flux shares the phases of the corrected flux */
+    if (raw_series != NULL) {
+        if (binned->length > 0) raw_series = raw_binned->series;
+        raw_results =
+            (transit_candidate*)arena_alloc(&star->memory,
+                                            max_results*
+                                            sizeof(transit_candidate));
+        if ((raw_results == NULL) ||
+            (fold_context_companion(&fold, &raw, raw_series) != 0)) {
+            printf("Unable to allocate memory for the search\n");
+            fold_context_free(&fold);
+            if (mask != NULL) periodogram_free(mask);
+            return -4;
+        }
+        raw.results = raw_results;
+        if (binned->length > 0) {
+            fold_context_weight(&raw, raw_binned->weight,
+                                raw_binned->squares);
+        }
+        else if (star->raw_weight != NULL) {
+            fold_context_weight(&raw, star->raw_weight, NULL);
+        }
+    }
+    if (params->hierarchical != 0) {
+        no_of_results =
+            detect_orbital_period_hierarchical(&fold,
+                                               params->minimum_period_days,
+                                               params->maximum_period_days,
+                                               params->oversample,
+                                               params->max_candidates,
+                                               params->method, mask,
+                                               results, max_results,
+                                               &evaluated);
+        if (text) printf("%d trial periods evaluated\n", evaluated);
+    }
+    else {
+        if (params->increment_days > 0) {
+            no_of_periods =
+                period_grid_uniform(params->minimum_period_days,
+                                    params->maximum_period_days,
+                                    params->increment_days, &periods);
+        }
+        else {
+            no_of_periods =
+                period_grid_adaptive(&fold,
+                                     params->minimum_period_days,
+                                     params->maximum_period_days,
+                                     DETECT_CURVE_LENGTH,
+                                     params->oversample, &periods);
+        }
+        if (no_of_periods <= 0) {
+            printf("Unable to create the period search grid\n");
+            if (raw_series != NULL) fold_context_free(&raw);
+            fold_context_free(&fold);
+            if (mask != NULL) periodogram_free(mask);
+            return -4;
+        }
+        if (mask != NULL) {
+            i = no_of_periods;
+            no_of_periods = periodogram_mask_periods(mask, periods,
+                                                     no_of_periods);
+            star->stats.search.periods[DETECT_MASKED] += i - no_of_periods;
+        }
+        if (text) printf("%d trial periods\n", no_of_periods);
+
+        /* a long search can be resumed if it's interrupted */
+        if (params->checkpoint[0] != 0) {
+            memset(&checkpoint, 0, sizeof(search_checkpoint));
+            sprintf(checkpoint.filename, "%s", params->checkpoint);
+            checkpoint.interval_seconds = params->checkpoint_seconds;
+            fold.checkpoint = &checkpoint;
+        }
+        no_of_results =
+            detect_orbital_period(&fold, periods, no_of_periods,
+                                  params->method, results, max_results);
+        free(periods);
+    }
+    if (raw_series != NULL) {
+        star->raw_results = raw.results;
+        star->no_of_raw_results = raw.no_of_results;
+        fold_context_free(&raw);
+    }
+    fold_context_free(&fold);
+    if (mask != NULL) periodogram_free(mask);
+
+    if (no_of_results > 0) {
+        star->results = results;
+        star->no_of_results = no_of_results;
+        *orbital_period_days = results[0].period_days;
+        if (text) scan_print_results(params, "", results, no_of_results);
+    }
+    else if (text) {
+        printf("No transits detected\n");
+    }
+    if (text && (raw_series != NULL)) {
+        if (star->no_of_raw_results > 0) {
+            scan_print_results(params, "raw_", star->raw_results,
+                               star->no_of_raw_results);
+        }
+        else {
+            printf("No transits detected in the raw flux\n");
+        }
+    }
+    return (no_of_results > 0) ? 0 : -5;
+}
+
+/**
+ * @brief Returns inverse variance weights for the samples of a star
+ *        which have errors. Samples without errors aren't weighted.
+ * @param star The light curve
+ * @returns zero on success
+ */
+static int scan_weights(scan_series * star)
+{
+    if (star->error != NULL) {
+        star->weight =
+            (float*)arena_alloc(&star->memory, star->length*sizeof(float));
+        if (star->weight == NULL) return -1;
+        fold_error_weights(star->error, star->length, star->weight);
+    }
+    if ((star->raw_series != NULL) && (star->raw_error != NULL)) {
+        star->raw_weight =
+            (float*)arena_alloc(&star->memory, star->length*sizeof(float));
+        if (star->raw_weight == NULL) return -1;
+        fold_error_weights(star->raw_error, star->length, star->raw_weight);
+    }
+    return 0;
+}
+
+/**
+ * @brief Searches the light curve of a star for transits
+ * @param params Scan parameters
+ * @param star The light curve
+ * @param orbital_period_days Returned orbital period, or zero
+ * @returns zero if a transit was found, 2 if the series has no
+ *          sections, 3 if the star was rejected by the pre-screen,
+ *          -4 on failure or -5 if no transit was found
+ */
+int scan_search(scan_parameters * params, scan_series * star,
+                float * orbital_period_days)
+{
+    int * endpoints;
+    int no_of_sections, status;
+    double wall, cpu, bin_seconds;
+
+    *orbital_period_days = 0;
+
+    scan_clock(0, &wall, &cpu);
+    endpoints = (int*)malloc((star->length*2 + 1)*sizeof(int));
+    if (endpoints == NULL) return -4;
+    no_of_sections = detect_endpoints(star->timestamp, star->length,
+                                      endpoints);
+    scan_stage_end(&star->stats, SCAN_STAGE_ENDPOINTS, 0, wall, cpu);
+    if (no_of_sections == 0) {
+        free(endpoints);
+        if (params->output == SCAN_OUTPUT_TEXT) {
+            printf("No sections detected in the time series\n");
+        }
+        return 2;
+    }
+
+    if ((params->weighted != 0) && (params->known_period_days == 0) &&
+        (scan_weights(star) != 0)) {
+        free(endpoints);
+        printf("Unable to allocate memory for the weights\n");
+        return -4;
+    }
+
+    /* samples much closer together than a bucket of the light curve
+       are folded into the same bucket, so they can be averaged first */
+    if ((params->prebin != 0) && (params->known_period_days == 0)) {
+        scan_clock(0, &wall, &cpu);
+        bin_seconds = params->prebin_fraction*params->minimum_period_days*
+            60.0*60.0*24.0/DETECT_CURVE_LENGTH;
+        status = prebin_series(star->timestamp, star->series, star->weight,
+                               star->length, endpoints, bin_seconds,
+                               &star->memory, &star->binned);
+        if ((status >= 0) && (star->raw_series != NULL)) {
+            status = prebin_series(star->timestamp, star->raw_series,
+                                   star->raw_weight, star->length,
+                                   endpoints, bin_seconds, &star->memory,
+                                   &star->raw_binned);
+        }
+        scan_stage_end(&star->stats, SCAN_STAGE_PREBIN, 0, wall, cpu);
+        if (status < 0) {
+            free(endpoints);
+            printf("Unable to allocate memory for the time bins\n");
+            return -4;
+        }
+        if (params->output == SCAN_OUTPUT_TEXT) {
+            printf("%d samples averaged into %d bins of %.0f seconds\n",
+                   star->length, star->binned.length, bin_seconds);
+        }
+    }
+    free(endpoints);
+
+    if (params->known_period_days != 0) {
+        *orbital_period_days = params->known_period_days;
+        return scan_result(star, *orbital_period_days, 0) ? -4 : 0;
+    }
+
+    /* most stars have no transit, and needn't be searched in full */
+    if (params->prescreen != 0) {
+        scan_clock(1, &wall, &cpu);
+        status = prescreen_star(star->timestamp, star->series, star->length,
+                                params->minimum_period_days,
+                                params->maximum_period_days,
+                                params->prescreen_threshold,
+                                &star->prescreen);
+        scan_stage_end(&star->stats, SCAN_STAGE_PRESCREEN, 1, wall, cpu);
+        if (status < 0) {
+            printf("Unable to pre-screen the light curve\n");
+            return -4;
+        }
+        if (status == 0) {
+            if (params->output == SCAN_OUTPUT_TEXT) {
+                printf("Rejected by the pre-screen, dips %d snr %.2f\n",
+                       star->prescreen.dips, star->prescreen.snr);
+            }
+            return 3;
+        }
+    }
+
+    scan_clock(1, &wall, &cpu);
+    status = scan_search_periods(params, star, orbital_period_days);
+    scan_stage_end(&star->stats, SCAN_STAGE_SEARCH, 1, wall, cpu);
+    return status;
+}
+
+/**
+ * @brief Plots the light curve of a star for a given orbital period,
+ *        either directly to png images or using gnuplot
+ * @param params Scan parameters
+ * @param star The light curve
+ * @param orbital_period_days The orbital period
+ */
+static void scan_plot_images(scan_parameters * params, scan_series * star,
+                             float orbital_period_days)
+{
+    char title[320];
+    char light_curve_filename[320];
+    char light_curve_distribution_filename[320];
+
+    sprintf(light_curve_filename,"%s.png",star->name);
+    sprintf(light_curve_distribution_filename,"%s_distr.png",star->name);
+    sprintf(title,"SuperWASP Light Curve for %s",star->name);
+    if (params->plotter == PLOTTER_GNUPLOT) {
+        gnuplot_light_curve_distribution(title,
+                                         star->timestamp, star->series,
+                                         star->length,
+                                         light_curve_distribution_filename,
+                                         1024, 640,
+                                         0.44,0.93,
+                                         "TAMUZ corrected processed flux (micro Vega)",
+                                         orbital_period_days,
+                                         params->vertical_scale);
+        gnuplot_light_curve(title,
+                            star->timestamp, star->series, star->length,
+                            light_curve_filename,
+                            1024, 640,
+                            0.44,0.93,
+                            "TAMUZ corrected processed flux (micro Vega)",
+                            orbital_period_days,
+                            params->vertical_scale);
+        return;
+    }
+
+    if (plot_light_curve_distribution(title,
+                                      star->timestamp, star->series,
+                                      star->length,
+                                      light_curve_distribution_filename,
+                                      1024, 640,
+                                      0.44,0.93,
+                                      "TAMUZ corrected processed flux (micro Vega)",
+                                      orbital_period_days,
+                                      params->vertical_scale) != 0) {
+        printf("Unable to save %s\n", light_curve_distribution_filename);
+    }
+    if (plot_light_curve(title,
+                         star->timestamp, star->series, star->length,
+                         light_curve_filename,
+                         1024, 640,
+                         0.44,0.93,
+                         "TAMUZ corrected processed flux (micro Vega)",
+                         orbital_period_days,
+                         params->vertical_scale) != 0) {
+        printf("Unable to save %s\n", light_curve_filename);
+    }
+}
+
+/**
+ * @brief Plots the light curve of a star, timing how long it takes.
+ *        See scan_plot_images.
+ * @param params Scan parameters
+ * @param star The light curve
+ * @param orbital_period_days The orbital period
+ */
+void scan_plot(scan_parameters * params, scan_series * star,
+               float orbital_period_days)
+{
+    double wall, cpu;
+
+    scan_clock(0, &wall, &cpu);
+    scan_plot_images(params, star, orbital_period_days);
+    scan_stage_end(&star->stats, SCAN_STAGE_PLOT, 0, wall, cpu);
+}
+
+/**
+ * @brief Prints a string as a JSON string, escaping characters which
+ *        would otherwise end it
+ * @param str The string
+ */
+static void scan_print_json_string(char * str)
+{
+    putchar('"');
+    for (; *str != 0; str++) {
+        if ((*str == '"') || (*str == '\\')) {
+            printf("\\%c", *str);
+        }
+        else if ((unsigned char)*str < 0x20) {
+            printf("\\u%04x", (unsigned char)*str);
+        }
+        else {
+            putchar(*str);
+        }
+    }
+    putchar('"');
+}
+
+/**
+ * @brief Prints a string as a CSV field, quoting it if it contains
+ *        separators or quotes
+ * @param str The string
+ */
+static void scan_print_csv_string(char * str)
+{
+    if (strpbrk(str, ",\"\r\n") == NULL) {
+        printf("%s", str);
+        return;
+    }
+    putchar('"');
+    for (; *str != 0; str++) {
+        if (*str == '"') putchar('"');
+        putchar(*str);
+    }
+    putchar('"');
+}
+
+/**
+ * @brief Returns the name of a detection method
+ * @param method DETECT_METHOD_HEURISTIC, _BLS or _LS
+ * @returns Name of the method, as given to --method
+ */
+static const char * scan_method_name(int method)
+{
+    switch(method) {
+    case DETECT_METHOD_BLS: return "bls";
+    case DETECT_METHOD_LS: return "ls";
+    }
+    return "heuristic";
+}
+
+/**
+ * @brief Returns the name of the status of a search
+ * @param status 1 if there were too few samples to search,
+ *        SCAN_STATUS_NOT_FETCHED if the daemon couldn't download the
+ *        star, otherwise the value returned by scan_search
+ * @returns Name of the status
+ */
+const char * scan_status_name(int status)
+{
+    switch(status) {
+    case 0: return "found";
+    case 1: return "too_few_samples";
+    case 2: return "no_sections";
+    case 3: return "prescreened";
+    case SCAN_STATUS_NOT_FETCHED: return "not_fetched";
+    case -5: return "no_transit";
+    }
+    return "failed";
+}
+
+/**
+ * @brief Prints the heading of the results table, if the results
+ *        are reported as CSV. This should be called once before
+ *        any stars are reported.
+ * @param params Scan parameters
+ */
+void scan_report_header(scan_parameters * params)
+{
+    if (params->output != SCAN_OUTPUT_CSV) return;
+
+    printf("star,samples,status,method,min_period_days,max_period_days,"
+           "oversample,increment_days,hierarchical,ls_prescreen,"
+           "rank,period_days,score,depth,duration_days,epoch_days,snr,"
+           "aliases%s\n", (params->raw_flux != 0) ? ",flux" : "");
+}
+
+/**
+ * @brief Prints candidates as the members of a JSON array
+ * @param results The candidates
+ * @param no_of_results The number of candidates
+ */
+static void scan_print_json_candidates(transit_candidate results[],
+                                       int no_of_results)
+{
+    transit_candidate * result;
+    int i;
+
+    for (i = 0; i < no_of_results; i++) {
+        result = &results[i];
+        printf("%s{\"period_days\":%.6f,\"score\":%g,\"depth\":%g,"
+               "\"duration_days\":%.6f,\"epoch_days\":%.6f,"
+               "\"snr\":%.2f,\"aliases\":%d}",
+               (i > 0) ? "," : "", result->period_days, result->score,
+               result->depth, result->duration_days, result->epoch_days,
+               result->snr, result->aliases);
+    }
+}
+
+/**
+ * @brief Prints a row of CSV for each candidate, or a single row
+ *        without one
+ * @param params Scan parameters
+ * @param star The light curve
+ * @param status Outcome of the search of this flux
+ * @param flux Name of the flux searched, or NULL if only the corrected
+ *        flux is searched
+ * @param results The candidates
+ * @param no_of_results The number of candidates
+ */
+static void scan_print_csv_rows(scan_parameters * params, scan_series * star,
+                                int status, char * flux,
+                                transit_candidate results[],
+                                int no_of_results)
+{
+    transit_candidate * result;
+    int i = 0;
+
+    do {
+        scan_print_csv_string(star->name);
+        printf(",%d,%s,%s,%g,%g,%g,%g,%d,%d,",
+               star->length, scan_status_name(status),
+               scan_method_name(params->method),
+               params->minimum_period_days, params->maximum_period_days,
+               params->oversample, params->increment_days,
+               params->hierarchical, params->ls_prescreen);
+        if (i < no_of_results) {
+            result = &results[i];
+            printf("%d,%.6f,%g,%g,%.6f,%.6f,%.2f,%d",
+                   i+1, result->period_days, result->score,
+                   result->depth, result->duration_days,
+                   result->epoch_days, result->snr, result->aliases);
+        }
+        else {
+            printf(",,,,,,,");
+        }
+        if (flux != NULL) printf(",%s", flux);
+        printf("\n");
+        i++;
+    } while (i < no_of_results);
+}
+
+/**
+ * @brief Prints the results of searching a star as JSON or as rows of
+ *        CSV, together with the parameters of the search. Nothing is
+ *        printed for text output, where the results were printed
+ *        during the search.
+ * @param params Scan parameters
+ * @param star The light curve, with any results of the search
+ * @param status 1 if there were too few samples to search, otherwise
+ *        the value returned by scan_search
+ */
+void scan_report(scan_parameters * params, scan_series * star, int status)
+{
+    int no_of_results = (status == 0) ? star->no_of_results : 0;
+    int raw_status = status;
+
+    /* the raw flux may have a transit whether or not the corrected
+       flux does, but is otherwise searched or not along with it */
+    if ((status == 0) || (status == -5)) {
+        raw_status = (star->no_of_raw_results > 0) ? 0 : -5;
+    }
+
+    if (params->output == SCAN_OUTPUT_JSON) {
+        printf("{\"star\":");
+        scan_print_json_string(star->name);
+        printf(",\"samples\":%d,\"status\":\"%s\",\"method\":\"%s\","
+               "\"min_period_days\":%g,\"max_period_days\":%g,"
+               "\"oversample\":%g,\"increment_days\":%g,"
+               "\"hierarchical\":%d,\"ls_prescreen\":%d,"
+               "\"candidates\":[",
+               star->length, scan_status_name(status),
+               scan_method_name(params->method),
+               params->minimum_period_days, params->maximum_period_days,
+               params->oversample, params->increment_days,
+               params->hierarchical, params->ls_prescreen);
+        scan_print_json_candidates(star->results, no_of_results);
+        printf("]");
+        if (params->weighted != 0) {
+            printf(",\"weighted\":%d", (star->weight != NULL));
+        }
+        if (params->raw_flux != 0) {
+            printf(",\"raw\":{\"status\":\"%s\",\"candidates\":[",
+                   scan_status_name(raw_status));
+            scan_print_json_candidates(star->raw_results,
+                                       star->no_of_raw_results);
+            printf("]}");
+        }
+        if (params->prescreen != 0) {
+            printf(",\"prescreen\":{\"scatter\":%g,\"outliers\":%d,"
+                   "\"dips\":%d,\"periods\":%d,\"period_days\":%.6f,"
+                   "\"snr\":%.2f}",
+                   star->prescreen.scatter, star->prescreen.outliers,
+                   star->prescreen.dips, star->prescreen.periods,
+                   star->prescreen.period_days, star->prescreen.snr);
+        }
+        if (params->prebin != 0) {
+            printf(",\"prebin\":{\"fraction\":%g,\"bins\":%d}",
+                   params->prebin_fraction, star->binned.length);
+        }
+        printf("}\n");
+    }
+    else if (params->output == SCAN_OUTPUT_CSV) {
+        if (params->raw_flux == 0) {
+            scan_print_csv_rows(params, star, status, NULL,
+                                star->results, no_of_results);
+            return;
+        }
+        scan_print_csv_rows(params, star, status, "corrected",
+                            star->results, no_of_results);
+        scan_print_csv_rows(params, star, raw_status, "raw",
+                            star->raw_results, star->no_of_raw_results);
+    }
+}
+
+/**
+ * @brief Prints the time spent on each stage of searching a star and
+ *        the outcomes of its trial periods, if they were requested
+ * @param params Scan parameters
+ * @param star The light curve
+ */
+void scan_stats_report(scan_parameters * params, scan_series * star)
+{
+    const char * stage_names[] = {
+        "load", "endpoints", "prebin", "prescreen", "search", "plot"
+    };
+    const char * outcome_names[] = {
+        "scored", "masked", "too_few_samples", "missing_data", "gaps",
+        "no_dip", "too_many_dipped", "too_many_nondipped"
+    };
+    scan_stats * stats = &star->stats;
+    struct rusage usage;
+    long evaluated = 0;
+    int i, threads = stats->search.threads;
+
+    if (params->stats != SCAN_STATS_JSON) return;
+
+    for (i = 0; i < DETECT_OUTCOMES; i++) {
+        if (i != DETECT_MASKED) evaluated += stats->search.periods[i];
+    }
+#ifdef _OPENMP
+    if (threads == 0) threads = omp_get_max_threads();
+#endif
+    if (threads == 0) threads = 1;
+    memset(&usage, 0, sizeof(usage));
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\"stats\":{\"star\":");
+    scan_print_json_string(star->name);
+    printf(",\"samples\":%d,\"threads\":%d,\"peak_rss_kb\":%ld,",
+           star->length, threads, (long)usage.ru_maxrss);
+    printf("\"stages\":{");
+    for (i = 0; i < SCAN_STAGES; i++) {
+        printf("%s\"%s\":{\"wall_seconds\":%.6f,\"cpu_seconds\":%.6f}",
+               (i > 0) ? "," : "", stage_names[i],
+               stats->wall_seconds[i], stats->cpu_seconds[i]);
+    }
+    printf("},\"periods\":{\"evaluated\":%ld", evaluated);
+    for (i = 0; i < DETECT_OUTCOMES; i++) {
+        printf(",\"%s\":%ld", outcome_names[i], stats->search.periods[i]);
+    }
+    printf("}}}\n");
+}
@@ -58,3 +58,57 @@ void scan_name(char * filename, char * result)
     }
     result[ctr]=0;
 }
+
+/**
+ * @brief Fast Fourier transform of a real series, using the iterative
+ *        radix 2 Cooley-Tukey algorithm
+ * @param series Array of real values
+ * @param series_length The length of the series, which must be
+ *        a power of two
+ * @param freq Returned complex spectrum, as interleaved real and
+ *        imaginary parts, with 2*series_length entries
+ */
+void fft1D(float series[], int series_length, float freq[])
+{
+    double complex * data, w, step, even, odd;
+    int i, j, bit, length, half;
+
+    memset(freq, 0, series_length*2*sizeof(float));
+    if ((series_length < 1) ||
+        ((series_length & (series_length - 1)) != 0)) {
+        return;
+    }
+
+    data = (double complex*)malloc(series_length*sizeof(double complex));
+    if (data == NULL) return;
+
+    /* bit reversed order */
+    for (i = 0, j = 0; i < series_length; i++) {
+        data[j] = series[i];
+        for (bit = series_length >> 1; (bit > 0) && (j & bit); bit >>= 1) {
+            j ^= bit;
+        }
+        j |= bit;
+    }
+
+    for (length = 2; length <= series_length; length <<= 1) {
+        half = length >> 1;
+        step = cexp(-2.0*M_PI*I/length);
+        for (i = 0; i < series_length; i += length) {
+            w = 1;
+            for (j = 0; j < half; j++) {
+                even = data[i+j];
+                odd = data[i+j+half]*w;
+                data[i+j] = even + odd;
+                data[i+j+half] = even - odd;
+                w *= step;
+            }
+        }
+    }
+
+    for (i = 0; i < series_length; i++) {
+        freq[i*2] = (float)creal(data[i]);
+        freq[i*2+1] = (float)cimag(data[i]);
+    }
+    free(data);
+}
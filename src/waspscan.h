@@ -21,6 +21,7 @@
 #define WASPSCAN_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
@@ -33,23 +34,453 @@
    be located because they'll be skipped over */
 #define SEARCH_INCREMENT_DAYS 0.00001
 
-/* Maximum number of steps in a search between min/max orbital periods */
-#define MAX_SEARCH_STEPS      1000000
+/* Default number of period grid steps for each light curve bucket
+   of phase drift across the observation baseline */
+#define GRID_OVERSAMPLE       1.0f
 
-/* Maximum length of a series of values loaded from a log file */
-#define MAX_SERIES_LENGTH     100000
+/* smallest block of memory allocated for the buffers of a star,
+   and the alignment of each buffer */
+#define ARENA_BLOCK_SIZE      (1024*1024)
+#define ARENA_ALIGN           64
+
+/* length of the light curve used for transit detection */
+#define DETECT_CURVE_LENGTH   256
+
+/* maximum length of a light curve which can be folded */
+#define FOLD_MAX_CURVE_LENGTH 512
+
+/* Period tiling: each thread folds a tile of periods together,
+   sweeping the samples in chunks which stay within the L2 cache.
+   The default chunk of 16384 samples is 192KB of ticks, magnitudes
+   and weights. */
+#define FOLD_MAX_TILE_PERIODS     64
+#define FOLD_TILE_PERIODS         8
+#define FOLD_TILE_SAMPLES         16384
+
+/* maximum number of series with the same sample times which are
+   folded together, so that the phase of each sample is found once */
+#define FOLD_MAX_COLUMNS      2
+
+/* kernels used to fold samples into light curve buckets */
+#define FOLD_KERNEL_SCALAR    0
+#define FOLD_KERNEL_SSE42     1
+#define FOLD_KERNEL_AVX2      2
+#define FOLD_KERNEL_AVX512    3
+
+/* Coarse to fine search: number of light curve buckets for the
+   coarse pass, ratio between grid steps of successive stages,
+   half width of the window searched around each survivor in units
+   of the previous step and default number of survivors */
+#define HIERARCHICAL_CURVE_LENGTH 64
+#define HIERARCHICAL_REFINE       4
+#define HIERARCHICAL_WINDOW       2
+#define HIERARCHICAL_CANDIDATES   16
+
+/* Pre-screen of each star: samples within this many hours are
+   averaged when looking for dips, individual samples are clipped to
+   this many standard deviations first, a dip must be this significant
+   and there must be at least this many separate dips to fold. The
+   coarse search uses a sparser grid than the hierarchical search, and
+   stars pass if its signal to noise reaches the threshold. */
+#define PRESCREEN_WINDOW_HOURS  1.0
+#define PRESCREEN_CLIP          4.0f
+#define PRESCREEN_DIP_SIGMA     3.0f
+#define PRESCREEN_MIN_DIPS      2
+#define PRESCREEN_OVERSAMPLE    0.25f
+#define PRESCREEN_THRESHOLD     10.0f
+
+/* default length of the time bins within which samples are averaged
+   before the search, as a fraction of one bucket of the light curve
+   at the minimum period */
+#define PREBIN_FRACTION         0.25f
+
+/* Daemon which searches the stars listed in a bulk download script:
+   default number of concurrent downloads, most stars which may be
+   fetched ahead of the search, stars loaded ahead of the search,
+   attempts at each download, seconds without data before a download
+   is abandoned, redirects followed and the longest line read */
+#define DAEMON_FETCHERS         4
+#define DAEMON_MAX_AHEAD        64
+#define DAEMON_SLOTS            2
+#define DAEMON_RETRIES          3
+#define DAEMON_TIMEOUT_SECONDS  60
+#define DAEMON_REDIRECTS        5
+#define DAEMON_LINE_LENGTH      4096
+
+/* Claims of work shared between daemons: default lines of the script
+   in a batch, seconds before an abandoned lease may be taken over,
+   renewals within each lease and seconds between looks for abandoned
+   batches once every batch has been claimed */
+#define DAEMON_CLAIM_SIZE       16
+#define DAEMON_LEASE_SECONDS    600
+#define DAEMON_RENEWALS         4
+#define DAEMON_CLAIM_POLL       10
+
+/* results of an attempt to claim a batch */
+#define CLAIM_LEASED            0
+#define CLAIM_CLAIMED           1
+#define CLAIM_DONE              2
+
+/* Box least squares: shortest and longest transits searched as a
+   fraction of the orbital period, and the least number of unclipped
+   samples inside and outside of a transit */
+#define BLS_MIN_DURATION        0.005
+#define BLS_MAX_DURATION        0.15
+#define BLS_MIN_TRANSIT_SAMPLES 10
+
+/* Box least squares: standard deviations above the median beyond which
+   samples are clipped. Samples below the median are never clipped,
+   since they may be within the transit. */
+#define BLS_CLIP_SIGMA          3.0f
+
+/* Heuristic: standard deviations either side of the median beyond which
+   samples are clipped. The standard deviation is estimated from the
+   median absolute deviation, so that outliers don't widen the bounds
+   and the bounds are wide enough to keep the transit. */
+#define DETECT_CLIP_SIGMA       2.0f
+
+/* the method used to score trial orbital periods */
+#define DETECT_METHOD_HEURISTIC 0
+#define DETECT_METHOD_BLS       1
+#define DETECT_METHOD_LS        2
+
+/* Lomb-Scargle periodogram: frequencies per resolution element,
+   the fraction of the variance explained by a sinusoid above which
+   a frequency is dominated by variability of the star, and the
+   spectral window above which it is dominated by sampling aliases */
+#define PERIODOGRAM_OVERSAMPLE  4
+#define PERIODOGRAM_VARIABILITY 0.1f
+#define PERIODOGRAM_ALIAS       0.5f
+
+/* Candidate periods: peaks kept by each thread for every distinct
+   candidate reported, the highest harmonic ratio and the number of
+   sidereal days which make one peak an alias of another, and the
+   length of a sidereal day */
+#define DETECT_CANDIDATE_POOL   8
+#define DETECT_HARMONICS        4
+#define DETECT_DAY_ALIASES      2
+#define DETECT_SIDEREAL_DAY     0.99726957
+
+/* A search which is checkpointed is split into chunks of this many
+   trial periods, and the best peaks so far are saved after a chunk
+   once this many seconds have passed since they were last saved */
+#define CHECKPOINT_PERIODS      16384
+#define CHECKPOINT_SECONDS      60
+
+/* outcome of scoring a trial period */
+#define DETECT_SCORED              0
+#define DETECT_MASKED              1  /* skipped by --ls-prescreen */
+#define DETECT_TOO_FEW_SAMPLES     2
+#define DETECT_MISSING_DATA        3  /* too many empty buckets */
+#define DETECT_GAPS                4  /* some empty buckets */
+#define DETECT_NO_DIP              5
+#define DETECT_TOO_MANY_DIPPED     6
+#define DETECT_TOO_MANY_NONDIPPED  7
+#define DETECT_OUTCOMES            8
+
+/* stages of searching a star which are timed */
+#define SCAN_STAGE_LOAD       0
+#define SCAN_STAGE_ENDPOINTS  1
+#define SCAN_STAGE_PREBIN     2
+#define SCAN_STAGE_PRESCREEN  3
+#define SCAN_STAGE_SEARCH     4
+#define SCAN_STAGE_PLOT       5
+#define SCAN_STAGES           6
+
+/* format of the statistics reported for each star */
+#define SCAN_STATS_NONE  0
+#define SCAN_STATS_JSON  1
+
+/* format of the results reported for each star */
+#define SCAN_OUTPUT_TEXT  0
+#define SCAN_OUTPUT_JSON  1
+#define SCAN_OUTPUT_CSV   2
+
+/* status of a star listed for the daemon which couldn't be downloaded */
+#define SCAN_STATUS_NOT_FETCHED  4
 
 /* the type of table */
 #define TABLE_TYPE_WASP 0
 #define TABLE_TYPE_K2   1
 
+/* columns of a table which may be loaded, see table_layout */
+#define TABLE_COLUMN_TIME       0
+#define TABLE_COLUMN_FLUX       1  /* flux which is searched */
+#define TABLE_COLUMN_ERROR      2  /* error of the searched flux */
+#define TABLE_COLUMN_RAW_FLUX   3  /* flux before TAMUZ correction */
+#define TABLE_COLUMN_RAW_ERROR  4  /* error of the raw flux */
+#define TABLE_COLUMN_FLAG       5  /* samples with any flag are dropped */
+#define TABLE_COLUMNS           6
+
+/* the program used to draw plots */
+#define PLOTTER_NATIVE  0
+#define PLOTTER_GNUPLOT 1
+
+/* Memory for the buffers of one star, released all at once */
+typedef struct arena_block arena_block;
+typedef struct {
+    arena_block * blocks;     /* most recently allocated first */
+    size_t capacity;          /* total size of all blocks */
+} arena;
+
+/* Counters of a period search */
+typedef struct {
+    long periods[DETECT_OUTCOMES];  /* trial periods by outcome */
+    int threads;                    /* threads which scored periods */
+} detect_statistics;
+
+/* Saves a period search in progress, so that it can be resumed */
+typedef struct {
+    char filename[256];
+    double interval_seconds;  /* least time between saves */
+    uint64_t key;             /* identifies the series and the search */
+} search_checkpoint;
+
+/* A possible transit found by a period search */
+typedef struct {
+    float period_days;        /* orbital period */
+    float score;              /* response of the detection method */
+    float depth;              /* drop in magnitude during the transit */
+    float duration_days;      /* length of the transit */
+    double epoch_days;        /* time of the middle of a transit */
+    float snr;                /* depth relative to the noise */
+    int aliases;              /* weaker peaks grouped with this one */
+} transit_candidate;
+
+/* Values calculated once for a series and then reused
+   for every trial orbital period */
+typedef struct fold_context {
+    int length;               /* number of samples */
+    uint32_t * ticks;         /* sample times since the origin in ticks */
+    int ticks_shared;         /* non-zero if the ticks belong to the
+                                 context of another series */
+    int tick_shift;           /* there are 2^tick_shift ticks per day */
+    double origin_days;       /* time of the earliest sample in days */
+    double baseline_days;     /* time between the first and last samples */
+    float * series;           /* sample magnitudes */
+    float mean;               /* mean magnitude */
+    float variance;           /* standard deviation of magnitudes */
+    float median;             /* median magnitude */
+    float scatter;            /* robust standard deviation of magnitudes,
+                                 see detect_scatter */
+    float * inlier;           /* 0 for clipped samples, otherwise 1 or the
+                                 weight of the sample */
+    float * weight;           /* weight of each sample, or NULL */
+    float * bin_squares;      /* squared deviations within each bin, or NULL */
+    int clip_method;          /* method the samples were clipped for,
+                                 see fold_context_clip */
+    double squares;           /* squared deviations of samples which were
+                                 averaged together, see fold_context_weight */
+    int tile_periods;         /* periods folded together by each thread */
+    int tile_samples;         /* samples folded for each period in turn */
+    detect_statistics * statistics; /* counters of the search, or NULL */
+    search_checkpoint * checkpoint; /* saving of the search, or NULL */
+    struct fold_context * companion; /* series with the same sample times
+                                        searched in the same pass, or NULL */
+    transit_candidate * results;     /* returned candidates of a companion,
+                                        allocated by the caller */
+    int no_of_results;               /* number of candidates returned */
+} fold_context;
+
+/* Moments of the samples within each light curve bucket */
+typedef struct {
+    float count[FOLD_MAX_CURVE_LENGTH];       /* number of samples */
+    float inliers[FOLD_MAX_CURVE_LENGTH];     /* number of unclipped samples */
+    float sum[FOLD_MAX_CURVE_LENGTH];         /* sum of unclipped magnitudes */
+    float sum_squares[FOLD_MAX_CURVE_LENGTH]; /* sum of squared unclipped
+                                                 deviations from the mean */
+} fold_moments;
+
+/* Folds a range of samples by orbital phase into the light curve
+   buckets of each lane, for the series and any companion */
+typedef void (*fold_accumulate_function)(fold_context * fold,
+                                         uint64_t multiplier,
+                                         int curve_length, int columns,
+                                         int start, int end,
+                                         float lanes[]);
+
+/* Lomb-Scargle periodogram at multiples of a frequency increment */
+typedef struct {
+    int length;               /* number of frequencies */
+    int samples;              /* number of samples in the light curve */
+    double freq_increment;    /* cycles per day between frequencies */
+    float * power;            /* power normalised by the variance */
+    float * window;           /* spectral window of the sampling times */
+    unsigned char * masked;   /* non-zero if not worth searching */
+} periodogram;
+
+/* Measurements made by the pre-screen of a star */
+typedef struct {
+    float median;             /* median magnitude */
+    float scatter;            /* robust standard deviation */
+    int outliers;             /* samples below the median by more than
+                                 PRESCREEN_DIP_SIGMA times the scatter */
+    int dips;                 /* separate times when the average over
+                                 the window was significantly low */
+    int periods;              /* trial periods of the coarse search */
+    float period_days;        /* best period of the coarse search */
+    float snr;                /* signal to noise of the best period */
+} prescreen_result;
+
+/* A light curve whose samples have been averaged within time bins */
+typedef struct {
+    int length;               /* number of bins */
+    double * timestamp;       /* mean time of the samples in each bin */
+    float * series;           /* mean magnitude of each bin */
+    float * weight;           /* total weight of the samples within each
+                                 bin, which is their number unless they
+                                 were weighted */
+    float * squares;          /* weighted sum of squared deviations of the
+                                 samples within each bin from their mean */
+} prebinned_series;
+
+/* Names and indexes of the columns of a table to be loaded, see
+   TABLE_COLUMN_TIME. Columns whose index is negative aren't loaded. */
+typedef struct {
+    char * name[TABLE_COLUMNS]; /* name within the header, or NULL */
+    int index[TABLE_COLUMNS];   /* index within each row */
+} table_layout;
+
+/* A light curve with an array for each column of the table, all of
+   which are loaded in a single pass. Columns which weren't loaded
+   are NULL. */
+typedef struct {
+    int length;               /* number of samples */
+    double * timestamp;       /* sample times in seconds */
+    float * series;           /* magnitudes which are searched */
+    float * error;            /* errors of the magnitudes */
+    float * raw_series;       /* magnitudes before TAMUZ correction */
+    float * raw_error;        /* errors of the raw magnitudes */
+} series_columns;
+
+/* Columns of a light curve memory mapped from a cache file */
+typedef struct {
+    series_columns columns;   /* arrays within the mapping */
+    void * mapping;           /* start of the memory mapped file */
+    size_t mapping_size;      /* size of the memory mapped file */
+} series_cache;
+
+/* Options which control how stars are loaded and searched */
+typedef struct {
+    int minimum_data_samples;
+    float minimum_period_days;
+    float maximum_period_days;
+    float known_period_days;
+    int table_type;
+    char table_name[256];     /* table within a fits file, or empty */
+    int table_index;          /* index of the table if there is no name */
+    float vertical_scale;
+    float increment_days;     /* fixed grid increment, or zero */
+    float oversample;
+    int hierarchical;
+    int max_candidates;
+    int use_cache;
+    int plotter;              /* PLOTTER_NATIVE or PLOTTER_GNUPLOT */
+    int method;               /* DETECT_METHOD_HEURISTIC, _BLS or _LS */
+    int ls_prescreen;         /* skip periods dominated by variability */
+    int max_results;          /* number of distinct candidates reported */
+    int tile_periods;         /* periods folded together by each thread */
+    int tile_samples;         /* samples folded for each period in turn */
+    int stats;                /* SCAN_STATS_NONE or SCAN_STATS_JSON */
+    int output;               /* SCAN_OUTPUT_TEXT, _JSON or _CSV */
+    int prescreen;            /* non-zero to pre-screen each star */
+    float prescreen_threshold; /* signal to noise needed to pass */
+    int prebin;               /* non-zero to average samples before the
+                                 search */
+    float prebin_fraction;    /* length of the bins as a fraction of a
+                                 bucket at the minimum period */
+    int weighted;             /* non-zero to weight samples by the inverse
+                                 variance of their errors */
+    int raw_flux;             /* non-zero to also search the flux before
+                                 TAMUZ correction */
+    int keep_flagged;         /* non-zero to keep flagged samples */
+    int plot;                 /* non-zero if plots are drawn */
+    char checkpoint[256];     /* file where the search is saved, or empty */
+    float checkpoint_seconds; /* least time between saves */
+} scan_parameters;
+
+/* Options of the daemon */
+typedef struct {
+    char log[256];            /* bulk download script, one star a line */
+    char working_dir[256];    /* downloads, candidates and the cursor */
+    char mirror[256];         /* local directory used in place of the
+                                 urls, or empty */
+    char cursor[256];         /* next line to search, within working_dir */
+    int fetchers;             /* concurrent downloads */
+    int ahead;                /* stars fetched ahead of the search */
+    float start_percent;      /* range of lines within the log */
+    float end_percent;
+    char claims[256];         /* directory shared with other daemons,
+                                 or empty */
+    char node[64];            /* name of this daemon within claims */
+    int claim_size;           /* lines of the script in a batch */
+    float lease_seconds;      /* time before a lease may be taken over */
+} daemon_parameters;
+
+/* Time spent on each stage of searching a star */
+typedef struct {
+    double wall_seconds[SCAN_STAGES];
+    double cpu_seconds[SCAN_STAGES];
+    detect_statistics search;
+} scan_stats;
+
+/* The light curve of a star */
+typedef struct {
+    char filename[256];
+    char name[256];
+    int length;               /* number of samples */
+    double * timestamp;       /* sample times in seconds */
+    float * series;           /* sample magnitudes */
+    float * error;            /* errors of the magnitudes, or NULL */
+    float * raw_series;       /* magnitudes before TAMUZ correction,
+                                 or NULL */
+    float * raw_error;        /* errors of the raw magnitudes, or NULL */
+    float * weight;           /* inverse variance weight of each sample,
+                                 or NULL */
+    float * raw_weight;       /* weights of the raw magnitudes, or NULL */
+    arena memory;             /* buffers unless a cache is used */
+    series_cache cache;
+    scan_stats stats;
+    prescreen_result prescreen;
+    prebinned_series binned;  /* searched in place of the samples if
+                                 there are any bins */
+    prebinned_series raw_binned; /* bins of the raw magnitudes */
+    transit_candidate * results; /* best candidates, from the arena */
+    int no_of_results;
+    transit_candidate * raw_results; /* best candidates of the raw
+                                        magnitudes, from the arena */
+    int no_of_raw_results;
+} scan_series;
+
 float detect_mean(float series[], int series_length);
 float detect_variance(float series[], int series_length, float mean);
-int logfile_load(char * filename, float timestamp[],
-                 float series[], int max_series_length,
+int detect_scatter(float series[], int series_length,
+                   float * median, float * scatter);
+int detect_weighted_scatter(float series[], float weight[],
+                            int series_length,
+                            float * median, float * scatter);
+void * arena_alloc(arena * mem, size_t size);
+void arena_reset(arena * mem);
+void arena_free(arena * mem);
+int logfile_load(char * filename, double ** timestamp,
+                 float ** series, arena * mem,
+                 char * time_field_name, char * flux_field_name,
                  int time_field_index, int flux_field_index);
+int logfile_load_fields(char * filename,
+                        int no_of_fields, char * field_name[],
+                        int field_index[], double * field_values[],
+                        int optional[], int flag_field, arena * mem);
+int logfile_load_columns(char * filename, table_layout * layout,
+                         arena * mem, series_columns * result);
+int cache_open(char * filename, char * columns, series_cache * cache);
+void cache_close(series_cache * cache);
+int cache_save(char * filename, char * columns, series_columns * loaded);
+int fits_is_fits(char * filename);
+int fits_load(char * filename,
+              char * table_name, int table_index,
+              table_layout * layout, arena * mem, series_columns * result);
 int gnuplot_distribution(char * title,
-                         float timestamp[],
+                         double timestamp[],
                          float series[], int series_length,
                          char * image_filename,
                          int image_width, int image_height,
@@ -57,7 +488,7 @@ int gnuplot_distribution(char * title,
                          float subtitle_indent_vertical,
                          char * axis_label);
 int gnuplot_light_curve(char * title,
-                        float timestamp[],
+                        double timestamp[],
                         float series[], int series_length,
                         char * image_filename,
                         int image_width, int image_height,
@@ -67,7 +498,7 @@ int gnuplot_light_curve(char * title,
                         float period_days,
                         float vertical_scale);
 int gnuplot_light_curve_distribution(char * title,
-                                     float timestamp[],
+                                     double timestamp[],
                                      float series[], int series_length,
                                      char * image_filename,
                                      int image_width, int image_height,
@@ -76,20 +507,142 @@ int gnuplot_light_curve_distribution(char * title,
                                      char * axis_label,
                                      float period_days,
                                      float vertical_scale);
+int png_write(char * filename, unsigned char * pixels,
+              int width, int height,
+              unsigned char palette[][3], int palette_size);
+int plot_light_curve(char * title,
+                     double timestamp[],
+                     float series[], int series_length,
+                     char * image_filename,
+                     int image_width, int image_height,
+                     float subtitle_indent_horizontal,
+                     float subtitle_indent_vertical,
+                     char * axis_label,
+                     float period_days,
+                     float vertical_scale);
+int plot_light_curve_distribution(char * title,
+                                  double timestamp[],
+                                  float series[], int series_length,
+                                  char * image_filename,
+                                  int image_width, int image_height,
+                                  float subtitle_indent_horizontal,
+                                  float subtitle_indent_vertical,
+                                  char * axis_label,
+                                  float period_days,
+                                  float vertical_scale);
 void fft1D(float series[], int series_length, float freq[]);
-int detect_endpoints(float timestamp[], int series_length,
+int detect_endpoints(double timestamp[], int series_length,
                      int endpoints[]);
-int light_curve(float timestamp[],
+int light_curve(double timestamp[],
                 float series[], int series_length,
                 float period_days,
                 float curve[], float density[], int curve_length);
 void scan_name(char * filename, char * result);
-float detect_orbital_period(float timestamp[],
-                            float series[], int series_length,
-                            float min_period_days,
-                            float max_period_days,
-                            float increment_days);
+int detect_orbital_period(fold_context * fold,
+                          float periods[], int no_of_periods, int method,
+                          transit_candidate results[], int max_results);
+uint64_t checkpoint_key(fold_context * fold,
+                        float periods[], int no_of_periods,
+                        int curve_length, int method, int max_length);
+int checkpoint_load(search_checkpoint * checkpoint, int no_of_periods,
+                    int columns, transit_candidate list[], int length[],
+                    int max_length, long outcomes[]);
+int checkpoint_save(search_checkpoint * checkpoint, int no_of_periods,
+                    int next_period, int columns, transit_candidate list[],
+                    int length[], int max_length, long outcomes[]);
+void checkpoint_remove(search_checkpoint * checkpoint);
+
+int claim_layout(char * directory, long no_of_lines, int batch_size);
+int claim_batch(char * directory, char * node, int batch,
+                double lease_seconds, long * next_line);
+int claim_renew(char * directory, char * node, int batch, long next_line);
+int claim_done(char * directory, char * node, int batch);
+int detect_orbital_period_hierarchical(fold_context * fold,
+                                       float min_period_days,
+                                       float max_period_days,
+                                       float oversample,
+                                       int max_candidates,
+                                       int method,
+                                       periodogram * mask,
+                                       transit_candidate results[],
+                                       int max_results,
+                                       int * evaluated);
+float bls_moments_response(fold_context * fold, fold_moments * moments,
+                           float period_days, int curve_length,
+                           transit_candidate * candidate);
+float bls_period_response(fold_context * fold,
+                          float period_days, int curve_length,
+                          transit_candidate * candidate,
+                          float workspace[]);
 int detect_phase_offset(float curve[], int curve_length);
 void adjust_curve(float curve[], int curve_length, int offset);
+int missing_data(float density[], int curve_length);
+double fold_time_origin(double timestamp[], int series_length);
+int fold_context_init(fold_context * fold,
+                      double timestamp[],
+                      float series[], int series_length);
+int fold_context_companion(fold_context * fold, fold_context * companion,
+                           float series[]);
+void fold_context_free(fold_context * fold);
+void fold_context_clip(fold_context * fold, int method);
+void fold_error_weights(float error[], int series_length, float weight[]);
+void fold_context_weight(fold_context * fold, float weight[],
+                         float squares[]);
+int fold_moments_curve(fold_moments * moments,
+                       float curve[], float density[], int curve_length);
+int fold_light_curve(fold_context * fold,
+                     float period_days,
+                     float curve[], float density[], int curve_length);
+void fold_bin_scalar(fold_context * fold, double period_days,
+                     int curve_length, fold_moments * moments);
+void fold_bin(fold_context * fold, double period_days,
+              int curve_length, fold_moments * moments,
+              float workspace[]);
+int fold_bin_workspace(fold_context * fold, int curve_length);
+void fold_bin_tile(fold_context * fold, float period_days[],
+                   int no_of_periods, int curve_length,
+                   fold_moments moments[], float workspace[]);
+int fold_kernel_select(int kernel);
+const char * fold_kernel_name(int kernel);
+int periodogram_init(periodogram * pg,
+                     double timestamp[], float series[], int series_length,
+                     float min_period_days, float oversample);
+void periodogram_free(periodogram * pg);
+float periodogram_best_period(periodogram * pg,
+                              float min_period_days, float max_period_days,
+                              float * power);
+int periodogram_masked(periodogram * pg, double freq);
+int periodogram_mask_periods(periodogram * pg,
+                             float periods[], int no_of_periods);
+int period_grid_uniform(float min_period_days, float max_period_days,
+                        float increment_days, float ** periods);
+double period_grid_frequency_increment(fold_context * fold,
+                                       int curve_length, float oversample);
+int period_grid_adaptive(fold_context * fold,
+                         float min_period_days, float max_period_days,
+                         int curve_length, float oversample,
+                         float ** periods);
+int prescreen_star(double timestamp[], float series[], int series_length,
+                   float min_period_days, float max_period_days,
+                   float threshold, prescreen_result * result);
+int prebin_series(double timestamp[], float series[], float weight[],
+                  int series_length, int endpoints[], double bin_seconds,
+                  arena * memory, prebinned_series * result);
+void scan_parameters_init(scan_parameters * params);
+int scan_load(scan_parameters * params, char * filename,
+              scan_series * star);
+void scan_series_release(scan_series * star);
+void scan_series_free(scan_series * star);
+int scan_search(scan_parameters * params, scan_series * star,
+                float * orbital_period_days);
+void scan_plot(scan_parameters * params, scan_series * star,
+               float orbital_period_days);
+const char * scan_status_name(int status);
+void scan_report_header(scan_parameters * params);
+void scan_report(scan_parameters * params, scan_series * star, int status);
+void scan_stats_report(scan_parameters * params, scan_series * star);
+int batch_run(scan_parameters * params, char * path);
+void daemon_parameters_init(daemon_parameters * daemon);
+int daemon_run(scan_parameters * params, daemon_parameters * daemon);
 
 #endif
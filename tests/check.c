@@ -0,0 +1,383 @@
+/*
+  WASPscan: Detection of exoplanet transits
+  Copyright (C) 2015 Bob Mottram
+  bob@robotics.uk.to
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Checks of the numerical building blocks of the search, run with
+   make check. Unlike the benchmark nothing is timed, and the exit
+   status is the number of checks which failed. */
+
+#include "waspscan.h"
+#include "synth.h"
+
+/* number of samples within the checked series */
+#define CHECK_SAMPLES         20000
+
+/* number of trial periods at which the fold kernels are compared */
+#define CHECK_KERNEL_PERIODS  100
+
+/* relative difference in the moments allowed between kernels, which
+   sum the samples in a different order */
+#define CHECK_KERNEL_TOLERANCE  1.0e-4
+
+/* length of the transformed series, and the frequencies of a cosine
+   and a sine within it in cycles per series */
+#define CHECK_FFT_LENGTH      256
+#define CHECK_FFT_COSINE      10
+#define CHECK_FFT_SINE        37
+
+/* period of the sinusoid given to the periodogram in days, and the
+   relative error allowed in the recovered period */
+#define CHECK_PERIODOGRAM_PERIOD     3.7
+#define CHECK_PERIODOGRAM_TOLERANCE  0.01
+
+/* relative error allowed in the period of the synthetic transit */
+#define CHECK_TRANSIT_TOLERANCE  1.0e-3
+
+/* relative error allowed in the scatter of samples found from bins */
+#define CHECK_SCATTER_TOLERANCE  0.1
+
+/**
+ * @brief Prints the outcome of a check
+ * @param name Name of the check
+ * @param passed Non-zero if the check passed
+ * @returns One if the check failed, otherwise zero
+ */
+static int check_report(const char * name, int passed)
+{
+    printf("%-40s %s\n", name, passed ? "ok" : "FAILED");
+    return passed ? 0 : 1;
+}
+
+/**
+ * @brief Returns a repeatable uniformly distributed random number
+ * @param state State of the generator
+ * @returns Random number in the range 0 to 1
+ */
+static double check_uniform(unsigned int * state)
+{
+    *state = *state*1103515245u + 12345u;
+    return ((*state >> 8) & 0xffffff) / 16777216.0;
+}
+
+/**
+ * @brief Creates a series of nightly observations with noise
+ * @param timestamp Returned imaging times in seconds
+ * @param series Returned magnitudes
+ * @param length The number of samples
+ */
+static void check_series(double timestamp[], float series[], int length)
+{
+    unsigned int state = 1;
+    int i;
+
+    for (i = 0; i < length; i++) {
+        /* 200 samples each night, two minutes apart */
+        timestamp[i] = 1.0e8 + (i / 200)*86400.0 + (i % 200)*120.0;
+        series[i] = (float)(1000.0 + 10.0*(check_uniform(&state) - 0.5));
+    }
+}
+
+/**
+ * @brief Checks that every fold kernel which the CPU supports gives the
+ *        same moments as the scalar kernel
+ * @returns The number of failed checks
+ */
+static int check_fold_kernels(void)
+{
+    double timestamp[CHECK_SAMPLES], period_days, difference;
+    float series[CHECK_SAMPLES];
+    fold_moments reference, moments;
+    fold_context fold;
+    float * workspace;
+    int kernel, i, j, passed, failures = 0;
+    int default_kernel;
+    char name[64];
+
+    check_series(timestamp, series, CHECK_SAMPLES);
+    if (fold_context_init(&fold, timestamp, series, CHECK_SAMPLES) != 0) {
+        return check_report("fold context", 0);
+    }
+    /* the workspace is sized for the most capable kernel */
+    default_kernel = fold_kernel_select(-1);
+    workspace = (float*)malloc(fold_bin_workspace(&fold, DETECT_CURVE_LENGTH)*
+                               sizeof(float));
+    if (workspace == NULL) {
+        fold_context_free(&fold);
+        return check_report("fold workspace", 0);
+    }
+
+    for (kernel = FOLD_KERNEL_SCALAR; kernel <= FOLD_KERNEL_AVX512;
+         kernel++) {
+        if (fold_kernel_select(kernel) != kernel) continue;
+        passed = 1;
+        for (i = 0; i < CHECK_KERNEL_PERIODS; i++) {
+            period_days = 0.5 + 9.5*i/CHECK_KERNEL_PERIODS;
+            fold_bin_scalar(&fold, period_days, DETECT_CURVE_LENGTH,
+                            &reference);
+            fold_bin(&fold, period_days, DETECT_CURVE_LENGTH, &moments,
+                     workspace);
+            for (j = 0; j < DETECT_CURVE_LENGTH; j++) {
+                if (moments.count[j] != reference.count[j]) passed = 0;
+                difference =
+                    fabs(moments.inliers[j] - reference.inliers[j]) /
+                    (fabs(reference.inliers[j]) + 1) +
+                    fabs(moments.sum[j] - reference.sum[j]) /
+                    (fabs(reference.sum[j]) + 1) +
+                    fabs(moments.sum_squares[j] - reference.sum_squares[j]) /
+                    (fabs(reference.sum_squares[j]) + 1);
+                if (difference > CHECK_KERNEL_TOLERANCE) passed = 0;
+            }
+        }
+        sprintf(name, "fold kernel %s", fold_kernel_name(kernel));
+        failures += check_report(name, passed);
+    }
+    fold_kernel_select(default_kernel);
+    free(workspace);
+    fold_context_free(&fold);
+    return failures;
+}
+
+/**
+ * @brief Checks the transform of a constant, a cosine and a sine, each
+ *        of which should appear only at its own frequency with the
+ *        expected amplitude and phase
+ * @returns The number of failed checks
+ */
+static int check_fft(void)
+{
+    float series[CHECK_FFT_LENGTH], freq[CHECK_FFT_LENGTH*2];
+    double expected_real, expected_imaginary, error = 0;
+    int i, n = CHECK_FFT_LENGTH;
+
+    for (i = 0; i < n; i++) {
+        series[i] =
+            (float)(2.0 + cos(2*M_PI*CHECK_FFT_COSINE*i/n) +
+                    0.5*sin(2*M_PI*CHECK_FFT_SINE*i/n));
+    }
+    fft1D(series, n, freq);
+
+    for (i = 0; i < n; i++) {
+        expected_real = 0;
+        expected_imaginary = 0;
+        if (i == 0) expected_real = 2.0*n;
+        if ((i == CHECK_FFT_COSINE) || (i == n - CHECK_FFT_COSINE)) {
+            expected_real = 0.5*n;
+        }
+        if (i == CHECK_FFT_SINE) expected_imaginary = -0.25*n;
+        if (i == n - CHECK_FFT_SINE) expected_imaginary = 0.25*n;
+        error += fabs(freq[i*2] - expected_real) +
+            fabs(freq[i*2+1] - expected_imaginary);
+    }
+    return check_report("fft of a known tone", error < 1.0e-3*n);
+}
+
+/**
+ * @brief Checks that the Lomb-Scargle periodogram finds the period of
+ *        a sinusoid within nightly observations with noise
+ * @returns The number of failed checks
+ */
+static int check_periodogram(void)
+{
+    double timestamp[CHECK_SAMPLES], days;
+    float series[CHECK_SAMPLES], period_days, power;
+    periodogram pg;
+    int i;
+
+    check_series(timestamp, series, CHECK_SAMPLES);
+    for (i = 0; i < CHECK_SAMPLES; i++) {
+        days = (timestamp[i] - timestamp[0]) / (60.0*60.0*24.0);
+        series[i] +=
+            (float)(5.0*sin(2*M_PI*days/CHECK_PERIODOGRAM_PERIOD));
+    }
+    if (periodogram_init(&pg, timestamp, series, CHECK_SAMPLES,
+                         0.5f, PERIODOGRAM_OVERSAMPLE) != 0) {
+        return check_report("periodogram", 0);
+    }
+    period_days = periodogram_best_period(&pg, 1, 10, &power);
+    periodogram_free(&pg);
+    return check_report("periodogram of a sinusoid",
+                        fabs(period_days - CHECK_PERIODOGRAM_PERIOD) <
+                        CHECK_PERIODOGRAM_TOLERANCE*CHECK_PERIODOGRAM_PERIOD);
+}
+
+/**
+ * @brief Checks that arena allocations of assorted sizes, including
+ *        ones larger than a block, are aligned for vector loads
+ * @returns The number of failed checks
+ */
+static int check_arena_alignment(void)
+{
+    arena mem;
+    void * ptr;
+    int i, passed = 1;
+
+    memset(&mem, 0, sizeof(arena));
+    for (i = 1; i < 64; i++) {
+        ptr = arena_alloc(&mem, (size_t)i*i*i*7);
+        if ((ptr == NULL) || (((size_t)ptr % ARENA_ALIGN) != 0)) passed = 0;
+        if (i == 32) arena_reset(&mem);
+    }
+    ptr = arena_alloc(&mem, ARENA_BLOCK_SIZE*3);
+    if ((ptr == NULL) || (((size_t)ptr % ARENA_ALIGN) != 0)) passed = 0;
+    arena_free(&mem);
+    return check_report("arena alignment", passed);
+}
+
+/**
+ * @brief Generates a synthetic light curve like the one used by the
+ *        benchmark and drops its flagged samples
+ * @param params Parameters of the light curve
+ * @param star Returned light curve
+ * @returns The number of samples kept, or zero on failure
+ */
+static int check_synthetic_star(synth_parameters * params,
+                                synth_series * star)
+{
+    int i, length = 0;
+
+    if (synth_generate(params, star) <= 0) return 0;
+    for (i = 0; i < star->length; i++) {
+        if (star->flag[i] != 0) continue;
+        star->timestamp[length] = star->timestamp[i];
+        star->series[length] = star->series[i];
+        length++;
+    }
+    return length;
+}
+
+/**
+ * @brief Searches a context between 2 and 2.5 days with the heuristic
+ * @param fold Context of the light curve
+ * @param result Returned best candidate
+ * @returns The number of candidates found
+ */
+static int check_heuristic_search(fold_context * fold,
+                                  transit_candidate * result)
+{
+    float * periods = NULL;
+    int no_of_periods, found = 0;
+
+    no_of_periods = period_grid_adaptive(fold, 2.0f, 2.5f,
+                                         DETECT_CURVE_LENGTH,
+                                         GRID_OVERSAMPLE, &periods);
+    if (no_of_periods > 0) {
+        found = detect_orbital_period(fold, periods, no_of_periods,
+                                      DETECT_METHOD_HEURISTIC, result, 1);
+    }
+    free(periods);
+    return found;
+}
+
+/**
+ * @brief Checks that the heuristic finds the transit of the synthetic
+ *        light curve used by the benchmark once its flagged samples
+ *        are dropped. The transit is only one and a half times deeper
+ *        than the noise, so clipping bounds which are too narrow lose
+ *        it and the search finds a daily alias instead.
+ * @returns The number of failed checks
+ */
+static int check_synthetic_search(void)
+{
+    synth_parameters params;
+    synth_series star;
+    transit_candidate result;
+    fold_context fold;
+    int length, found;
+
+    synth_parameters_init(&params);
+    length = check_synthetic_star(&params, &star);
+    if ((length == 0) ||
+        (fold_context_init(&fold, star.timestamp, star.series, length) != 0)) {
+        synth_free(&star);
+        return check_report("synthetic light curve", 0);
+    }
+    found = check_heuristic_search(&fold, &result);
+    fold_context_free(&fold);
+    synth_free(&star);
+    return check_report("heuristic search of a synthetic transit",
+                        (found > 0) &&
+                        (fabs(result.period_days - params.period_days) <
+                         CHECK_TRANSIT_TOLERANCE*params.period_days));
+}
+
+/**
+ * @brief Checks that the heuristic finds the transit of the synthetic
+ *        light curve once its samples have been averaged within bins,
+ *        as with --prebin. Samples are taken every minute, so that each
+ *        bin holds a few of them. The bin means scatter less than the
+ *        samples, so the robust scatter of the weighted bins is also
+ *        checked against that of the samples, which the bins are
+ *        clipped to.
+ * @returns The number of failed checks
+ */
+static int check_prebinned_search(void)
+{
+    synth_parameters params;
+    synth_series star;
+    transit_candidate result;
+    prebinned_series binned;
+    fold_context fold;
+    arena mem;
+    float median, scatter;
+    int * endpoints = NULL;
+    int length, found = 0, passed = 0, failures = 0;
+
+    memset(&mem, 0, sizeof(arena));
+    synth_parameters_init(&params);
+    params.cadence_seconds = 60.0f;
+    length = check_synthetic_star(&params, &star);
+    if (length > 0) endpoints = (int*)malloc((length*2 + 1)*sizeof(int));
+    if ((endpoints != NULL) &&
+        (detect_scatter(star.series, length, &median, &scatter) == 0) &&
+        (detect_endpoints(star.timestamp, length, endpoints) > 0) &&
+        (prebin_series(star.timestamp, star.series, NULL, length, endpoints,
+                       PREBIN_FRACTION*2.0*60.0*60.0*24.0/
+                       DETECT_CURVE_LENGTH, &mem, &binned) > 0) &&
+        (fold_context_init(&fold, binned.timestamp, binned.series,
+                           binned.length) == 0)) {
+        fold_context_weight(&fold, binned.weight, binned.squares);
+        failures += check_report("scatter of prebinned samples",
+                                 fabs(fold.scatter - scatter) <
+                                 CHECK_SCATTER_TOLERANCE*scatter);
+        found = check_heuristic_search(&fold, &result);
+        fold_context_free(&fold);
+        passed = (found > 0) &&
+            (fabs(result.period_days - params.period_days) <
+             CHECK_TRANSIT_TOLERANCE*params.period_days);
+    }
+    free(endpoints);
+    arena_free(&mem);
+    synth_free(&star);
+    return failures +
+        check_report("heuristic search of a prebinned transit", passed);
+}
+
+int main(int argc, char* argv[])
+{
+    int failures = 0;
+
+    failures += check_fold_kernels();
+    failures += check_fft();
+    failures += check_periodogram();
+    failures += check_arena_alignment();
+    failures += check_synthetic_search();
+    failures += check_prebinned_search();
+
+    printf("%d checks failed\n", failures);
+    return failures;
+}